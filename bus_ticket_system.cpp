@@ -4,15 +4,243 @@
 #include <fstream>
 #include <cstring>
 #include <cctype>
-#include <conio.h> // For _getch() to hide password
 #include <iomanip>
+#include <cstdint>
+#include <bitset>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <unordered_map>
+#include <map>
+#include <deque>
+#include <tuple>
+#include <algorithm>
+#include <numeric>
+#include <climits>
+#include <cmath>
+#include <cfloat>
+#include <cstdio>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <conio.h> // For _getch() to hide password
+#include <io.h>
+#include <direct.h>
+#include <fcntl.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <cerrno>
+#endif
+
+// SSE2/AVX2 scan filters, chosen at run time; other compilers and CPUs use
+// the scalar versions
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define X86_SIMD
+#endif
 
 using namespace std;
 
 // Constants
-const int MAX_BUSES = 50;
-const int MAX_TICKETS = 200;
 const int MAX_SEATS = 50;
+const int SEAT_WORDS = (MAX_SEATS + 63) / 64; // 64-bit words per seat map
+const int STORE_CHUNK_SIZE = 4096; // Records per storage chunk
+const int STORE_MAX_CHUNKS = 65536; // Chunk directory size (268M records per store)
+const int JOURNAL_GROUP_SIZE = 64;  // Records per fsync under group commit
+const int CHECKPOINT_INTERVAL = 10000; // Journal records between checkpoints
+const char* const JOURNAL_FILE = "journal.log";
+const char* const PREVIOUS_JOURNAL_FILE = "journal.log.prev"; // Records not yet in a written checkpoint
+const uint32_t DATA_FILE_MAGIC = 0x53544242; // "BBTS"
+const uint32_t DATA_FILE_VERSION = 5;
+const char* const CHECKPOINT_FILES[] = {"strings.dat", "buses.dat", "passengers.dat", "tickets.dat",
+                                        "busbills.dat", "waitlist.dat", "bushistory.dat"};
+const int BUS_LOCK_STRIPES = 256; // Per-bus booking locks (bus ID modulo stripes)
+const int SERVER_MAX_REQUEST = 4096; // Longest request line the server accepts
+const int SERVER_MAX_EVENTS = 64;    // epoll events handled per wakeup
+const int SERVER_MAX_FIELDS = SERVER_MAX_REQUEST / 2; // Fields a request line can hold
+const int IMPORT_BATCH_SIZE = 4096;  // Rows per bulk import batch
+const int SHARD_MAX = 64;            // Shards in a sharded deployment
+const int SHARD_RETRY_MS = 1000;     // Wait between reconnects to a shard that is down
+const int SHARD_RESPONSE_TIMEOUT_MS = 5000; // A shard this late with a response is taken down
+const int SHARD_TICK_MS = 100;       // How often a router checks shard deadlines
+const int FOLLOW_POLL_MS = 50;       // How often a follower checks the journal for new records
+const int FOLLOW_BATCH_RECORDS = 256; // Records a follower applies per hold of the write locks
+const int FOLLOW_LOAD_ATTEMPTS = 3;  // Checkpoint loads a follower tries per poll while one is written
+const int GROUP_MAX_SEATS = 1024;    // Seats per group booking (one journal record)
+const int SCAN_CHUNK_SIZE = 4096;    // Tickets copied per lock hold when scanning
+const int COMPACT_CHUNK_SIZE = 4096; // Ticket or bus slots compacted per lock hold
+const int EXPORT_BUFFER_SIZE = 1 << 20; // Bytes buffered per export write
+const int EXPORT_GROUP_ROWS = 65536;    // Rows per columnar row group
+const size_t ARENA_BLOCK_SIZE = 64 * 1024; // Bytes per arena block
+const size_t POOL_BLOCK_SIZE = 64 * 1024;  // Bytes per object pool block
+const size_t POOL_MAX_OBJECT = 256;        // Larger pool requests go to the heap
+const int HOLD_TICK_MS = 100;      // Resolution of seat hold expiry
+const int HOLD_MAX_SECONDS = 3600; // Longest a seat can be held
+const int JOURNEY_MAX_LEGS = 4;      // Buses per planned journey
+const int JOURNEY_DAYS = 2;          // Travel dates a planned journey may span
+const int JOURNEY_MIN_TRANSFER = 30; // Default minutes between connecting buses
+const int WAITLIST_MAX_PRIORITY = 9; // Waitlist priorities run from 0 to this
+const int BENCH_STEADY_CYCLES = 1000; // Book/cancel cycles checked for heap allocations
+
+// Index of the lowest set bit of a non-zero word
+inline int lowestSetBit(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+// Atomic operations on plain fields of records that booking threads
+// share. Records stay trivially copyable so they can be journaled and
+// mapped from disk as raw struct images.
+#ifdef _MSC_VER
+inline uint64_t atomicLoad(const uint64_t* target) {
+    return (uint64_t)_InterlockedOr64((volatile long long*)target, 0);
+}
+inline int atomicLoad(const int* target) {
+    return _InterlockedOr((volatile long*)target, 0);
+}
+inline bool atomicCompareExchange(uint64_t* target, uint64_t expected, uint64_t desired) {
+    return (uint64_t)_InterlockedCompareExchange64((volatile long long*)target, (long long)desired,
+                                                   (long long)expected) == expected;
+}
+inline int atomicFetchAdd(int* target, int delta) {
+    return _InterlockedExchangeAdd((volatile long*)target, delta);
+}
+#else
+inline uint64_t atomicLoad(const uint64_t* target) {
+    return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+}
+inline int atomicLoad(const int* target) {
+    return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+}
+inline bool atomicCompareExchange(uint64_t* target, uint64_t expected, uint64_t desired) {
+    return __atomic_compare_exchange_n(target, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+inline int atomicFetchAdd(int* target, int delta) {
+    return __atomic_fetch_add(target, delta, __ATOMIC_ACQ_REL);
+}
+#endif
+
+// Packed seat map: one bit per seat (set = free) plus a running free count.
+// Seat numbers passed to the member functions are 0-based. Claims and
+// releases are compare-and-set on the seat word, so two threads can never
+// both win the same seat.
+struct SeatMap {
+    uint64_t freeBits[SEAT_WORDS];
+    int freeCount;
+
+    // Mark the first totalSeats seats free and the rest unusable
+    void reset(int totalSeats) {
+        for (int w = 0; w < SEAT_WORDS; w++) {
+            int bits = totalSeats - w * 64;
+            if (bits >= 64) {
+                freeBits[w] = ~0ULL;
+            } else if (bits > 0) {
+                freeBits[w] = (1ULL << bits) - 1;
+            } else {
+                freeBits[w] = 0;
+            }
+        }
+        freeCount = totalSeats;
+    }
+
+    bool isFree(int seat) const {
+        return (atomicLoad(&freeBits[seat / 64]) >> (seat % 64)) & 1;
+    }
+
+    int available() const {
+        return atomicLoad(&freeCount);
+    }
+
+    // Mark a seat booked; returns false if it was not free
+    bool claim(int seat) {
+        uint64_t mask = 1ULL << (seat % 64);
+        uint64_t* word = &freeBits[seat / 64];
+        uint64_t current = atomicLoad(word);
+        while (current & mask) {
+            if (atomicCompareExchange(word, current, current & ~mask)) {
+                atomicFetchAdd(&freeCount, -1);
+                return true;
+            }
+            current = atomicLoad(word);
+        }
+        return false;
+    }
+
+    // Mark a booked seat free again
+    void release(int seat) {
+        uint64_t mask = 1ULL << (seat % 64);
+        uint64_t* word = &freeBits[seat / 64];
+        uint64_t current = atomicLoad(word);
+        while (!(current & mask)) {
+            if (atomicCompareExchange(word, current, current | mask)) {
+                atomicFetchAdd(&freeCount, 1);
+                return;
+            }
+            current = atomicLoad(word);
+        }
+    }
+
+    // Recount free seats from the bitmap
+    int popcount() const {
+        int count = 0;
+        for (int w = 0; w < SEAT_WORDS; w++) {
+            count += (int)bitset<64>(atomicLoad(&freeBits[w])).count();
+        }
+        return count;
+    }
+
+    // Find the first n free seats, or the first block of n adjacent free
+    // seats. Writes the seat numbers to out and returns false if none fit.
+    bool findFreeSeats(int n, bool adjacent, int* out) const {
+        if (n <= 0 || n > available()) {
+            return false;
+        }
+        int found = 0;
+        for (int w = 0; w < SEAT_WORDS; w++) {
+            uint64_t word = atomicLoad(&freeBits[w]);
+            while (word) {
+                int seat = w * 64 + lowestSetBit(word);
+                word &= word - 1;
+                if (adjacent && found > 0 && out[found - 1] != seat - 1) {
+                    found = 0; // Run broken, start a new block here
+                }
+                out[found++] = seat;
+                if (found == n) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+};
 
 // Structure to store bus details
 struct Bus {
@@ -25,8 +253,11 @@ struct Bus {
     char travelDate[11];
     int totalSeats;
     double ticketPrice;
-    bool seatAvailability[MAX_SEATS];
+    SeatMap seats;
     bool isActive;
+    int busNumberId; // Interned strings, assigned when the bus is stored
+    int sourceId;
+    int destinationId;
 };
 
 // Structure to store passenger details
@@ -37,1219 +268,9318 @@ struct Passenger {
     char gender[2];
 };
 
-// Structure to store ticket details
+// Structure to store ticket details. This is the form tickets take in the
+// API and the journal; the service stores them split into TicketCore and
+// TicketDetails.
 struct Ticket {
     int ticketId;
     int busId;
     Passenger passenger;
     int seatNumber;
-    char bookingDate[30];
-    char travelDate[11];
-    char source[50];
-    char destination[50];
+    int travelDate;      // Packed as YYYYMMDD
+    int sourceId;        // Interned city names
+    int destinationId;
+    int64_t bookingTime; // Seconds since the epoch
     double fare;
     bool isBooked;
 };
 
+// Fields of a ticket read by bookings, cancellations and index rebuilds,
+// packed so a scan touches 24 bytes per ticket
+struct TicketCore {
+    int ticketId;
+    int busId;
+    int seatNumber;
+    bool isBooked;
+    double fare;
+};
+
+// Fields of a ticket only read when it is shown or exported
+struct TicketDetails {
+    Passenger passenger;
+    int travelDate;      // Packed as YYYYMMDD
+    int sourceId;        // Interned city names
+    int destinationId;
+    int64_t bookingTime; // Seconds since the epoch
+};
+
+// A passenger waiting for a seat on a full bus
+struct WaitlistEntry {
+    int waitId;
+    int busId;
+    int priority; // Higher priorities are promoted first, equal ones in joining order
+    Passenger passenger;
+    int64_t joinedTime;
+};
+
+// Journal payload of a waitlist promotion: a freed seat and the booking
+// that took it, applied together
+struct WaitlistPromotion {
+    int cancelledTicketId; // Ticket whose seat was freed, or 0 for a seat hold that ended
+    int waitId;            // Entry promoted
+    Ticket ticket;         // Its booking
+};
+
 // Structure to store bus bill history
 struct BusBill {
     int billId;
     int busId;
-    char busNumber[20];
-    char source[50];
-    char destination[50];
-    char travelDate[11];
+    int busNumberId;     // Interned strings
+    int sourceId;
+    int destinationId;
+    int travelDate;      // Packed as YYYYMMDD
     char departureTime[10];
     char arrivalTime[10];
     int totalSeats;
     double totalRevenue;
-    char generatedDate[30];
+    int64_t generatedTime; // Seconds since the epoch
     bool isActive;
     int passengerCount;
     int passengerIds[MAX_SEATS]; // Store ticket IDs of passengers
 };
 
-class BusReservationSystem {
+// What compaction dropped for one bus: its cancelled tickets and, once the
+// bus is deleted and has no tickets left, its own record. Reports rebuilt
+// from the stores add these back, so their totals survive compaction.
+struct BusHistory {
+    int busId;
+    int removed;          // 1 once the bus record has been dropped
+    int sourceId;         // Route, date and seats of a dropped bus
+    int destinationId;
+    int travelDate;       // Packed as YYYYMMDD
+    int totalSeats;
+    int64_t cancelledTickets; // Cancelled tickets dropped
+};
+
+// Heap allocations made by this thread. Every operator new is counted,
+// so a benchmark can check that a path does not allocate.
+thread_local uint64_t threadHeapAllocations = 0;
+
+void* operator new(size_t size) {
+    threadHeapAllocations++;
+    void* memory = malloc(size ? size : 1);
+    if (!memory) {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // free() pairs with the malloc() above
+#endif
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Bump allocator for objects that live as long as one request or report.
+// Nothing is freed on its own; reset() releases everything at once and
+// keeps the blocks, so an arena reused across requests stops touching the
+// heap once its blocks fit the largest request. Not thread-safe.
+class Arena {
 private:
-    Bus buses[MAX_BUSES];
-    Ticket tickets[MAX_TICKETS];
-    BusBill busBills[MAX_BUSES]; // Array to store bus bills
-    int busCount;
-    int ticketCount;
-    int billCount;
-    int nextTicketId;
-    int nextBusId;
-    int nextBillId;
-    const char* USERNAME = "admin";
-    const char* PASSWORD = "********";
-    
-    // Get current date and time as string
-    void getCurrentDateTime(char* dateTime) {
-        time_t now = time(nullptr);
-        strcpy(dateTime, ctime(&now));
-        // Remove newline
-        int len = strlen(dateTime);
-        if (len > 0 && dateTime[len-1] == '\n') {
-            dateTime[len-1] = '\0';
+    struct Block {
+        unique_ptr<char[]> memory;
+        size_t size;
+    };
+    vector<Block> blocks;
+    size_t current; // Block being filled
+    size_t used;    // Bytes used in it
+
+public:
+    Arena() : current(0), used(0) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment) {
+        for (; current < blocks.size(); current++, used = 0) {
+            uintptr_t base = (uintptr_t)blocks[current].memory.get();
+            size_t offset = ((base + used + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+            if (offset + size <= blocks[current].size) {
+                used = offset + size;
+                return blocks[current].memory.get() + offset;
+            }
         }
+        size_t blockSize = max(ARENA_BLOCK_SIZE, size + alignment);
+        blocks.push_back(Block{unique_ptr<char[]>(new char[blockSize]), blockSize});
+        current = blocks.size() - 1;
+        return allocate(size, alignment);
     }
 
-    // Function to check if a date is valid and not in the past
-    bool isValidFutureDate(const char* dateStr) {
-        // Check format (DD/MM/YYYY)
-        if (strlen(dateStr) != 10 || dateStr[2] != '/' || dateStr[5] != '/') {
-            return false;
+    // Release everything allocated so far
+    void reset() {
+        current = 0;
+        used = 0;
+    }
+};
+
+// Standard allocator drawing from an arena, for containers that live no
+// longer than the arena's current request
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+    Arena* arena;
+
+    explicit ArenaAllocator(Arena& owner) : arena(&owner) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+};
+
+template <typename T>
+using ArenaVector = vector<T, ArenaAllocator<T>>;
+
+// Pool of small fixed-size objects, such as the nodes of a hash index.
+// Freed objects go on a free list per 16-byte size class and are handed
+// out again before new memory is carved from the current block, so a
+// container whose entries come and go stops allocating. Objects larger
+// than POOL_MAX_OBJECT come from the heap. Not thread-safe: a pool
+// belongs to the containers guarded by one lock.
+class ObjectPool {
+private:
+    static const size_t GRANULE = 16;
+    struct FreeObject {
+        FreeObject* next;
+    };
+    FreeObject* freeLists[POOL_MAX_OBJECT / GRANULE];
+    vector<unique_ptr<char[]>> blocks;
+    char* next; // Unused part of the last block
+    char* end;
+
+public:
+    ObjectPool() : next(nullptr), end(nullptr) {
+        memset(freeLists, 0, sizeof(freeLists));
+    }
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    void* allocate(size_t size) {
+        if (size > POOL_MAX_OBJECT) {
+            return ::operator new(size);
         }
-        
-        // Extract day, month, year
-        int day = (dateStr[0] - '0') * 10 + (dateStr[1] - '0');
-        int month = (dateStr[3] - '0') * 10 + (dateStr[4] - '0');
-        int year = (dateStr[6] - '0') * 1000 + (dateStr[7] - '0') * 100 + 
-                   (dateStr[8] - '0') * 10 + (dateStr[9] - '0');
-        
-        // Basic date validation
-        if (day < 1 || day > 31 || month < 1 || month > 12 || year < 2023) {
-            return false;
+        size_t sizeClass = (max(size, (size_t)1) - 1) / GRANULE;
+        FreeObject* object = freeLists[sizeClass];
+        if (object) {
+            freeLists[sizeClass] = object->next;
+            return object;
         }
-        
-        // Get current date
-        time_t now = time(nullptr);
-        struct tm* currentTime = localtime(&now);
-        int currentDay = currentTime->tm_mday;
-        int currentMonth = currentTime->tm_mon + 1; // tm_mon is 0-based
-        int currentYear = currentTime->tm_year + 1900;
-        
-        // Compare with current date
-        if (year < currentYear) {
-            return false;
-        } else if (year == currentYear) {
-            if (month < currentMonth) {
-                return false;
-            } else if (month == currentMonth) {
-                if (day < currentDay) {
-                    return false;
-                }
-            }
+        size_t rounded = (sizeClass + 1) * GRANULE;
+        if ((size_t)(end - next) < rounded) {
+            blocks.emplace_back(new char[POOL_BLOCK_SIZE]);
+            next = blocks.back().get();
+            end = next + POOL_BLOCK_SIZE;
         }
-        
-        return true;
+        void* memory = next;
+        next += rounded;
+        return memory;
     }
 
-    // String copy function
-    void copyString(char* dest, const char* src) {
-        strcpy(dest, src);
+    void deallocate(void* memory, size_t size) {
+        if (size > POOL_MAX_OBJECT) {
+            ::operator delete(memory);
+            return;
+        }
+        size_t sizeClass = (max(size, (size_t)1) - 1) / GRANULE;
+        FreeObject* object = static_cast<FreeObject*>(memory);
+        object->next = freeLists[sizeClass];
+        freeLists[sizeClass] = object;
     }
+};
 
-    // String compare function
-    bool compareString(const char* str1, const char* str2) {
-        return strcmp(str1, str2) == 0;
+// Standard allocator drawing from an object pool
+template <typename T>
+struct PoolAllocator {
+    static_assert(alignof(T) <= 16, "pool objects are 16-byte aligned");
+    typedef T value_type;
+    ObjectPool* pool;
+
+    PoolAllocator(ObjectPool& owner) : pool(&owner) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool) {}
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(pool->allocate(count * sizeof(T)));
     }
 
-    // Count available seats
-    int countAvailableSeats(const Bus& bus) {
-        int count = 0;
-        for (int i = 0; i < bus.totalSeats; i++) {
-            if (bus.seatAvailability[i]) {
-                count++;
-            }
+    void deallocate(T* memory, size_t count) {
+        pool->deallocate(memory, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const {
+        return pool == other.pool;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const {
+        return pool != other.pool;
+    }
+};
+
+// Hash index whose nodes come from an object pool
+template <typename Key, typename Value>
+using PooledMap = unordered_map<Key, Value, hash<Key>, equal_to<Key>, PoolAllocator<pair<const Key, Value>>>;
+
+// Hierarchical timer wheel. Level 0 has one slot per tick; each higher
+// level has one slot per turn of the level below, and a slot's timers are
+// moved down a level (cascaded) when the level below wraps onto it.
+// Scheduling and cancelling are O(1) and a timer cascades at most once per
+// level, so expiring timers never scans the ones still pending.
+// Timers are nodes in one array, linked into their slot; freed nodes are
+// reused. Not thread-safe: the owner serializes calls.
+class TimerWheel {
+public:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const uint64_t MAX_DELAY = (1ULL << (LEVELS * SLOT_BITS)) - 1; // Ticks (19 days of 100 ms)
+
+private:
+    struct Node {
+        uint64_t expiresAt; // Tick
+        int payload;
+        int prev;
+        int next; // Next node in the slot, or in the free list
+    };
+    vector<Node> nodes;
+    int freeNodes;
+    int heads[LEVELS * SLOTS];
+    uint64_t currentTick; // Next tick to expire
+    int pending;
+
+    // Link a node into the slot its expiry falls in, seen from currentTick
+    void link(int node) {
+        uint64_t expiresAt = nodes[node].expiresAt;
+        uint64_t delay = expiresAt - currentTick;
+        int level = 0;
+        while (level < LEVELS - 1 && delay >= (1ULL << ((level + 1) * SLOT_BITS))) {
+            level++;
         }
-        return count;
+        int slot = level * SLOTS + (int)((expiresAt >> (level * SLOT_BITS)) & (SLOTS - 1));
+        nodes[node].prev = -slot - 1; // A slot head points back at its slot
+        nodes[node].next = heads[slot];
+        if (heads[slot] != -1) {
+            nodes[heads[slot]].prev = node;
+        }
+        heads[slot] = node;
     }
 
-    // Find bus by ID
-    int findBusById(int busId) {
-        for (int i = 0; i < busCount; i++) {
-            if (buses[i].busId == busId && buses[i].isActive) {
-                return i;
-            }
+    void unlink(int node) {
+        int prev = nodes[node].prev;
+        int next = nodes[node].next;
+        if (prev < 0) {
+            heads[-prev - 1] = next;
+        } else {
+            nodes[prev].next = next;
+        }
+        if (next != -1) {
+            nodes[next].prev = prev;
         }
-        return -1;
     }
 
-    // Find ticket by ID
-    int findTicketById(int ticketId) {
-        for (int i = 0; i < ticketCount; i++) {
-            if (tickets[i].ticketId == ticketId && tickets[i].isBooked) {
-                return i;
-            }
+    // Move every timer of a slot to the slots below it. Returns the slot's
+    // position in its level, which is 0 when that level wraps too.
+    int cascade(int level) {
+        int position = (int)((currentTick >> (level * SLOT_BITS)) & (SLOTS - 1));
+        int node = heads[level * SLOTS + position];
+        heads[level * SLOTS + position] = -1;
+        while (node != -1) {
+            int next = nodes[node].next;
+            link(node);
+            node = next;
         }
-        return -1;
+        return position;
     }
 
-    // Check if bus has active bookings
-    bool hasActiveBookings(int busId) {
-        for (int i = 0; i < ticketCount; i++) {
-            if (tickets[i].busId == busId && tickets[i].isBooked) {
-                return true;
-            }
+public:
+    TimerWheel() : freeNodes(-1), currentTick(0), pending(0) {
+        fill(heads, heads + LEVELS * SLOTS, -1);
+    }
+
+    // Schedule a timer for a tick (an earlier tick expires on the next
+    // advance). Returns the handle that cancels it.
+    int schedule(uint64_t expiresAt, int payload) {
+        int node = freeNodes;
+        if (node == -1) {
+            node = (int)nodes.size();
+            nodes.push_back(Node());
+        } else {
+            freeNodes = nodes[node].next;
         }
-        return false;
+        expiresAt = max(expiresAt, currentTick);
+        nodes[node].expiresAt = min(expiresAt, currentTick + MAX_DELAY);
+        nodes[node].payload = payload;
+        link(node);
+        pending++;
+        return node;
     }
 
-    // Clear input buffer
-    void clearInputBuffer() {
-        cin.clear();
-        while (cin.get() != '\n');
+    // Cancel a timer that has not expired yet
+    void cancel(int handle) {
+        unlink(handle);
+        nodes[handle].next = freeNodes;
+        freeNodes = handle;
+        pending--;
     }
 
-    // Check if bus is fully booked
-    bool isBusFullyBooked(int busIndex) {
-        for (int i = 0; i < buses[busIndex].totalSeats; i++) {
-            if (buses[busIndex].seatAvailability[i]) {
-                return false;
+    // Expire every timer due at or before a tick, calling expire(payload)
+    // for each. Handles of expired timers are free again when it is called.
+    template <typename Expire>
+    void advance(uint64_t tick, Expire expire) {
+        if (pending == 0) {
+            currentTick = max(currentTick, tick + 1);
+            return;
+        }
+        for (; currentTick <= tick; currentTick++) {
+            int position = (int)(currentTick & (SLOTS - 1));
+            for (int level = 1; position == 0 && level < LEVELS; level++) {
+                position = cascade(level);
+            }
+            int slot = (int)(currentTick & (SLOTS - 1));
+            int node = heads[slot];
+            heads[slot] = -1;
+            while (node != -1) {
+                int next = nodes[node].next;
+                nodes[node].next = freeNodes;
+                freeNodes = node;
+                pending--;
+                expire(nodes[node].payload);
+                node = next;
             }
         }
-        return true;
     }
 
-    // Generate bus bill
-    void generateBusBill(int busIndex) {
-        if (billCount >= MAX_BUSES) {
-            cout << "Maximum bill limit reached!\n";
-            return;
+    // Timers scheduled and not yet expired or cancelled
+    int size() const {
+        return pending;
+    }
+};
+
+// Growable record store. Records are kept in fixed-size chunks, so growing
+// the store never moves or copies existing records and an index handed out
+// by push_back() stays valid for the lifetime of the store.
+// A store can also serve a prefix of records in place from a mapped data
+// file; records appended after that go to the chunks.
+// The chunk directory is allocated once, so a reader indexing an existing
+// record never races with a writer appending a new chunk; appends
+// themselves must be serialized by the caller.
+template <typename T>
+class RecordStore {
+private:
+    unique_ptr<unique_ptr<T[]>[]> chunks;
+    int chunkCount;
+    T* mapped;       // Records served from a mapped file, or null
+    int mappedCount;
+    atomic<int> count;
+
+public:
+    RecordStore() : chunks(new unique_ptr<T[]>[STORE_MAX_CHUNKS]), chunkCount(0),
+                    mapped(nullptr), mappedCount(0), count(0) {}
+
+    // Number of records stored
+    int size() const {
+        return count.load(memory_order_acquire);
+    }
+
+    T& operator[](int index) {
+        if (index < mappedCount) {
+            return mapped[index];
         }
+        index -= mappedCount;
+        return chunks[index / STORE_CHUNK_SIZE][index % STORE_CHUNK_SIZE];
+    }
 
-        Bus& bus = buses[busIndex];
-        
-        // Calculate total revenue
-        double totalRevenue = 0;
-        int passengerCount = 0;
-        int passengerIds[MAX_SEATS];
-        
-        for (int i = 0; i < ticketCount; i++) {
-            if (tickets[i].isBooked && tickets[i].busId == bus.busId) {
-                totalRevenue += tickets[i].fare;
-                passengerIds[passengerCount] = tickets[i].ticketId;
-                passengerCount++;
+    const T& operator[](int index) const {
+        return const_cast<RecordStore*>(this)->operator[](index);
+    }
+
+    // Append a record and return its index
+    int push_back(const T& record) {
+        int index = count.load(memory_order_relaxed);
+        if (index - mappedCount == chunkCount * STORE_CHUNK_SIZE) {
+            if (chunkCount == STORE_MAX_CHUNKS) {
+                throw length_error("record store is full");
             }
+            chunks[chunkCount++].reset(new T[STORE_CHUNK_SIZE]);
         }
-        
-        // Create bill
-        BusBill newBill;
-        newBill.billId = nextBillId++;
-        newBill.busId = bus.busId;
-        copyString(newBill.busNumber, bus.busNumber);
-        copyString(newBill.source, bus.source);
-        copyString(newBill.destination, bus.destination);
-        copyString(newBill.travelDate, bus.travelDate);
-        copyString(newBill.departureTime, bus.departureTime);
-        copyString(newBill.arrivalTime, bus.arrivalTime);
-        newBill.totalSeats = bus.totalSeats;
-        newBill.totalRevenue = totalRevenue;
-        getCurrentDateTime(newBill.generatedDate);
-        newBill.isActive = true;
-        newBill.passengerCount = passengerCount;
-        
-        // Copy passenger IDs
-        for (int i = 0; i < passengerCount; i++) {
-            newBill.passengerIds[i] = passengerIds[i];
-        }
-        
-        // Add bill to array
-        busBills[billCount++] = newBill;
-        
-        // Print bill
-        cout << "\n========== BUS BILL ==========\n";
-        cout << "Bill ID: " << newBill.billId << endl;
-        cout << "Bus Number: " << newBill.busNumber << endl;
-        cout << "Route: " << newBill.source << " to " << newBill.destination << endl;
-        cout << "Travel Date: " << newBill.travelDate << endl;
-        cout << "Departure Time: " << newBill.departureTime << endl;
-        cout << "Arrival Time: " << newBill.arrivalTime << endl;
-        cout << "Total Seats: " << newBill.totalSeats << endl;
-        cout << "Total Passengers: " << passengerCount << endl;
-        cout << "Total Revenue: " << newBill.totalRevenue << endl;
-        cout << "Generated On: " << newBill.generatedDate << endl;
-        cout << "================================\n";
-        
-        // No longer marking bus as inactive
-        // bus.isActive = false;
-        
-        cout << "\nBus has been fully booked.\n";
-        cout << "A bill has been generated and stored in history.\n";
+        (*this)[index] = record;
+        count.store(index + 1, memory_order_release);
+        return index;
     }
 
-public:
-    // Clear screen function
-    void clearScreen() {
-        #ifdef _WIN32
-            system("cls");
-        #else
-            system("clear");
-        #endif
+    // Serve the first records of an empty store from mapped memory. The
+    // memory must stay mapped for the lifetime of the store.
+    void attach(T* records, int recordCount) {
+        clear();
+        mapped = records;
+        mappedCount = recordCount;
+        count = recordCount;
     }
 
-    // Display decorated header
-    void displayHeader(const char* title) {
-        int titleLength = strlen(title);
-        int totalWidth = 60;
-        int padding = (totalWidth - titleLength) / 2;
-        
-        cout << "\n";
-        cout << "+" << string(totalWidth-2, '=') << "+\n";
-        cout << "|" << string(padding-1, ' ') << title << string(totalWidth-padding-titleLength-1, ' ') << "|\n";
-        cout << "+" << string(totalWidth-2, '=') << "+\n";
+    // Records stored contiguously from index on. Sets length to how many
+    // can be read through the returned pointer.
+    const T* run(int index, int& length) const {
+        if (index < mappedCount) {
+            length = mappedCount - index;
+            return mapped + index;
+        }
+        int offset = (index - mappedCount) % STORE_CHUNK_SIZE;
+        length = min(STORE_CHUNK_SIZE - offset, size() - index);
+        return &(*this)[index];
     }
 
-    BusReservationSystem() {
-        busCount = 0;
-        ticketCount = 0;
-        billCount = 0;
-        nextTicketId = 1001;
-        nextBusId = 101;
-        nextBillId = 501;
-        
-        // Initialize all buses as inactive
-        for (int i = 0; i < MAX_BUSES; i++) {
-            buses[i].isActive = false;
-            busBills[i].isActive = false;
+    // Keep only the first records of a store that has not grown since
+    // attach()
+    void truncate(int recordCount) {
+        if (chunkCount == 0 && recordCount < mappedCount) {
+            mappedCount = recordCount;
+            count = recordCount;
         }
-        
-        loadData(); // Load data from file
     }
 
-    ~BusReservationSystem() {
-        saveData(); // Save data when program closes
+    // Remove all records and release their memory
+    void clear() {
+        for (int i = 0; i < chunkCount; i++) {
+            chunks[i].reset();
+        }
+        chunkCount = 0;
+        mapped = nullptr;
+        mappedCount = 0;
+        count = 0;
     }
+};
 
-    // Login function
-    bool login() {
-        char username[50];
-        char password[50];
-        char ch;
-        int attempts = 0;
-        const int MAX_ATTEMPTS = 3;
+// Tickets split into two parallel stores, one for TicketCore and one for
+// TicketDetails, both indexed by the same ticket index. Scans over the
+// core fields never pull passenger details into the cache.
+class TicketStore {
+private:
+    RecordStore<TicketCore> cores;
+    RecordStore<TicketDetails> details;
 
-        while (attempts < MAX_ATTEMPTS) {
-            clearScreen();
-            displayHeader("LOGIN");
+public:
+    // Number of tickets stored
+    int size() const {
+        return cores.size();
+    }
+
+    TicketCore& core(int index) {
+        return cores[index];
+    }
+
+    const TicketCore& core(int index) const {
+        return cores[index];
+    }
+
+    const TicketDetails& detail(int index) const {
+        return details[index];
+    }
+
+    // Reassemble a whole ticket
+    Ticket get(int index) const {
+        const TicketCore& hot = cores[index];
+        const TicketDetails& cold = details[index];
+        Ticket ticket;
+        ticket.ticketId = hot.ticketId;
+        ticket.busId = hot.busId;
+        ticket.passenger = cold.passenger;
+        ticket.seatNumber = hot.seatNumber;
+        ticket.travelDate = cold.travelDate;
+        ticket.sourceId = cold.sourceId;
+        ticket.destinationId = cold.destinationId;
+        ticket.bookingTime = cold.bookingTime;
+        ticket.fare = hot.fare;
+        ticket.isBooked = hot.isBooked;
+        return ticket;
+    }
+
+    // Append a ticket and return its index. The details go first, so a
+    // reader that sees the new size also sees both halves.
+    int push_back(const Ticket& ticket) {
+        details.push_back(detailsOf(ticket));
+        return cores.push_back(coreOf(ticket));
+    }
+
+    // Store a ticket in a slot freed by compaction
+    void put(int index, const Ticket& ticket) {
+        details[index] = detailsOf(ticket);
+        cores[index] = coreOf(ticket);
+    }
+
+    // Stores backing each half, for checkpoints
+    RecordStore<TicketCore>& coreStore() {
+        return cores;
+    }
+
+    RecordStore<TicketDetails>& detailStore() {
+        return details;
+    }
+
+private:
+    static TicketCore coreOf(const Ticket& ticket) {
+        TicketCore hot;
+        hot.ticketId = ticket.ticketId;
+        hot.busId = ticket.busId;
+        hot.seatNumber = ticket.seatNumber;
+        hot.isBooked = ticket.isBooked;
+        hot.fare = ticket.fare;
+        return hot;
+    }
+
+    static TicketDetails detailsOf(const Ticket& ticket) {
+        TicketDetails cold;
+        cold.passenger = ticket.passenger;
+        cold.travelDate = ticket.travelDate;
+        cold.sourceId = ticket.sourceId;
+        cold.destinationId = ticket.destinationId;
+        cold.bookingTime = ticket.bookingTime;
+        return cold;
+    }
+};
+
+// Private, copy-on-write view of a whole file. Records can be read and
+// modified in place; changes never reach the file itself.
+class MappedFile {
+private:
+    char* data;
+    size_t length;
+#ifdef _WIN32
+    vector<char> buffer; // Windows cannot replace a mapped file, so read it instead
+#endif
+
+public:
+    MappedFile() : data(nullptr), length(0) {}
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* path) {
+        close();
+#ifdef _WIN32
+        ifstream in(path, ios::binary | ios::ate);
+        if (!in.is_open()) {
+            return false;
+        }
+        buffer.resize((size_t)in.tellg());
+        in.seekg(0);
+        if (!buffer.empty() && !in.read(buffer.data(), buffer.size())) {
+            buffer.clear();
+            return false;
+        }
+        data = buffer.data();
+        length = buffer.size();
+        return true;
+#else
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* view = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED) {
+            return false;
+        }
+        data = static_cast<char*>(view);
+        length = info.st_size;
+        return true;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        buffer.clear();
+        buffer.shrink_to_fit();
+#else
+        if (data) {
+            munmap(data, length);
+        }
+#endif
+        data = nullptr;
+        length = 0;
+    }
+
+    char* bytes() {
+        return data;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+// Header at the start of strings.dat, buses.dat, tickets.dat,
+// passengers.dat, busbills.dat, waitlist.dat and bushistory.dat. Records
+// follow immediately after it as raw struct images.
+struct DataFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;      // sizeof(record) of the build that wrote the file
+    int32_t nextId;
+    uint64_t recordCount;
+    uint64_t payloadChecksum; // Checksum of all record bytes
+    uint64_t checkpointStamp; // Checkpoint that wrote the file; all its files share it
+    uint64_t headerChecksum;  // Checksum of the fields above
+    uint8_t reserved[16];     // Pads the header to 64 bytes
+};
+
+// Key for the route search index: buses ordered by route, then date
+struct RouteKey {
+    int sourceId; // Interned city names
+    int destinationId;
+    int travelDate; // Packed as YYYYMMDD
+    int busId;
+
+    bool operator<(const RouteKey& other) const {
+        return tie(sourceId, destinationId, travelDate, busId) <
+               tie(other.sourceId, other.destinationId, other.travelDate, other.busId);
+    }
+};
+
+// Key for the departure index: buses ordered by source, then date
+struct DepartureKey {
+    int sourceId;
+    int travelDate; // Packed as YYYYMMDD
+    int busId;
+
+    bool operator<(const DepartureKey& other) const {
+        return tie(sourceId, travelDate, busId) < tie(other.sourceId, other.travelDate, other.busId);
+    }
+};
+
+// One interned string as stored in strings.dat
+struct InternedString {
+    char text[56]; // Fits the longest bus number or city name
+};
+
+// Dictionary of interned strings: bus numbers and city names. Records
+// hold a small ID instead of their own copy of the text, and comparing two
+// IDs is comparing the strings. IDs are assigned in order and never change.
+// Interning must be serialized by the caller; the text of an existing ID
+// can be read at any time.
+class StringDictionary {
+private:
+    RecordStore<InternedString> entries;
+    unordered_map<string, int> ids; // Text -> ID
+
+public:
+    // Store backing the dictionary, for checkpoints
+    RecordStore<InternedString>& store() {
+        return entries;
+    }
+
+    int size() const {
+        return entries.size();
+    }
+
+    // ID of a string, adding it if it is new
+    int intern(const char* text) {
+        auto it = ids.find(text);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        InternedString entry;
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.text, text, sizeof(entry.text) - 1);
+        int id = entries.push_back(entry);
+        ids.emplace(entry.text, id);
+        return id;
+    }
+
+    // ID of a string, or -1 if it was never interned
+    int find(const char* text) const {
+        auto it = ids.find(text);
+        return it == ids.end() ? -1 : it->second;
+    }
+
+    // Text of an ID ("" if unknown)
+    const char* text(int id) const {
+        return id >= 0 && id < entries.size() ? entries[id].text : "";
+    }
+
+    // Rebuild the text -> ID map after the store was loaded
+    void rebuildIndex() {
+        ids.clear();
+        ids.reserve(entries.size());
+        for (int i = 0; i < entries.size(); i++) {
+            ids.emplace(entries[i].text, i);
+        }
+    }
+};
+
+// Force data already handed to the OS for a file to stable storage
+bool syncFileData(FILE* file) {
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Flush a file's data to stable storage
+bool syncFile(FILE* file) {
+    return fflush(file) == 0 && syncFileData(file);
+}
+
+// Flush a closed file's data to stable storage
+bool syncPath(const char* path) {
+#ifdef _WIN32
+    int fd = _open(path, _O_RDWR | _O_BINARY);
+    if (fd < 0) return false;
+    bool ok = _commit(fd) == 0;
+    _close(fd);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+#endif
+    return ok;
+}
+
+// Atomically replace target with the freshly written temp file
+bool replaceFile(const char* tempPath, const char* targetPath) {
+#ifdef _WIN32
+    return MoveFileExA(tempPath, targetPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(tempPath, targetPath) == 0;
+#endif
+}
+
+// Whether an open file is still the file a path names, which it is not
+// once another file has been renamed over the path. pathSize is set to
+// the size of the named file, or -1 if there is none.
+bool isFileAtPath(FILE* file, const char* path, long& pathSize) {
+#ifdef _WIN32
+    pathSize = -1;
+    HANDLE named = CreateFileA(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                               OPEN_EXISTING, 0, nullptr);
+    if (named == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    BY_HANDLE_FILE_INFORMATION namedInfo, openedInfo;
+    bool same = GetFileInformationByHandle(named, &namedInfo) != 0;
+    CloseHandle(named);
+    if (!same) {
+        return false;
+    }
+    pathSize = (long)namedInfo.nFileSizeLow;
+    HANDLE opened = file ? (HANDLE)_get_osfhandle(_fileno(file)) : INVALID_HANDLE_VALUE;
+    return opened != INVALID_HANDLE_VALUE && GetFileInformationByHandle(opened, &openedInfo) &&
+           openedInfo.dwVolumeSerialNumber == namedInfo.dwVolumeSerialNumber &&
+           openedInfo.nFileIndexHigh == namedInfo.nFileIndexHigh &&
+           openedInfo.nFileIndexLow == namedInfo.nFileIndexLow;
+#else
+    struct stat named, opened;
+    if (stat(path, &named) != 0) {
+        pathSize = -1;
+        return false;
+    }
+    pathSize = (long)named.st_size;
+    return file && fstat(fileno(file), &opened) == 0 &&
+           opened.st_dev == named.st_dev && opened.st_ino == named.st_ino;
+#endif
+}
+
+// FNV-1a checksum of a byte range
+uint32_t computeChecksum(const void* data, size_t length, uint32_t hash = 2166136261u) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Word-at-a-time FNV-style checksum for large data files
+uint64_t computeBlockChecksum(const void* data, size_t length, uint64_t hash = 14695981039346656037ULL) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    size_t words = length / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        memcpy(&word, bytes + i * 8, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for (size_t i = words * 8; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Operations whose latency is measured
+enum MetricOperation {
+    METRIC_ADD_BUS,
+    METRIC_BOOK,
+    METRIC_BOOK_GROUP,
+    METRIC_HOLD,           // Placing and releasing seat holds
+    METRIC_WAITLIST,       // Joining and leaving waitlists
+    METRIC_CANCEL,
+    METRIC_DELETE_BUS,
+    METRIC_LOOKUP,         // getBus, getTicket, getBill
+    METRIC_SEARCH,         // Route and departure searches
+    METRIC_PLAN,           // Journey planning
+    METRIC_SCAN,           // findTickets, findBuses
+    METRIC_JOURNAL_APPEND, // Including the wait for fsync
+    METRIC_SAVE,           // Checkpoint
+    METRIC_LOAD,           // Startup load and journal replay
+    METRIC_OPERATION_COUNT
+};
+
+const char* metricName(MetricOperation operation) {
+    switch (operation) {
+        case METRIC_ADD_BUS: return "add_bus";
+        case METRIC_BOOK: return "book";
+        case METRIC_BOOK_GROUP: return "book_group";
+        case METRIC_HOLD: return "hold";
+        case METRIC_WAITLIST: return "waitlist";
+        case METRIC_CANCEL: return "cancel";
+        case METRIC_DELETE_BUS: return "delete_bus";
+        case METRIC_LOOKUP: return "lookup";
+        case METRIC_SEARCH: return "search";
+        case METRIC_PLAN: return "plan";
+        case METRIC_SCAN: return "scan";
+        case METRIC_JOURNAL_APPEND: return "journal_append";
+        case METRIC_SAVE: return "save";
+        case METRIC_LOAD: return "load";
+        default: return "unknown";
+    }
+}
+
+// Timestamps for latency measurement. On x86 this is the time stamp
+// counter, which reads several times faster than steady_clock; ticks are
+// only converted to nanoseconds when metrics are read.
+inline uint64_t metricTicks() {
+#ifdef X86_SIMD
+    return __builtin_ia32_rdtsc();
+#else
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Both clocks as the program started, to measure the tick rate against
+const struct {
+    uint64_t ticks;
+    chrono::steady_clock::time_point time;
+} metricClockOrigin = {metricTicks(), chrono::steady_clock::now()};
+
+// Nanoseconds per metric tick, measured over the run so far
+double metricNanosPerTick() {
+#ifdef X86_SIMD
+    // Give a process that reads its metrics right away a usable baseline
+    this_thread::sleep_until(metricClockOrigin.time + chrono::milliseconds(10));
+    double nanos = (double)chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - metricClockOrigin.time).count();
+    uint64_t ticks = metricTicks() - metricClockOrigin.ticks;
+    return ticks > 0 ? nanos / ticks : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+// Latency histogram buckets, HDR style: values below 16 ticks get a bucket
+// each, and every power of two above that is split into 16 equal buckets,
+// so a bucket is never wider than 1/16 of its values. The last bucket
+// also takes everything from 2^40 ticks (minutes) up.
+const int HISTOGRAM_SUB_BUCKETS = 16;
+const int HISTOGRAM_BUCKETS = (40 - 3) * HISTOGRAM_SUB_BUCKETS;
+
+int histogramBucket(uint64_t ticks) {
+    if (ticks < (uint64_t)HISTOGRAM_SUB_BUCKETS) {
+        return (int)ticks;
+    }
+#if defined(__GNUC__)
+    int msb = 63 - __builtin_clzll(ticks);
+#else
+    int msb = 63;
+    while (!(ticks >> msb)) {
+        msb--;
+    }
+#endif
+    int bucket = (msb - 3) * HISTOGRAM_SUB_BUCKETS + (int)((ticks >> (msb - 4)) & (HISTOGRAM_SUB_BUCKETS - 1));
+    return min(bucket, HISTOGRAM_BUCKETS - 1);
+}
+
+// Largest value that falls into a bucket
+uint64_t histogramBucketLimit(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int msb = bucket / HISTOGRAM_SUB_BUCKETS + 3;
+    uint64_t low = (uint64_t)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << (msb - 4);
+    return low + (1ULL << (msb - 4)) - 1;
+}
+
+// One thread's counters and histograms. Only the owning thread writes,
+// so updates are plain relaxed loads and stores with no locked
+// instructions; readers may see a count a moment late but never torn.
+struct MetricsShard {
+    atomic<uint64_t> calls[METRIC_OPERATION_COUNT];
+    atomic<uint64_t> failures[METRIC_OPERATION_COUNT];
+    atomic<uint64_t> totalTicks[METRIC_OPERATION_COUNT];
+    atomic<uint64_t> buckets[METRIC_OPERATION_COUNT][HISTOGRAM_BUCKETS];
+
+    MetricsShard() {
+        for (int op = 0; op < METRIC_OPERATION_COUNT; op++) {
+            calls[op] = 0;
+            failures[op] = 0;
+            totalTicks[op] = 0;
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+                buckets[op][b] = 0;
+            }
+        }
+    }
+};
+
+// Counters and histogram of one operation, summed over all threads
+struct OperationMetrics {
+    uint64_t calls;
+    uint64_t failures;
+    double totalNanos;
+    double nanosPerTick;
+    vector<uint64_t> buckets;
+
+    // Latency in nanoseconds at quantile q (0..1), as the upper limit of its bucket
+    double quantile(double q) const {
+        if (calls == 0) {
+            return 0;
+        }
+        uint64_t rank = min(calls - 1, (uint64_t)(q * calls));
+        uint64_t seen = 0;
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            seen += buckets[b];
+            if (seen > rank) {
+                return histogramBucketLimit(b) * nanosPerTick;
+            }
+        }
+        return 0;
+    }
+};
+
+// Owner of every thread's shard. A thread takes a shard on its first
+// measurement and hands it back when it exits; the shard keeps its counts
+// and goes to the next new thread, so totals are never lost and idle
+// threads cost nothing.
+class MetricsRegistry {
+private:
+    mutex lock;
+    vector<unique_ptr<MetricsShard>> shards;
+    vector<MetricsShard*> spare;
+
+public:
+    MetricsShard* acquire() {
+        lock_guard<mutex> guard(lock);
+        if (!spare.empty()) {
+            MetricsShard* shard = spare.back();
+            spare.pop_back();
+            return shard;
+        }
+        shards.emplace_back(new MetricsShard());
+        return shards.back().get();
+    }
+
+    void release(MetricsShard* shard) {
+        lock_guard<mutex> guard(lock);
+        spare.push_back(shard);
+    }
+
+    // Sum one operation over all shards
+    OperationMetrics collect(MetricOperation operation) {
+        OperationMetrics total = {0, 0, 0, metricNanosPerTick(), vector<uint64_t>(HISTOGRAM_BUCKETS)};
+        uint64_t totalTicks = 0;
+        lock_guard<mutex> guard(lock);
+        for (const auto& shard : shards) {
+            total.calls += shard->calls[operation].load(memory_order_relaxed);
+            total.failures += shard->failures[operation].load(memory_order_relaxed);
+            totalTicks += shard->totalTicks[operation].load(memory_order_relaxed);
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+                total.buckets[b] += shard->buckets[operation][b].load(memory_order_relaxed);
+            }
+        }
+        total.totalNanos = totalTicks * total.nanosPerTick;
+        return total;
+    }
+};
+
+MetricsRegistry& metricsRegistry() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+// This thread's shard, returned to the registry when the thread exits
+struct ThreadMetrics {
+    MetricsShard* shard;
+
+    ~ThreadMetrics() {
+        if (shard) {
+            metricsRegistry().release(shard);
+        }
+    }
+};
+thread_local ThreadMetrics threadMetrics = {nullptr};
+
+// Add one bump to a counter only this thread writes
+inline void bumpCounter(atomic<uint64_t>& counter, uint64_t amount) {
+    counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+// Record one call of an operation that started at metricTicks() startedAt
+void recordLatency(MetricOperation operation, uint64_t startedAt, bool failed) {
+    uint64_t ticks = metricTicks() - startedAt;
+    MetricsShard* shard = threadMetrics.shard;
+    if (!shard) {
+        shard = threadMetrics.shard = metricsRegistry().acquire();
+    }
+    bumpCounter(shard->calls[operation], 1);
+    bumpCounter(shard->totalTicks[operation], ticks);
+    bumpCounter(shard->buckets[operation][histogramBucket(ticks)], 1);
+    if (failed) {
+        bumpCounter(shard->failures[operation], 1);
+    }
+}
+
+// Event types written to the journal
+enum JournalRecordType {
+    JOURNAL_ADD_BUS = 1,    // Payload: Bus
+    JOURNAL_BOOK_TICKET,    // Payload: Ticket
+    JOURNAL_CANCEL_TICKET,  // Payload: int ticketId
+    JOURNAL_DELETE_BUS,     // Payload: int busId
+    JOURNAL_ADD_BILL,       // Payload: BusBill
+    JOURNAL_BOOK_GROUP,     // Payload: Ticket array, booked together
+    JOURNAL_JOIN_WAITLIST,  // Payload: WaitlistEntry
+    JOURNAL_LEAVE_WAITLIST, // Payload: int waitId
+    JOURNAL_PROMOTE_WAITLIST, // Payload: WaitlistPromotion
+    JOURNAL_CHECKPOINT      // Payload: JournalMarker. First record of a journal; never replayed
+};
+
+// Marker starting the journal written after a checkpoint. A follower
+// tailing the previous journal checks previousStamp to tell whether the
+// new journal carries on from the one it has applied.
+struct JournalMarker {
+    uint64_t checkpointStamp; // Checkpoint the journal's records apply on top of
+    uint64_t previousStamp;   // checkpointStamp of the journal it replaced
+};
+
+// How a process opens the data files
+enum OpenMode {
+    OPEN_READ_WRITE, // Owns the data: journals changes and checkpoints
+    OPEN_READ_ONLY,  // Loads a snapshot and never writes, so it can run
+                     // beside the process that owns the data
+    OPEN_FOLLOWER    // Read-only, and keeps applying the owner's journal
+                     // to the snapshot as the owner appends to it
+};
+
+// The slice of the ID space a service allocates from. Shard index of
+// count allocates only IDs equal to index modulo count, so a router can
+// tell which shard owns a bus, ticket, waitlist entry or hold from its ID.
+struct ShardSpec {
+    int index;
+    int count; // 1 when not sharded
+};
+
+// How a sharded deployment splits buses among its shards
+enum ShardKey {
+    SHARD_BY_ROUTE, // Each route on one shard, so a route search asks one shard
+    SHARD_BY_DATE   // Each travel date on one shard, so journey planning does
+};
+
+// When the journal forces appended records to disk
+enum FsyncPolicy {
+    FSYNC_EVERY_COMMIT, // Every record is durable before it is acknowledged
+    FSYNC_GROUP_COMMIT, // Records are synced in groups of JOURNAL_GROUP_SIZE
+    FSYNC_NEVER         // Leave flushing to the operating system
+};
+
+// Header in front of every journal record
+struct JournalRecordHeader {
+    uint32_t type;
+    uint32_t length;   // Payload bytes
+    uint32_t checksum; // Checksum of type and payload
+};
+
+// Append-only write-ahead journal of reservation events. Records are
+// replayed on startup on top of the last checkpoint; a torn or corrupt
+// record at the tail marks the end of the log.
+// append() is thread-safe. Under FSYNC_EVERY_COMMIT, threads waiting for
+// durability share fsync calls: one thread syncs everything appended so
+// far while the others wait, and they all return together (group commit).
+class Journal {
+private:
+    FILE* file;
+    FsyncPolicy policy;
+    mutex lock;
+    condition_variable syncDone;
+    bool syncing;           // A thread is inside fsync
+    uint64_t appendedSeq;   // Sequence number of the last appended record
+    uint64_t durableSeq;    // Sequence number of the last synced record
+    int pendingRecords;     // Appended but not yet synced
+    atomic<int> recordCount; // Records since the last checkpoint
+    uint64_t stamp;         // Checkpoint stamp in this journal's marker (0 if it has none)
+    char buffer[BUFSIZ];    // stdio buffer of file, so appending never allocates
+
+    // Wait until record seq is on stable storage, syncing it ourselves if
+    // no other thread is already doing so
+    bool waitDurable(unique_lock<mutex>& guard, uint64_t seq) {
+        while (durableSeq < seq) {
+            if (syncing) {
+                syncDone.wait(guard);
+                continue;
+            }
+            syncing = true;
+            uint64_t target = appendedSeq;
+            bool ok = fflush(file) == 0;
+            guard.unlock();
+            ok = ok && syncFileData(file);
+            guard.lock();
+            syncing = false;
+            if (ok) {
+                durableSeq = target;
+                pendingRecords = 0;
+            }
+            syncDone.notify_all();
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Open the journal file for appending, buffered in buffer
+    void openFile() {
+        file = fopen(JOURNAL_FILE, "ab");
+        if (file) {
+            setvbuf(file, buffer, _IOFBF, sizeof(buffer));
+        }
+    }
+
+    // Write one record with its header to a file
+    static bool writeRecordTo(FILE* out, JournalRecordType type, const void* data, uint32_t length) {
+        JournalRecordHeader header;
+        header.type = type;
+        header.length = length;
+        header.checksum = computeChecksum(data, length, computeChecksum(&header.type, sizeof(header.type)));
+        return fwrite(&header, sizeof(header), 1, out) == 1 &&
+               (length == 0 || fwrite(data, length, 1, out) == 1);
+    }
+
+    // Write one record with the lock held. Returns its sequence number, or 0.
+    uint64_t writeRecord(JournalRecordType type, const void* data, uint32_t length) {
+        if (!writeRecordTo(file, type, data, length)) {
+            return 0;
+        }
+        recordCount++;
+        pendingRecords++;
+        return ++appendedSeq;
+    }
+
+    // Commit records up to seq according to the fsync policy. Records not
+    // synced yet are still flushed, so followers see them at once.
+    bool commit(unique_lock<mutex>& guard, uint64_t seq) {
+        if (policy == FSYNC_EVERY_COMMIT ||
+            (policy == FSYNC_GROUP_COMMIT && pendingRecords >= JOURNAL_GROUP_SIZE)) {
+            return waitDurable(guard, seq);
+        }
+        return fflush(file) == 0;
+    }
+
+public:
+    Journal() : file(nullptr), policy(FSYNC_EVERY_COMMIT), syncing(false),
+                appendedSeq(0), durableSeq(0), pendingRecords(0), recordCount(0), stamp(0) {}
+
+    ~Journal() {
+        close();
+    }
+
+    // Open the journal for appending
+    bool open(FsyncPolicy fsyncPolicy) {
+        policy = fsyncPolicy;
+        FILE* in = fopen(JOURNAL_FILE, "rb");
+        if (in) {
+            JournalMarker marker;
+            long offset;
+            stamp = readMarker(in, marker, offset) ? marker.checkpointStamp : 0;
+            fclose(in);
+        }
+        openFile();
+        return file != nullptr;
+    }
+
+    void close() {
+        if (file) {
+            syncFile(file);
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    // Records appended since the last checkpoint
+    int size() const {
+        return recordCount.load();
+    }
+
+    // Current length of the journal file in bytes
+    long bytes() {
+        lock_guard<mutex> guard(lock);
+        if (!file || fseek(file, 0, SEEK_END) != 0) {
+            return 0;
+        }
+        return ftell(file);
+    }
+
+    // Append a record and commit it according to the fsync policy
+    bool append(JournalRecordType type, const void* data, uint32_t length) {
+        uint64_t startedAt = metricTicks();
+        unique_lock<mutex> guard(lock);
+        uint64_t seq = file ? writeRecord(type, data, length) : 0;
+        bool ok = seq != 0 && commit(guard, seq);
+        recordLatency(METRIC_JOURNAL_APPEND, startedAt, !ok);
+        return ok;
+    }
+
+    // Append count records of one type and commit them together, so a
+    // bulk load pays for one fsync rather than one per record
+    bool appendBatch(JournalRecordType type, const void* records, uint32_t recordLength, int count) {
+        uint64_t startedAt = metricTicks();
+        unique_lock<mutex> guard(lock);
+        const char* record = static_cast<const char*>(records);
+        uint64_t seq = appendedSeq;
+        bool ok = file != nullptr;
+        for (int i = 0; i < count && ok; i++, record += recordLength) {
+            seq = writeRecord(type, record, recordLength);
+            ok = seq != 0;
+        }
+        ok = ok && commit(guard, seq);
+        recordLatency(METRIC_JOURNAL_APPEND, startedAt, !ok);
+        return ok;
+    }
+
+    // Force every appended record to disk
+    bool sync() {
+        unique_lock<mutex> guard(lock);
+        return file && waitDurable(guard, appendedSeq);
+    }
+
+    // Start a new journal for the records after checkpoint checkpointStamp.
+    // The records so far move to PREVIOUS_JOURNAL_FILE, which is kept until
+    // that checkpoint has been written (see dropPrevious()); if an earlier
+    // checkpoint never got that far, they are added to the end of it. The
+    // new journal, holding only its marker, is written beside the old one
+    // and renamed over it, so a follower still reading the old file can
+    // finish it. The caller must make sure no other thread is appending.
+    bool rotate(uint64_t checkpointStamp) {
+        lock_guard<mutex> guard(lock);
+        bool ok = file && syncFile(file);
+        if (file) {
+            fclose(file);
+        }
+        FILE* previous = fopen(PREVIOUS_JOURNAL_FILE, "rb");
+        if (previous) {
+            fclose(previous);
+            ok = ok && appendRecords(JOURNAL_FILE, PREVIOUS_JOURNAL_FILE);
+        } else {
+            ok = ok && replaceFile(JOURNAL_FILE, PREVIOUS_JOURNAL_FILE);
+        }
+        string tempPath = string(JOURNAL_FILE) + ".tmp";
+        JournalMarker marker = {checkpointStamp, stamp};
+        FILE* fresh = ok ? fopen(tempPath.c_str(), "wb") : nullptr;
+        ok = fresh && writeRecordTo(fresh, JOURNAL_CHECKPOINT, &marker, sizeof(marker)) && syncFile(fresh);
+        ok = fresh && fclose(fresh) == 0 && ok && replaceFile(tempPath.c_str(), JOURNAL_FILE);
+        if (ok) {
+            stamp = checkpointStamp;
+        }
+        openFile();
+        pendingRecords = 0;
+        recordCount = 0;
+        durableSeq = appendedSeq;
+        return ok && file;
+    }
+
+    // Delete the previous journal once the checkpoint that started the
+    // current one has been written
+    void dropPrevious() {
+        lock_guard<mutex> guard(lock);
+        remove(PREVIOUS_JOURNAL_FILE);
+    }
+
+    // Read a journal's marker from the start of the file. On success,
+    // offset is where its first record starts.
+    static bool readMarker(FILE* in, JournalMarker& marker, long& offset) {
+        offset = 0;
+        bool found = false;
+        readRecords(in, offset, 1, [&](JournalRecordType type, const char* data, uint32_t length) {
+            if (type == JOURNAL_CHECKPOINT && length == sizeof(marker)) {
+                memcpy(&marker, data, sizeof(marker));
+                found = true;
+            }
+        }, true);
+        if (!found) {
+            offset = 0;
+        }
+        return found;
+    }
+
+    // Feed up to maxRecords intact records, starting at byte offset, to
+    // apply(type, data, length), and move offset past them. Stops at the
+    // end of the file or at a torn or corrupt record, which a journal
+    // still being appended to may simply not have finished yet. Markers
+    // are skipped unless withMarkers is set. Returns the records read.
+    template <typename ApplyFn>
+    static int readRecords(FILE* in, long& offset, int maxRecords, ApplyFn apply, bool withMarkers = false) {
+        clearerr(in);
+        if (fseek(in, offset, SEEK_SET) != 0) {
+            return 0;
+        }
+        int read = 0;
+        JournalRecordHeader header;
+        vector<char> payload;
+        while (read < maxRecords && fread(&header, sizeof(header), 1, in) == 1) {
+            if (header.length > (1u << 20)) {
+                break; // Corrupt length
+            }
+            payload.resize(header.length);
+            if (header.length > 0 && fread(payload.data(), header.length, 1, in) != 1) {
+                break; // Torn write at the tail
+            }
+            uint32_t checksum = computeChecksum(payload.data(), header.length,
+                                                computeChecksum(&header.type, sizeof(header.type)));
+            if (checksum != header.checksum) {
+                break;
+            }
+            offset += sizeof(header) + header.length;
+            read++;
+            if (header.type != JOURNAL_CHECKPOINT || withMarkers) {
+                apply((JournalRecordType)header.type, payload.data(), header.length);
+            }
+        }
+        return read;
+    }
+
+    // Copy the intact records of journal file from, without its marker, to
+    // the end of journal file to, and sync it
+    static bool appendRecords(const char* from, const char* to) {
+        FILE* in = fopen(from, "rb");
+        if (!in) {
+            return false;
+        }
+        JournalMarker marker;
+        long start;
+        readMarker(in, marker, start);
+        long end = start;
+        readRecords(in, end, INT_MAX, [](JournalRecordType, const char*, uint32_t) {});
+        FILE* out = fopen(to, "ab");
+        bool ok = out && fseek(in, start, SEEK_SET) == 0;
+        char buffer[65536];
+        for (long left = end - start; ok && left > 0;) {
+            size_t chunk = (size_t)min(left, (long)sizeof(buffer));
+            ok = fread(buffer, chunk, 1, in) == 1 && fwrite(buffer, chunk, 1, out) == 1;
+            left -= (long)chunk;
+        }
+        ok = ok && syncFile(out);
+        ok = out && fclose(out) == 0 && ok;
+        fclose(in);
+        return ok;
+    }
+
+    // Feed every intact record to apply(type, data, length): first those
+    // of a previous journal whose checkpoint was never written, then those
+    // of the journal file. Records the checkpoint already has are skipped
+    // or change nothing. Returns the length of the intact part of the
+    // journal file.
+    template <typename ApplyFn>
+    static long replay(ApplyFn apply) {
+        long offset = 0;
+        FILE* in = fopen(PREVIOUS_JOURNAL_FILE, "rb");
+        if (in) {
+            readRecords(in, offset, INT_MAX, apply);
+            fclose(in);
+        }
+        in = fopen(JOURNAL_FILE, "rb");
+        if (!in) {
+            return 0;
+        }
+        offset = 0;
+        readRecords(in, offset, INT_MAX, apply);
+        fclose(in);
+        return offset;
+    }
+};
+
+// Next IDs stored in the last checkpoint. Journal records with lower IDs
+// are already part of the checkpoint and are skipped on replay.
+struct CheckpointIds {
+    int nextBusId;
+    int nextTicketId;
+    int nextBillId;
+    int nextWaitId;
+};
+
+// Number of days in a month (1-12) of a year
+int daysInMonth(int month, int year) {
+    static const int monthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leapYear = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return month == 2 && leapYear ? 29 : monthDays[month - 1];
+}
+
+// Function to check if a day, month and year name a real calendar date
+bool isCalendarDate(int day, int month, int year) {
+    return year >= 1 && month >= 1 && month <= 12 && day >= 1 && day <= daysInMonth(month, year);
+}
+
+// Pack a DD/MM/YYYY date into a sortable YYYYMMDD integer (0 if malformed
+// or not a calendar date)
+int packDate(const char* dateStr) {
+    if (strlen(dateStr) != 10 || dateStr[2] != '/' || dateStr[5] != '/') {
+        return 0;
+    }
+    for (int i = 0; i < 10; i++) {
+        if (i != 2 && i != 5 && !isdigit((unsigned char)dateStr[i])) {
+            return 0;
+        }
+    }
+    
+    int day = (dateStr[0] - '0') * 10 + (dateStr[1] - '0');
+    int month = (dateStr[3] - '0') * 10 + (dateStr[4] - '0');
+    int year = (dateStr[6] - '0') * 1000 + (dateStr[7] - '0') * 100 + 
+               (dateStr[8] - '0') * 10 + (dateStr[9] - '0');
+    if (!isCalendarDate(day, month, year)) {
+        return 0;
+    }
+    return year * 10000 + month * 100 + day;
+}
+
+// Function to check if a date is valid and not in the past
+bool isValidFutureDate(const char* dateStr) {
+    int date = packDate(dateStr);
+    if (date == 0 || date / 10000 < 2023) {
+        return false;
+    }
+    
+    // Get current date
+    time_t now = time(nullptr);
+    struct tm currentTime;
+#ifdef _WIN32
+    localtime_s(&currentTime, &now);
+#else
+    localtime_r(&now, &currentTime);
+#endif
+    int today = (currentTime.tm_year + 1900) * 10000 + (currentTime.tm_mon + 1) * 100 + currentTime.tm_mday;
+    
+    // Compare with current date
+    return date >= today;
+}
+
+// Function to check if a time is valid (HH:MM AM or HH:MM PM, 12-hour clock)
+bool isValidTime(const char* timeStr) {
+    int length = strlen(timeStr);
+    int hourDigits = length - 6; // "H:MM AM" or "HH:MM AM"
+    if (hourDigits < 1 || hourDigits > 2 || timeStr[hourDigits] != ':' || timeStr[length - 3] != ' ') {
+        return false;
+    }
+    for (int i = 0; i < length - 3; i++) {
+        if (i != hourDigits && !isdigit((unsigned char)timeStr[i])) {
+            return false;
+        }
+    }
+    
+    int hour = atoi(timeStr);
+    int minute = (timeStr[hourDigits + 1] - '0') * 10 + (timeStr[hourDigits + 2] - '0');
+    const char* suffix = timeStr + length - 2;
+    return hour >= 1 && hour <= 12 && minute <= 59 &&
+           (strcmp(suffix, "AM") == 0 || strcmp(suffix, "PM") == 0);
+}
+
+// Format a packed YYYYMMDD date as DD/MM/YYYY (11 bytes)
+void formatDate(int date, char* dateStr) {
+    unsigned packed = (unsigned)date; // Unsigned parts always fit their fields
+    snprintf(dateStr, 11, "%02u/%02u/%04u", packed % 100, packed / 100 % 100, packed / 10000 % 10000);
+}
+
+// Minutes after midnight of a valid HH:MM AM or HH:MM PM time
+int minutesOfDay(const char* timeStr) {
+    int hour = atoi(timeStr) % 12;
+    int minute = atoi(strchr(timeStr, ':') + 1);
+    if (timeStr[strlen(timeStr) - 2] == 'P') {
+        hour += 12;
+    }
+    return hour * 60 + minute;
+}
+
+// Format minutes after midnight as HH:MM AM or HH:MM PM (9 bytes). Times
+// past midnight wrap to the next day.
+void formatMinutes(int minutes, char* timeStr) {
+    unsigned int minute = (unsigned int)minutes % (24 * 60);
+    unsigned int hour = minute / 60 % 12;
+    snprintf(timeStr, 9, "%02u:%02u %cM", hour == 0 ? 12 : hour, minute % 60, minute < 12 * 60 ? 'A' : 'P');
+}
+
+// The day after a packed YYYYMMDD date (0 if the date is not a calendar
+// date, which packDate() never returns)
+int nextDate(int date) {
+    int day = date % 100;
+    int month = date / 100 % 100;
+    int year = date / 10000;
+    if (!isCalendarDate(day, month, year)) {
+        return 0;
+    }
+    if (day < daysInMonth(month, year)) {
+        return date + 1;
+    }
+    return month == 12 ? (year + 1) * 10000 + 101 : year * 10000 + (month + 1) * 100 + 1;
+}
+
+// Format seconds since the epoch like ctime(), without the newline (30 bytes)
+void formatDateTime(int64_t seconds, char* dateTime) {
+    time_t when = (time_t)seconds;
+#ifdef _WIN32
+    ctime_s(dateTime, 30, &when);
+#else
+    ctime_r(&when, dateTime);
+#endif
+    // Remove newline
+    int len = strlen(dateTime);
+    if (len > 0 && dateTime[len-1] == '\n') {
+        dateTime[len-1] = '\0';
+    }
+}
+
+// Instruction sets the scan filters can use
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2
+};
+
+// Best instruction set this CPU supports
+SimdLevel detectSimdLevel() {
+#ifdef X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SIMD_SSE2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SIMD_AVX2: return "avx2";
+        case SIMD_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+// Instruction set used by the filters below. main() may lower it.
+SimdLevel simdLevel = detectSimdLevel();
+
+// The filters work on a selection bitmap with one bit per row: every
+// filter clears the bits of rows that fail its condition, so a chain of
+// filters ANDs them together. The vector versions handle whole groups of
+// 64 rows and return how many rows they covered; the scalar loop finishes
+// the rest.
+
+// Select the first count rows
+void selectAll(uint64_t* keep, int count) {
+    int words = (count + 63) / 64;
+    for (int w = 0; w < words; w++) {
+        keep[w] = ~0ULL;
+    }
+    if (count % 64 != 0) {
+        keep[words - 1] = (1ULL << (count % 64)) - 1;
+    }
+}
+
+// Call visit(row) for every selected row, in order
+template <typename Fn>
+void forEachSelected(const uint64_t* keep, int count, Fn visit) {
+    int words = (count + 63) / 64;
+    for (int w = 0; w < words; w++) {
+        uint64_t bits = keep[w];
+        while (bits != 0) {
+#ifdef __GNUC__
+            int bit = __builtin_ctzll(bits);
+#else
+            int bit = 0;
+            while (!(bits & (1ULL << bit))) {
+                bit++;
+            }
+#endif
+            visit(w * 64 + bit);
+            bits &= bits - 1;
+        }
+    }
+}
+
+#ifdef X86_SIMD
+__attribute__((target("avx2")))
+int filterInt32RangeAvx2(const int32_t* values, int count, int32_t low, int32_t high, uint64_t* keep) {
+    __m256i lowVector = _mm256_set1_epi32(low);
+    __m256i highVector = _mm256_set1_epi32(high);
+    int row = 0;
+    for (; row + 64 <= count; row += 64) {
+        uint64_t rejected = 0;
+        for (int lane = 0; lane < 64; lane += 8) {
+            __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + row + lane));
+            __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(lowVector, value),
+                                              _mm256_cmpgt_epi32(value, highVector));
+            rejected |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(outside)) << lane;
+        }
+        keep[row / 64] &= ~rejected;
+    }
+    return row;
+}
+
+__attribute__((target("sse2")))
+int filterInt32RangeSse2(const int32_t* values, int count, int32_t low, int32_t high, uint64_t* keep) {
+    __m128i lowVector = _mm_set1_epi32(low);
+    __m128i highVector = _mm_set1_epi32(high);
+    int row = 0;
+    for (; row + 64 <= count; row += 64) {
+        uint64_t rejected = 0;
+        for (int lane = 0; lane < 64; lane += 4) {
+            __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + row + lane));
+            __m128i outside = _mm_or_si128(_mm_cmpgt_epi32(lowVector, value),
+                                           _mm_cmpgt_epi32(value, highVector));
+            rejected |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(outside)) << lane;
+        }
+        keep[row / 64] &= ~rejected;
+    }
+    return row;
+}
+
+__attribute__((target("avx2")))
+int filterDoubleRangeAvx2(const double* values, int count, double low, double high, uint64_t* keep) {
+    __m256d lowVector = _mm256_set1_pd(low);
+    __m256d highVector = _mm256_set1_pd(high);
+    int row = 0;
+    for (; row + 64 <= count; row += 64) {
+        uint64_t rejected = 0;
+        for (int lane = 0; lane < 64; lane += 4) {
+            __m256d value = _mm256_loadu_pd(values + row + lane);
+            __m256d outside = _mm256_or_pd(_mm256_cmp_pd(value, lowVector, _CMP_LT_OQ),
+                                           _mm256_cmp_pd(value, highVector, _CMP_GT_OQ));
+            rejected |= (uint64_t)_mm256_movemask_pd(outside) << lane;
+        }
+        keep[row / 64] &= ~rejected;
+    }
+    return row;
+}
+
+__attribute__((target("sse2")))
+int filterDoubleRangeSse2(const double* values, int count, double low, double high, uint64_t* keep) {
+    __m128d lowVector = _mm_set1_pd(low);
+    __m128d highVector = _mm_set1_pd(high);
+    int row = 0;
+    for (; row + 64 <= count; row += 64) {
+        uint64_t rejected = 0;
+        for (int lane = 0; lane < 64; lane += 2) {
+            __m128d value = _mm_loadu_pd(values + row + lane);
+            __m128d outside = _mm_or_pd(_mm_cmplt_pd(value, lowVector), _mm_cmpgt_pd(value, highVector));
+            rejected |= (uint64_t)_mm_movemask_pd(outside) << lane;
+        }
+        keep[row / 64] &= ~rejected;
+    }
+    return row;
+}
+
+__attribute__((target("avx2")))
+int filterByteEqualsAvx2(const uint8_t* values, int count, uint8_t wanted, uint64_t* keep) {
+    __m256i wantedVector = _mm256_set1_epi8((char)wanted);
+    int row = 0;
+    for (; row + 64 <= count; row += 64) {
+        uint64_t matched = 0;
+        for (int lane = 0; lane < 64; lane += 32) {
+            __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + row + lane));
+            matched |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(value, wantedVector)) << lane;
+        }
+        keep[row / 64] &= matched;
+    }
+    return row;
+}
+
+__attribute__((target("sse2")))
+int filterByteEqualsSse2(const uint8_t* values, int count, uint8_t wanted, uint64_t* keep) {
+    __m128i wantedVector = _mm_set1_epi8((char)wanted);
+    int row = 0;
+    for (; row + 64 <= count; row += 64) {
+        uint64_t matched = 0;
+        for (int lane = 0; lane < 64; lane += 16) {
+            __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + row + lane));
+            matched |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(value, wantedVector)) << lane;
+        }
+        keep[row / 64] &= matched;
+    }
+    return row;
+}
+#endif
+
+// Keep rows whose value is between low and high (inclusive)
+void filterInt32Range(const int32_t* values, int count, int32_t low, int32_t high, uint64_t* keep) {
+    int row = 0;
+#ifdef X86_SIMD
+    if (simdLevel == SIMD_AVX2) {
+        row = filterInt32RangeAvx2(values, count, low, high, keep);
+    } else if (simdLevel == SIMD_SSE2) {
+        row = filterInt32RangeSse2(values, count, low, high, keep);
+    }
+#endif
+    for (; row < count; row++) {
+        if (values[row] < low || values[row] > high) {
+            keep[row / 64] &= ~(1ULL << (row % 64));
+        }
+    }
+}
+
+// Keep rows whose value is between low and high (inclusive)
+void filterDoubleRange(const double* values, int count, double low, double high, uint64_t* keep) {
+    int row = 0;
+#ifdef X86_SIMD
+    if (simdLevel == SIMD_AVX2) {
+        row = filterDoubleRangeAvx2(values, count, low, high, keep);
+    } else if (simdLevel == SIMD_SSE2) {
+        row = filterDoubleRangeSse2(values, count, low, high, keep);
+    }
+#endif
+    for (; row < count; row++) {
+        if (values[row] < low || values[row] > high) {
+            keep[row / 64] &= ~(1ULL << (row % 64));
+        }
+    }
+}
+
+// Keep rows whose value equals wanted
+void filterByteEquals(const uint8_t* values, int count, uint8_t wanted, uint64_t* keep) {
+    int row = 0;
+#ifdef X86_SIMD
+    if (simdLevel == SIMD_AVX2) {
+        row = filterByteEqualsAvx2(values, count, wanted, keep);
+    } else if (simdLevel == SIMD_SSE2) {
+        row = filterByteEqualsSse2(values, count, wanted, keep);
+    }
+#endif
+    for (; row < count; row++) {
+        if (values[row] != wanted) {
+            keep[row / 64] &= ~(1ULL << (row % 64));
+        }
+    }
+}
+
+// Result codes returned by the reservation API
+enum OperationStatus {
+    STATUS_OK,
+    STATUS_BUS_NOT_FOUND,
+    STATUS_TICKET_NOT_FOUND,
+    STATUS_INVALID_SEAT,
+    STATUS_SEAT_TAKEN,
+    STATUS_BUS_FULL,
+    STATUS_DUPLICATE_BUS_NUMBER,
+    STATUS_BUS_HAS_BOOKINGS,
+    STATUS_JOURNAL_FAILED,
+    STATUS_INVALID_DATE,
+    STATUS_INVALID_BUS,
+    STATUS_BAD_REQUEST,
+    STATUS_INVALID_TIME,
+    STATUS_NO_ADJACENT_SEATS,
+    STATUS_HOLD_NOT_FOUND,
+    STATUS_SEATS_AVAILABLE,
+    STATUS_WAITLIST_NOT_FOUND,
+    STATUS_READ_ONLY,
+    STATUS_CROSS_SHARD,
+    STATUS_SHARD_UNAVAILABLE
+};
+
+// Describe a result code
+const char* statusMessage(OperationStatus status) {
+    switch (status) {
+        case STATUS_OK: return "OK";
+        case STATUS_BUS_NOT_FOUND: return "Bus not found";
+        case STATUS_TICKET_NOT_FOUND: return "Ticket not found or already cancelled";
+        case STATUS_INVALID_SEAT: return "Invalid seat number";
+        case STATUS_SEAT_TAKEN: return "Seat is already booked";
+        case STATUS_BUS_FULL: return "No seats available";
+        case STATUS_DUPLICATE_BUS_NUMBER: return "Bus number already exists";
+        case STATUS_BUS_HAS_BOOKINGS: return "Bus has active bookings";
+        case STATUS_JOURNAL_FAILED: return "Change could not be saved";
+        case STATUS_INVALID_DATE: return "Date must be DD/MM/YYYY, today or later";
+        case STATUS_INVALID_BUS: return "Bus details are incomplete or out of range";
+        case STATUS_BAD_REQUEST: return "Malformed request";
+        case STATUS_INVALID_TIME: return "Time must be HH:MM AM or HH:MM PM";
+        case STATUS_NO_ADJACENT_SEATS: return "Not enough adjacent seats";
+        case STATUS_HOLD_NOT_FOUND: return "Hold not found or expired";
+        case STATUS_SEATS_AVAILABLE: return "Bus still has free seats";
+        case STATUS_WAITLIST_NOT_FOUND: return "Not on the waitlist";
+        case STATUS_READ_ONLY: return "Read-only replica; send changes to the primary";
+        case STATUS_CROSS_SHARD: return "Request spans shards; split it per shard";
+        case STATUS_SHARD_UNAVAILABLE: return "Shard unavailable";
+    }
+    return "Unknown error";
+}
+
+// Outcome of a reservation API call
+struct OperationResult {
+    OperationStatus status;
+    int busId;
+    int ticketId;
+    int seatNumber;
+    double fare;
+    int billId; // Bill generated by this operation, or 0
+    int promotedTicketId; // Waitlisted booking that took a cancelled seat, or 0
+};
+
+// Running revenue and occupancy totals for a bus, a route, a travel day or
+// the whole system. Updated on every booking and cancellation.
+struct RevenueRollup {
+    double revenue;     // Fares of tickets currently booked
+    int passengers;     // Tickets currently booked
+    int seats;          // Seats on the buses counted
+    long bookings;      // Bookings made, including ones later cancelled
+    long cancellations;
+
+    double loadFactor() const {
+        return seats > 0 ? (double)passengers / seats : 0.0;
+    }
+};
+
+// Outcome of joining a waitlist
+struct WaitlistResult {
+    OperationStatus status;
+    int waitId;
+    int ahead; // Passengers ahead in the bus's waitlist
+};
+
+// Outcome of placing a seat hold
+struct HoldResult {
+    OperationStatus status;
+    int holdId;
+    int busId;
+    int seatNumber;
+    double fare;
+    int expiresIn; // Seconds
+};
+
+// One bus of a journey planner timetable
+struct JourneyConnection {
+    int departAt; // Minutes after midnight of the timetable's first date
+    int arriveAt;
+    int fromCity; // Timetable city numbers
+    int toCity;
+    int busIndex;
+};
+
+// Timetable the journey planner searches: every active bus departing on a
+// run of JOURNEY_DAYS travel dates, in departure order. Cities are
+// renumbered densely so the planner's per-city arrays stay small.
+struct JourneyTimetable {
+    int lastDate;                          // Last travel date covered
+    vector<int> cityIds;                   // City number -> interned city ID
+    vector<JourneyConnection> connections; // By departure time
+};
+
+// One bus ride of a planned journey
+struct JourneyLeg {
+    Bus bus;      // Copy of the bus
+    int departAt; // Minutes after midnight of the journey's travel date
+    int arriveAt;
+};
+
+// A journey found by the planner, legs in travel order
+struct Journey {
+    int legCount;
+    JourneyLeg legs[JOURNEY_MAX_LEGS];
+    double fare;
+};
+
+// Revenue rollup for one route
+struct RouteRevenue {
+    const char* source; // Interned city names
+    const char* destination;
+    RevenueRollup totals;
+};
+
+// Revenue rollup for one travel day
+struct DayRevenue {
+    int date; // Packed YYYYMMDD
+    RevenueRollup totals;
+};
+
+// One seat to book in a bulk import or a group booking
+struct BookingRequest {
+    int busId;
+    int seatNumber; // 1-based, or 0 for the first free seat
+    Passenger passenger;
+};
+
+// Outcome of a group booking: every seat was booked, or none was
+struct GroupBookingResult {
+    OperationStatus status;
+    int failedRequest;                // Request that failed the group, or -1
+    vector<OperationResult> bookings; // One per request, when status is STATUS_OK
+};
+
+// Records the latency of one API call when it goes out of scope, as a
+// failure if the call's status is set to anything but STATUS_OK
+class OperationTimer {
+private:
+    MetricOperation operation;
+    const OperationStatus* status;
+    uint64_t startedAt;
+
+public:
+    OperationTimer(MetricOperation timedOperation, const OperationStatus* resultStatus = nullptr)
+        : operation(timedOperation), status(resultStatus), startedAt(metricTicks()) {}
+
+    ~OperationTimer() {
+        recordLatency(operation, startedAt, status && *status != STATUS_OK);
+    }
+};
+
+// Point-in-time sizes of the service's stores
+struct ServiceGauges {
+    int buses;          // Active buses
+    int tickets;        // Tickets stored, booked or cancelled and not yet compacted
+    int bookedTickets;
+    int bills;
+    long freeSeats;     // Over all active buses, not counting held seats
+    int heldSeats;
+    int waitlisted;     // Passengers on waitlists
+    int strings;        // Interned bus numbers and city names
+    int freeSlots;      // Bus and ticket slots freed by compaction, awaiting reuse
+    long journalBytes;
+    long replicaLagBytes;     // Followed journal not yet applied; 0 unless following
+    long replicaLagMillis;    // Since the follower last had the whole journal
+    long replicaLoadProblems; // Failed checkpoint loads, and data file problems met reloading after startup
+};
+
+// Conditions for findTickets() and findBuses(). A record matches when it
+// meets every condition that is set.
+struct ScanQuery {
+    int busId;               // 0 for any bus
+    const char* source;      // Null or empty for any city
+    const char* destination;
+    int fromDate;            // Packed YYYYMMDD, inclusive
+    int toDate;
+    double minFare;          // Ticket fare, or a bus's ticket price
+    double maxFare;
+    int bookedState;         // Tickets only: -1 any, 0 cancelled, 1 booked
+    int minFreeSeats;        // Buses only: 0 for any
+};
+
+// Ticket fields the scan filters read, one column per field and one row
+// per ticket index. The columns are never mapped, so they all share the
+// same chunk boundaries.
+struct TicketColumns {
+    RecordStore<int32_t> busIds;
+    RecordStore<int32_t> travelDates;
+    RecordStore<int32_t> sourceIds;
+    RecordStore<int32_t> destinationIds;
+    RecordStore<double> fares;
+    RecordStore<uint8_t> booked;
+
+    void clear() {
+        busIds.clear();
+        travelDates.clear();
+        sourceIds.clear();
+        destinationIds.clear();
+        fares.clear();
+        booked.clear();
+    }
+};
+
+// Headless reservation service. Owns the stores, indexes, journal and
+// checkpoints and does no terminal I/O, so it can back the console menu or
+// any other front end. Every public method is thread-safe.
+class ReservationService {
+private:
+    RecordStore<Bus> buses;
+    TicketStore tickets;
+    TicketColumns ticketColumns; // Copy of the filterable ticket fields
+    RecordStore<BusBill> busBills; // Store for bus bills
+    ObjectPool stateNodes; // Nodes of the hash indexes guarded by stateLock
+    ObjectPool indexNodes; // and by indexLock, so bookings reuse freed nodes
+    PooledMap<int, int> busIndexById{stateNodes};    // Active bus ID -> bus index
+    PooledMap<int, int> ticketIndexById{indexNodes}; // Ticket ID -> ticket index
+    PooledMap<int, int> billIndexById{indexNodes};   // Bill ID -> bill index
+    PooledMap<int, int> billIndexByBus{indexNodes};  // Bus ID -> latest bill index
+    // Bus ID -> booked ticket indexes (ascending). A list is created with
+    // room for every seat when its bus is indexed (stateLock exclusive) and
+    // kept, when its bus has no bookings left, until the bus is deleted.
+    PooledMap<int, vector<int>> liveTicketsByBus{indexNodes};
+    int liveTicketCount; // Booked tickets over all lists
+    unordered_map<string, int> busIndexByNumber; // Active bus number -> bus index
+    map<RouteKey, int> routeIndex;         // (source, destination, date) -> active bus index
+    map<DepartureKey, int> departureIndex; // (source, date) -> active bus index
+    // Journey planner timetables, keyed by first travel date. Each is a
+    // snapshot built on first use for a date with departures and dropped when a bus it covers is added
+    // or deleted (with stateLock exclusive); journeyLock serializes
+    // planners building one under a shared stateLock.
+    map<int, unique_ptr<JourneyTimetable>> journeyTimetables;
+    mutex journeyLock;
+    
+    // Revenue aggregates. Entries are created with stateLock held
+    // exclusively and their totals change with indexLock held exclusively,
+    // so readers hold both locks shared.
+    struct BusStats {
+        RevenueRollup totals;
+        RevenueRollup* route; // Rollups the bus counts towards
+        RevenueRollup* day;
+    };
+    unordered_map<int, BusStats> busStats; // Bus ID -> totals. Deleted buses stay, so reports keep their history
+    // Bus ID -> what compaction dropped, counted back into busStats.
+    // Compaction changes it with stateLock or indexLock held exclusively;
+    // readers hold stateLock exclusively.
+    unordered_map<int, BusHistory> busHistory;
+    map<pair<int, int>, RevenueRollup> routeRollups; // (source ID, destination ID) -> totals
+    map<int, RevenueRollup> dayRollups; // Packed travel date -> totals
+    RevenueRollup systemTotals;
+    int nextTicketId;
+    int nextBusId;
+    int nextBillId;
+    Journal journal;
+    MappedFile busFileMap;    // Checkpoint files whose records are
+    MappedFile ticketFileMap; // served in place by the stores
+    MappedFile passengerFileMap;
+    MappedFile billFileMap;
+    MappedFile stringFileMap;
+    StringDictionary strings; // Interned bus numbers and city names
+    
+    // Locking for concurrent booking. Bookings and cancellations hold
+    // stateLock shared plus the lock of their bus, so different buses book
+    // in parallel. Adding or deleting a bus and copying the stores for a
+    // checkpoint hold stateLock exclusively. indexLock guards ticket and bill appends, the ticket and
+    // bill indexes and ticket status changes. A follower applies the owner's
+    // journal holding both exclusively.
+    shared_mutex stateLock;
+    shared_mutex indexLock;
+    mutex busLocks[BUS_LOCK_STRIPES];
+    // Problems found while the constructor loaded the data files. Nothing
+    // adds to them once it has returned, so they are read without a lock.
+    vector<string> warnings;
+    bool startedUp; // The constructor has loaded; see warn()
+    bool readOnly;
+    ShardSpec shard;
+    uint64_t checkpointStamp; // Stamp of the last checkpoint written or loaded
+    vector<uint64_t> loadedStamps; // Stamps of the files the last load read (0 for none)
+    
+    // Slots of compacted tickets (guarded by indexLock) and buses (guarded
+    // by stateLock), reused before the stores grow
+    vector<int> freeTicketSlots;
+    vector<int> freeBusSlots;
+    
+    // Checkpoints. checkpointLock serializes them. Each copies the stores
+    // into the snapshot under a short exclusive stateLock and writes the
+    // copy without it, so bookings carry on while the files are written.
+    // Strings, bills and ticket details are only ever appended to, so only
+    // their sizes are copied; compacted ticket slots are not reused while
+    // the details are written. Periodic checkpoints run on the checkpointer
+    // thread: the operation that fills the journal only wakes it.
+    struct CheckpointSnapshot {
+        CheckpointIds ids;
+        int stringCount;
+        int ticketCount;
+        int billCount;
+        vector<Bus> buses;
+        vector<TicketCore> ticketCores;
+        vector<WaitlistEntry> waiting;
+        vector<BusHistory> history;
+    };
+    mutex checkpointLock;
+    CheckpointSnapshot snapshot; // Guarded by checkpointLock
+    bool reuseTicketSlots;       // Guarded by indexLock
+    thread checkpointer;
+    mutex checkpointerLock;
+    condition_variable checkpointerWake;
+    atomic<bool> checkpointRequested;
+    bool stoppingCheckpointer;
+    
+    // Seat holds. A held seat is claimed in its bus's seat map, so nobody
+    // else can book it, but has no ticket until the hold is confirmed.
+    // Holds are not journaled: they live in memory and a restart frees
+    // their seats. holdLock guards the holds and their timer wheel and is
+    // taken last, after stateLock and any bus lock.
+    struct SeatHold {
+        int busId;
+        int seatNumber; // 1-based
+        int timer;      // Timer wheel handle, or -1 once the hold has expired
+    };
+    mutex holdLock;
+    ObjectPool holdNodes;
+    PooledMap<int, SeatHold> holds{holdNodes};       // Hold ID -> hold
+    PooledMap<int, int> heldSeatsByBus{holdNodes};   // Bus ID -> seats held
+    TimerWheel holdTimers; // Expiry, in HOLD_TICK_MS ticks since holdClockOrigin
+    chrono::steady_clock::time_point holdClockOrigin;
+    int nextHoldId;
+    thread holdReaper; // Started by the first hold
+    condition_variable holdReaperWake;
+    bool stoppingHoldReaper;
+    
+    // Journal shipping (OPEN_FOLLOWER). The follower thread tails the
+    // owner's journal and applies each record it finds, holding stateLock
+    // and indexLock exclusively as the owner's own changes would. When
+    // the owner checkpoints, the old journal is read to its end and the
+    // new one carries on from it; a follower that missed a whole journal
+    // reloads the checkpoint instead. The fields below belong to the
+    // follower thread once it has started.
+    bool following;
+    bool followerLoaded;        // A consistent checkpoint has been loaded
+    FILE* followedJournal;      // Journal being applied, kept open across renames
+    uint64_t followedStamp;     // Checkpoint stamp in its marker
+    long followedOffset;        // Bytes of it applied
+    CheckpointIds followedIds;  // Next IDs of the checkpoint loaded
+    thread follower;
+    mutex followerLock;
+    condition_variable followerWake;
+    bool stoppingFollower;
+    atomic<long> followerLagBytes;      // Journal bytes not yet applied at the last poll
+    atomic<int64_t> followerCaughtUpAt; // Steady clock milliseconds when last fully applied
+    atomic<long> followerLoadProblems;  // See ServiceGauges::replicaLoadProblems
+    
+    // Waitlists of full buses. All buses share one ordered index whose key
+    // puts each bus's waiters together, highest priority first and then in
+    // joining order, so joining, leaving and promoting the head of a bus's
+    // list are O(log n) however many buses have waiters. A seat freed by a
+    // cancellation or an ended hold goes straight to the head of the list.
+    // waitlistLock guards both maps and is taken last, after stateLock and
+    // any bus lock; changes also hold their bus's lock.
+    struct WaitlistKey {
+        int busId;
+        int priority;
+        int waitId;
+        
+        bool operator<(const WaitlistKey& other) const {
+            if (busId != other.busId) {
+                return busId < other.busId;
+            }
+            if (priority != other.priority) {
+                return priority > other.priority;
+            }
+            return waitId < other.waitId;
+        }
+    };
+    mutex waitlistLock;
+    ObjectPool waitlistNodes;
+    map<WaitlistKey, WaitlistEntry, less<WaitlistKey>,
+        PoolAllocator<pair<const WaitlistKey, WaitlistEntry>>> waitlists{waitlistNodes};
+    PooledMap<int, WaitlistKey> waitlistKeys{waitlistNodes}; // Wait ID -> key
+    int nextWaitId;
+    
+    // String copy function
+    void copyString(char* dest, const char* src) {
+        strcpy(dest, src);
+    }
+
+    // Find bus by ID
+    int findBusById(int busId) {
+        auto it = busIndexById.find(busId);
+        return it == busIndexById.end() ? -1 : it->second;
+    }
+
+    // Find ticket by ID (booked tickets only)
+    int findTicketById(int ticketId) {
+        int ticketIndex = findTicketRecord(ticketId);
+        if (ticketIndex != -1 && tickets.core(ticketIndex).isBooked) {
+            return ticketIndex;
+        }
+        return -1;
+    }
+
+    // Find ticket by ID, including cancelled tickets not yet compacted
+    int findTicketRecord(int ticketId) {
+        auto it = ticketIndexById.find(ticketId);
+        return it == ticketIndexById.end() ? -1 : it->second;
+    }
+
+    // Check if bus has active bookings
+    bool hasActiveBookings(int busId) {
+        auto it = liveTicketsByBus.find(busId);
+        return it != liveTicketsByBus.end() && !it->second.empty();
+    }
+
+    // Index a newly stored bus
+    void indexBus(int busIndex) {
+        const Bus& bus = buses[busIndex];
+        if (!bus.isActive) {
+            return;
+        }
+        int date = packDate(bus.travelDate);
+        busIndexById[bus.busId] = busIndex;
+        busIndexByNumber[bus.busNumber] = busIndex;
+        routeIndex[RouteKey{bus.sourceId, bus.destinationId, date, bus.busId}] = busIndex;
+        departureIndex[DepartureKey{bus.sourceId, date, bus.busId}] = busIndex;
+        dropJourneyTimetables(date);
+        // The live ticket list gets its capacity now, so booking a seat
+        // never allocates
+        liveTicketsByBus[bus.busId].reserve(bus.totalSeats);
+    }
+
+    // Remove a deleted bus from the bus indexes
+    void unindexBus(int busIndex) {
+        const Bus& bus = buses[busIndex];
+        int date = packDate(bus.travelDate);
+        busIndexById.erase(bus.busId);
+        busIndexByNumber.erase(bus.busNumber);
+        routeIndex.erase(RouteKey{bus.sourceId, bus.destinationId, date, bus.busId});
+        departureIndex.erase(DepartureKey{bus.sourceId, date, bus.busId});
+        dropJourneyTimetables(date);
+    }
+
+    // Drop the journey timetables covering a travel date
+    void dropJourneyTimetables(int date) {
+        for (auto it = journeyTimetables.begin(); it != journeyTimetables.end() && it->first <= date;) {
+            if (date <= it->second->lastDate) {
+                it = journeyTimetables.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Timetable of the buses departing on a travel date and the
+    // JOURNEY_DAYS - 1 dates after it. Built from the departure index,
+    // one range per source city. Only timetables with a bus in them are
+    // kept, so clients asking for arbitrary dates cannot grow the cache
+    // past the dates that have departures. The caller holds stateLock.
+    const JourneyTimetable& journeyTimetable(int date) {
+        static const JourneyTimetable noBuses{};
+        lock_guard<mutex> guard(journeyLock);
+        auto cached = journeyTimetables.find(date);
+        if (cached != journeyTimetables.end()) {
+            return *cached->second;
+        }
+        unique_ptr<JourneyTimetable> timetable(new JourneyTimetable());
+        unordered_map<int, int> cityNumbers; // Interned city ID -> city number
+        auto cityNumber = [&](int cityId) {
+            auto inserted = cityNumbers.emplace(cityId, (int)timetable->cityIds.size());
+            if (inserted.second) {
+                timetable->cityIds.push_back(cityId);
+            }
+            return inserted.first->second;
+        };
+        
+        int travelDate = date;
+        for (int day = 0; day < JOURNEY_DAYS; day++, travelDate = nextDate(travelDate)) {
+            timetable->lastDate = travelDate;
+            auto it = departureIndex.begin();
+            while (it != departureIndex.end()) {
+                int sourceId = it->first.sourceId;
+                it = departureIndex.lower_bound(DepartureKey{sourceId, travelDate, INT_MIN});
+                for (; it != departureIndex.end() && it->first.sourceId == sourceId &&
+                       it->first.travelDate == travelDate; ++it) {
+                    const Bus& bus = buses[it->second];
+                    JourneyConnection connection;
+                    connection.departAt = day * 24 * 60 + minutesOfDay(bus.departureTime);
+                    connection.arriveAt = day * 24 * 60 + minutesOfDay(bus.arrivalTime);
+                    if (connection.arriveAt <= connection.departAt) {
+                        connection.arriveAt += 24 * 60; // Arrives the next day
+                    }
+                    connection.fromCity = cityNumber(bus.sourceId);
+                    connection.toCity = cityNumber(bus.destinationId);
+                    connection.busIndex = it->second;
+                    timetable->connections.push_back(connection);
+                }
+                it = departureIndex.lower_bound(DepartureKey{sourceId + 1, INT_MIN, INT_MIN});
+            }
+        }
+        if (timetable->connections.empty()) {
+            return noBuses;
+        }
+        stable_sort(timetable->connections.begin(), timetable->connections.end(),
+                    [](const JourneyConnection& a, const JourneyConnection& b) {
+                        return a.departAt < b.departAt;
+                    });
+        return *(journeyTimetables[date] = move(timetable));
+    }
+
+    // Find active buses on a route travelling between two dates (inclusive)
+    void findBusesOnRoute(ArenaVector<int>& result, const char* source, const char* destination,
+                          int fromDate = 0, int toDate = INT_MAX) {
+        int sourceId = strings.find(source);
+        int destinationId = strings.find(destination);
+        if (sourceId == -1 || destinationId == -1) {
+            return; // A city no bus has ever served
+        }
+        auto it = routeIndex.lower_bound(RouteKey{sourceId, destinationId, fromDate, INT_MIN});
+        auto end = routeIndex.upper_bound(RouteKey{sourceId, destinationId, toDate, INT_MAX});
+        for (; it != end; ++it) {
+            result.push_back(it->second);
+        }
+    }
+
+    // Find all active buses departing from a city between two dates (inclusive)
+    void findDepartures(ArenaVector<int>& result, const char* source, int fromDate, int toDate) {
+        int sourceId = strings.find(source);
+        if (sourceId == -1) {
+            return;
+        }
+        auto it = departureIndex.lower_bound(DepartureKey{sourceId, fromDate, INT_MIN});
+        auto end = departureIndex.upper_bound(DepartureKey{sourceId, toDate, INT_MAX});
+        for (; it != end; ++it) {
+            result.push_back(it->second);
+        }
+    }
+
+    // Find active bus by bus number
+    int findBusByNumber(const char* busNumber) {
+        auto it = busIndexByNumber.find(busNumber);
+        return it == busIndexByNumber.end() ? -1 : it->second;
+    }
+
+    // Start revenue totals for a stored bus
+    void trackBus(const Bus& bus) {
+        trackBus(bus.busId, bus.sourceId, bus.destinationId, packDate(bus.travelDate), bus.totalSeats);
+    }
+
+    void trackBus(int busId, int sourceId, int destinationId, int travelDate, int totalSeats) {
+        BusStats& stats = busStats[busId];
+        memset(&stats.totals, 0, sizeof(stats.totals));
+        stats.totals.seats = totalSeats;
+        stats.route = &routeRollups[make_pair(sourceId, destinationId)];
+        stats.day = &dayRollups[travelDate];
+        stats.route->seats += totalSeats;
+        stats.day->seats += totalSeats;
+        systemTotals.seats += totalSeats;
+    }
+
+    // Count a bus's compacted history back into its rollups
+    void countHistory(const BusHistory& history) {
+        if (history.removed) {
+            trackBus(history.busId, history.sourceId, history.destinationId, history.travelDate,
+                     history.totalSeats);
+        }
+        auto it = busStats.find(history.busId);
+        if (it == busStats.end()) {
+            return;
+        }
+        RevenueRollup* rollups[4] = {&it->second.totals, it->second.route, it->second.day, &systemTotals};
+        for (RevenueRollup* rollup : rollups) {
+            rollup->bookings += history.cancelledTickets;
+            rollup->cancellations += history.cancelledTickets;
+        }
+    }
+
+    // History entry of a bus, created empty on first use
+    BusHistory& historyOf(int busId) {
+        BusHistory& history = busHistory[busId];
+        history.busId = busId;
+        return history;
+    }
+
+    // Add or remove a ticket's fare in every rollup it counts towards
+    void countTicket(const TicketCore& ticket, bool booked) {
+        auto it = busStats.find(ticket.busId);
+        if (it == busStats.end()) {
+            return;
+        }
+        RevenueRollup* rollups[4] = {&it->second.totals, it->second.route, it->second.day, &systemTotals};
+        for (RevenueRollup* rollup : rollups) {
+            if (booked) {
+                rollup->revenue += ticket.fare;
+                rollup->passengers++;
+                rollup->bookings++;
+            } else {
+                rollup->revenue -= ticket.fare;
+                rollup->passengers--;
+                rollup->cancellations++;
+            }
+        }
+    }
+
+    // Index a newly stored ticket, appended or in a reused slot
+    void indexTicket(int ticketIndex) {
+        const TicketCore& ticket = tickets.core(ticketIndex);
+        const TicketDetails& details = tickets.detail(ticketIndex);
+        ticketIndexById[ticket.ticketId] = ticketIndex;
+        auto setColumn = [ticketIndex](auto& column, auto value) {
+            if (ticketIndex < column.size()) {
+                column[ticketIndex] = value;
+            } else {
+                column.push_back(value);
+            }
+        };
+        setColumn(ticketColumns.busIds, ticket.busId);
+        setColumn(ticketColumns.travelDates, details.travelDate);
+        setColumn(ticketColumns.sourceIds, details.sourceId);
+        setColumn(ticketColumns.destinationIds, details.destinationId);
+        setColumn(ticketColumns.fares, ticket.fare);
+        setColumn(ticketColumns.booked, (uint8_t)ticket.isBooked);
+        countTicket(ticket, true);
+        if (ticket.isBooked) {
+            vector<int>& live = liveTicketsByBus[ticket.busId];
+            if (live.capacity() == 0) {
+                live.reserve(MAX_SEATS); // A deleted bus's list, loaded from a checkpoint
+            }
+            live.insert(upper_bound(live.begin(), live.end(), ticketIndex), ticketIndex);
+            liveTicketCount++;
+        } else {
+            countTicket(ticket, false); // Loaded already cancelled
+        }
+    }
+
+    // Remove a cancelled ticket from its bus's live ticket list
+    void unindexLiveTicket(int ticketIndex) {
+        const TicketCore& ticket = tickets.core(ticketIndex);
+        countTicket(ticket, false);
+        ticketColumns.booked[ticketIndex] = false;
+        auto it = liveTicketsByBus.find(ticket.busId);
+        if (it == liveTicketsByBus.end()) {
+            return;
+        }
+        vector<int>& live = it->second;
+        auto pos = lower_bound(live.begin(), live.end(), ticketIndex);
+        if (pos != live.end() && *pos == ticketIndex) {
+            live.erase(pos);
+            liveTicketCount--;
+        }
+    }
+
+    // Lock serializing bookings on one bus
+    mutex& busLock(int busId) {
+        return busLocks[busId % BUS_LOCK_STRIPES];
+    }
+
+    // Store a new bus, interning its bus number and cities. Replaying the
+    // journal interns them in the same order, so the IDs come out the same.
+    void applyAddBus(const Bus& bus) {
+        nextBusId = max(nextBusId, alignId(bus.busId + 1));
+        int busIndex;
+        if (freeBusSlots.empty()) {
+            busIndex = buses.push_back(bus);
+        } else {
+            busIndex = freeBusSlots.back();
+            freeBusSlots.pop_back();
+            buses[busIndex] = bus;
+        }
+        Bus& stored = buses[busIndex];
+        stored.busNumberId = strings.intern(bus.busNumber);
+        stored.sourceId = strings.intern(bus.source);
+        stored.destinationId = strings.intern(bus.destination);
+        indexBus(busIndex);
+        trackBus(stored);
+    }
+
+    // Store a booked ticket whose seat has already been claimed, reusing
+    // a compacted ticket's slot if there is one and no checkpoint is
+    // writing out the ticket details
+    void storeTicket(const Ticket& ticket) {
+        if (freeTicketSlots.empty() || !reuseTicketSlots) {
+            indexTicket(tickets.push_back(ticket));
+            return;
+        }
+        int ticketIndex = freeTicketSlots.back();
+        freeTicketSlots.pop_back();
+        tickets.put(ticketIndex, ticket);
+        indexTicket(ticketIndex);
+    }
+
+    // Store a replayed ticket and mark its seat booked
+    void applyBookTicket(const Ticket& ticket) {
+        nextTicketId = max(nextTicketId, alignId(ticket.ticketId + 1));
+        int busIndex = findBusById(ticket.busId);
+        if (busIndex != -1) {
+            buses[busIndex].seats.claim(ticket.seatNumber - 1);
+        }
+        storeTicket(ticket);
+    }
+
+    // Cancel a ticket and free its seat
+    void applyCancelTicket(int ticketId) {
+        int ticketIndex = findTicketById(ticketId);
+        if (ticketIndex == -1) {
+            return;
+        }
+        TicketCore& ticket = tickets.core(ticketIndex);
+        int busIndex = findBusById(ticket.busId);
+        if (busIndex != -1) {
+            buses[busIndex].seats.release(ticket.seatNumber - 1);
+        }
+        ticket.isBooked = false;
+        unindexLiveTicket(ticketIndex);
+    }
+
+    // Add a passenger to a bus's waitlist
+    void applyJoinWaitlist(const WaitlistEntry& entry) {
+        lock_guard<mutex> waiting(waitlistLock);
+        WaitlistKey key = {entry.busId, entry.priority, entry.waitId};
+        waitlists.emplace(key, entry);
+        waitlistKeys.emplace(entry.waitId, key);
+    }
+
+    // Remove a passenger from their waitlist
+    void applyLeaveWaitlist(int waitId) {
+        lock_guard<mutex> waiting(waitlistLock);
+        auto it = waitlistKeys.find(waitId);
+        if (it != waitlistKeys.end()) {
+            waitlists.erase(it->second);
+            waitlistKeys.erase(it);
+        }
+    }
+
+    // Replay a promotion: cancel the old ticket, if any, and book the
+    // waiting passenger into the seat
+    void applyPromotion(const WaitlistPromotion& promotion, const CheckpointIds& checkpointIds) {
+        if (promotion.cancelledTicketId != 0) {
+            applyCancelTicket(promotion.cancelledTicketId);
+        }
+        applyLeaveWaitlist(promotion.waitId);
+        if (promotion.ticket.ticketId >= checkpointIds.nextTicketId) {
+            applyBookTicket(promotion.ticket);
+        }
+    }
+
+    // Mark a bus deleted. The caller holds indexLock exclusively, if
+    // anyone else could be reading.
+    void applyDeleteBus(int busId) {
+        int busIndex = findBusById(busId);
+        if (busIndex == -1) {
+            return;
+        }
+        unindexBus(busIndex);
+        buses[busIndex].isActive = false;
+        {
+            lock_guard<mutex> waiting(waitlistLock);
+            auto first = waitlists.lower_bound(WaitlistKey{busId, INT_MAX, INT_MIN});
+            auto last = waitlists.lower_bound(WaitlistKey{busId + 1, INT_MAX, INT_MIN});
+            for (auto it = first; it != last; ++it) {
+                waitlistKeys.erase(it->first.waitId);
+            }
+            waitlists.erase(first, last);
+        }
+        auto live = liveTicketsByBus.find(busId);
+        if (live != liveTicketsByBus.end() && live->second.empty()) {
+            liveTicketsByBus.erase(live);
+        }
+    }
+
+    // Store a generated bill
+    void applyAddBill(const BusBill& bill) {
+        nextBillId = max(nextBillId, alignId(bill.billId + 1));
+        indexBill(busBills.push_back(bill));
+    }
+
+    // Index a newly stored bill
+    void indexBill(int billIndex) {
+        const BusBill& bill = busBills[billIndex];
+        billIndexById[bill.billId] = billIndex;
+        if (bill.isActive) {
+            billIndexByBus[bill.busId] = billIndex;
+        }
+    }
+
+    // Find bill by ID
+    int findBillById(int billId) {
+        auto it = billIndexById.find(billId);
+        return it == billIndexById.end() ? -1 : it->second;
+    }
+
+    // Apply one replayed journal record unless the checkpoint already has it
+    void applyJournalRecord(JournalRecordType type, const char* data, uint32_t length,
+                            const CheckpointIds& checkpointIds) {
+        switch (type) {
+            case JOURNAL_ADD_BUS:
+                if (length == sizeof(Bus)) {
+                    Bus bus;
+                    memcpy(&bus, data, sizeof(Bus));
+                    if (bus.busId >= checkpointIds.nextBusId) {
+                        applyAddBus(bus);
+                    }
+                }
+                break;
+            case JOURNAL_BOOK_TICKET:
+                if (length == sizeof(Ticket)) {
+                    Ticket ticket;
+                    memcpy(&ticket, data, sizeof(Ticket));
+                    if (ticket.ticketId >= checkpointIds.nextTicketId) {
+                        applyBookTicket(ticket);
+                    }
+                }
+                break;
+            case JOURNAL_CANCEL_TICKET:
+                if (length == sizeof(int)) {
+                    int ticketId;
+                    memcpy(&ticketId, data, sizeof(int));
+                    applyCancelTicket(ticketId);
+                }
+                break;
+            case JOURNAL_DELETE_BUS:
+                if (length == sizeof(int)) {
+                    int busId;
+                    memcpy(&busId, data, sizeof(int));
+                    applyDeleteBus(busId);
+                }
+                break;
+            case JOURNAL_BOOK_GROUP:
+                if (length % sizeof(Ticket) == 0) {
+                    for (uint32_t offset = 0; offset < length; offset += sizeof(Ticket)) {
+                        Ticket ticket;
+                        memcpy(&ticket, data + offset, sizeof(Ticket));
+                        if (ticket.ticketId >= checkpointIds.nextTicketId) {
+                            applyBookTicket(ticket);
+                        }
+                    }
+                }
+                break;
+            case JOURNAL_JOIN_WAITLIST:
+                if (length == sizeof(WaitlistEntry)) {
+                    WaitlistEntry entry;
+                    memcpy(&entry, data, sizeof(WaitlistEntry));
+                    if (entry.waitId >= checkpointIds.nextWaitId) {
+                        nextWaitId = max(nextWaitId, alignId(entry.waitId + 1));
+                        applyJoinWaitlist(entry);
+                    }
+                }
+                break;
+            case JOURNAL_LEAVE_WAITLIST:
+                if (length == sizeof(int)) {
+                    int waitId;
+                    memcpy(&waitId, data, sizeof(int));
+                    applyLeaveWaitlist(waitId);
+                }
+                break;
+            case JOURNAL_PROMOTE_WAITLIST:
+                if (length == sizeof(WaitlistPromotion)) {
+                    WaitlistPromotion promotion;
+                    memcpy(&promotion, data, sizeof(WaitlistPromotion));
+                    applyPromotion(promotion, checkpointIds);
+                }
+                break;
+            case JOURNAL_ADD_BILL:
+                if (length == sizeof(BusBill)) {
+                    BusBill bill;
+                    memcpy(&bill, data, sizeof(BusBill));
+                    if (bill.billId >= checkpointIds.nextBillId) {
+                        applyAddBill(bill);
+                    }
+                }
+                break;
+            case JOURNAL_CHECKPOINT:
+                break; // Markers are read by readMarker(), never applied
+        }
+    }
+
+    // Wake the checkpointer once enough journal records have built up
+    void maybeCheckpoint() {
+        if (journal.size() >= CHECKPOINT_INTERVAL && !checkpointRequested.exchange(true)) {
+            lock_guard<mutex> guard(checkpointerLock);
+            checkpointerWake.notify_one();
+        }
+    }
+
+    // Write the checkpoints maybeCheckpoint() asks for until the service
+    // is destroyed
+    void runCheckpointer() {
+        unique_lock<mutex> guard(checkpointerLock);
+        while (true) {
+            checkpointerWake.wait(guard, [this] { return checkpointRequested || stoppingCheckpointer; });
+            if (stoppingCheckpointer) {
+                return;
+            }
+            guard.unlock();
+            {
+                lock_guard<mutex> checkpointing(checkpointLock);
+                if (journal.size() >= CHECKPOINT_INTERVAL) {
+                    writeCheckpoint();
+                }
+            }
+            guard.lock();
+            checkpointRequested = false;
+        }
+    }
+
+    // Copy the first count records of a store
+    template <typename T>
+    static void copyRecords(const RecordStore<T>& store, int count, vector<T>& copy) {
+        copy.clear();
+        copy.reserve(count);
+        for (int i = 0, length; i < count; i += length) {
+            const T* run = store.run(i, length);
+            length = min(length, count - i);
+            copy.insert(copy.end(), run, run + length);
+        }
+    }
+
+    // Create and store a bill for a bus. The caller holds stateLock and,
+    // for a shared stateLock, the bus's lock. Returns the new bill ID.
+    int createBusBill(int busIndex) {
+        Bus& bus = buses[busIndex];
+        
+        // Revenue comes from the running totals; the live ticket list
+        // only supplies the passenger IDs, which go straight into the bill
+        BusBill newBill;
+        double totalRevenue = 0;
+        int passengerCount = 0;
+        {
+            shared_lock<shared_mutex> index(indexLock);
+            auto stats = busStats.find(bus.busId);
+            if (stats != busStats.end()) {
+                totalRevenue = stats->second.totals.revenue;
+            }
+            auto live = liveTicketsByBus.find(bus.busId);
+            if (live != liveTicketsByBus.end()) {
+                for (int ticketIndex : live->second) {
+                    if (passengerCount == MAX_SEATS) {
+                        break;
+                    }
+                    newBill.passengerIds[passengerCount] = tickets.core(ticketIndex).ticketId;
+                    passengerCount++;
+                }
+            }
+        }
+        
+        // Create bill
+        newBill.billId = atomicFetchAdd(&nextBillId, shard.count);
+        newBill.busId = bus.busId;
+        newBill.busNumberId = bus.busNumberId;
+        newBill.sourceId = bus.sourceId;
+        newBill.destinationId = bus.destinationId;
+        newBill.travelDate = packDate(bus.travelDate);
+        copyString(newBill.departureTime, bus.departureTime);
+        copyString(newBill.arrivalTime, bus.arrivalTime);
+        newBill.totalSeats = bus.totalSeats;
+        newBill.totalRevenue = totalRevenue;
+        newBill.generatedTime = time(nullptr);
+        newBill.isActive = true;
+        newBill.passengerCount = passengerCount;
+        
+        // Add bill to store. A bill that misses the journal is derived data
+        // and is still written by the next checkpoint.
+        journal.append(JOURNAL_ADD_BILL, &newBill, sizeof(BusBill));
+        unique_lock<shared_mutex> index(indexLock);
+        indexBill(busBills.push_back(newBill));
+        return newBill.billId;
+    }
+
+    // Rebuild all lookup indexes from the stores
+    void rebuildIndexes() {
+        busIndexById.clear();
+        ticketIndexById.clear();
+        ticketColumns.clear();
+        liveTicketsByBus.clear();
+        liveTicketCount = 0;
+        billIndexById.clear();
+        billIndexByBus.clear();
+        busIndexByNumber.clear();
+        routeIndex.clear();
+        departureIndex.clear();
+        journeyTimetables.clear();
+        busStats.clear();
+        routeRollups.clear();
+        dayRollups.clear();
+        memset(&systemTotals, 0, sizeof(systemTotals));
+        busIndexById.reserve(buses.size());
+        ticketIndexById.reserve(tickets.size());
+        busStats.reserve(buses.size());
+        
+        for (int i = 0; i < buses.size(); i++) {
+            indexBus(i);
+            trackBus(buses[i]);
+        }
+        for (const auto& entry : busHistory) {
+            countHistory(entry.second);
+        }
+        for (int i = 0; i < tickets.size(); i++) {
+            indexTicket(i);
+        }
+        for (int i = 0; i < busBills.size(); i++) {
+            indexBill(i);
+        }
+    }
+
+    // Drop cancelled tickets, and deleted buses with no tickets left, from
+    // the stores. Their slots go on the free lists for reuse, so the IDs of
+    // other records do not change, and what they added to the revenue
+    // totals goes into busHistory. The stores are compacted
+    // COMPACT_CHUNK_SIZE slots per lock hold, so bookings carry on while a
+    // large store is compacted: tickets with stateLock shared and indexLock
+    // exclusive, buses with stateLock exclusive. Only the checkpoint writer
+    // (holding checkpointLock) or the follower thread compacts, and the
+    // caller holds neither lock.
+    void compactStores() {
+        for (int start = 0;; start += COMPACT_CHUNK_SIZE) {
+            shared_lock<shared_mutex> state(stateLock);
+            unique_lock<shared_mutex> index(indexLock);
+            int end = min(tickets.size(), start + COMPACT_CHUNK_SIZE);
+            if (start >= end) {
+                break;
+            }
+            compactTickets(start, end);
+        }
+        for (int start = 0;; start += COMPACT_CHUNK_SIZE) {
+            unique_lock<shared_mutex> state(stateLock);
+            shared_lock<shared_mutex> index(indexLock);
+            int end = min(buses.size(), start + COMPACT_CHUNK_SIZE);
+            if (start >= end) {
+                break;
+            }
+            compactBuses(start, end);
+        }
+    }
+
+    // Free the slots of cancelled tickets in [start, end)
+    void compactTickets(int start, int end) {
+        for (int i = start; i < end; i++) {
+            TicketCore& ticket = tickets.core(i);
+            if (ticket.ticketId == 0 || ticket.isBooked) {
+                continue;
+            }
+            historyOf(ticket.busId).cancelledTickets++;
+            ticketIndexById.erase(ticket.ticketId);
+            ticket.ticketId = 0;
+            ticket.busId = 0;
+            ticketColumns.busIds[i] = 0;
+            freeTicketSlots.push_back(i);
+        }
+    }
+
+    // Free the slots of deleted buses in [start, end). A full bus can be
+    // deleted with its bookings still active. Such a bus stays in the
+    // store, so its tickets keep resolving.
+    void compactBuses(int start, int end) {
+        for (int i = start; i < end; i++) {
+            Bus& bus = buses[i];
+            if (bus.busId == 0 || bus.isActive || hasActiveBookings(bus.busId)) {
+                continue;
+            }
+            BusHistory& history = historyOf(bus.busId);
+            history.removed = 1;
+            history.sourceId = bus.sourceId;
+            history.destinationId = bus.destinationId;
+            history.travelDate = packDate(bus.travelDate);
+            history.totalSeats = bus.totalSeats;
+            bus.busId = 0;
+            freeBusSlots.push_back(i);
+        }
+    }
+
+    // Follow the planner's via[] links back from a city reached in a round,
+    // copying each bus taken under its bus lock. The caller holds stateLock.
+    Journey traceJourney(const JourneyTimetable& timetable, const ArenaVector<int>& via,
+                         int cityCount, int round, int city) {
+        Journey journey;
+        journey.legCount = 0;
+        journey.fare = 0;
+        for (; round > 0; round--) {
+            int c = via[round * cityCount + city];
+            if (c == -1) {
+                continue; // Reached as early with fewer buses
+            }
+            const JourneyConnection& connection = timetable.connections[c];
+            JourneyLeg& leg = journey.legs[journey.legCount++];
+            {
+                lock_guard<mutex> guard(busLock(buses[connection.busIndex].busId));
+                leg.bus = buses[connection.busIndex];
+            }
+            leg.departAt = connection.departAt;
+            leg.arriveAt = connection.arriveAt;
+            journey.fare += leg.bus.ticketPrice;
+            city = connection.fromCity;
+        }
+        reverse(journey.legs, journey.legs + journey.legCount);
+        return journey;
+    }
+
+    // A new booked ticket for a seat on a bus
+    Ticket makeTicket(const Bus& bus, int seatNumber, const Passenger& passenger) {
+        return makeTicket(bus, seatNumber, passenger, atomicFetchAdd(&nextTicketId, shard.count), time(nullptr));
+    }
+
+    // A booked ticket with an ID and booking time the caller already chose
+    Ticket makeTicket(const Bus& bus, int seatNumber, const Passenger& passenger,
+                      int ticketId, int64_t bookingTime) {
+        Ticket ticket;
+        ticket.ticketId = ticketId;
+        ticket.busId = bus.busId;
+        ticket.passenger = passenger;
+        ticket.seatNumber = seatNumber;
+        ticket.bookingTime = bookingTime;
+        ticket.fare = bus.ticketPrice;
+        ticket.isBooked = true;
+        ticket.travelDate = packDate(bus.travelDate);
+        ticket.sourceId = bus.sourceId;
+        ticket.destinationId = bus.destinationId;
+        return ticket;
+    }
+
+    // First passenger on a bus's waitlist. Returns false if nobody waits.
+    bool nextWaiter(int busId, WaitlistEntry& entry) {
+        lock_guard<mutex> waiting(waitlistLock);
+        auto it = waitlists.lower_bound(WaitlistKey{busId, INT_MAX, INT_MIN});
+        if (it == waitlists.end() || it->first.busId != busId) {
+            return false;
+        }
+        entry = it->second;
+        return true;
+    }
+
+    // Give a seat that is still claimed, but about to be freed, to the
+    // head of the bus's waitlist: the freed seat and the new booking are
+    // journaled as one record. Returns the new ticket ID, or 0 if nobody
+    // waits or the promotion could not be journaled, in which case the
+    // caller frees the seat. The caller holds stateLock shared and the
+    // bus's lock.
+    int promoteWaiter(int busIndex, int seatNumber, int cancelledTicketId) {
+        const Bus& bus = buses[busIndex];
+        WaitlistEntry entry;
+        if (!nextWaiter(bus.busId, entry)) {
+            return 0;
+        }
+        WaitlistPromotion promotion;
+        memset(&promotion, 0, sizeof(promotion));
+        promotion.cancelledTicketId = cancelledTicketId;
+        promotion.waitId = entry.waitId;
+        promotion.ticket = makeTicket(bus, seatNumber, entry.passenger);
+        if (!journal.append(JOURNAL_PROMOTE_WAITLIST, &promotion, sizeof(promotion))) {
+            return 0;
+        }
+        applyLeaveWaitlist(entry.waitId);
+        unique_lock<shared_mutex> index(indexLock);
+        if (cancelledTicketId != 0) {
+            int ticketIndex = findTicketById(cancelledTicketId);
+            tickets.core(ticketIndex).isBooked = false;
+            unindexLiveTicket(ticketIndex);
+        }
+        storeTicket(promotion.ticket);
+        return promotion.ticket.ticketId;
+    }
+
+    // Free the seat of a hold that ended unconfirmed, or pass it to the
+    // bus's waitlist, billing the bus if that fills it. The caller holds
+    // stateLock shared and the bus's lock.
+    void endHold(int busIndex, int seatNumber) {
+        if (promoteWaiter(busIndex, seatNumber, 0) == 0) {
+            buses[busIndex].seats.release(seatNumber - 1);
+        } else if (isBusFullyBooked(busIndex)) {
+            createBusBill(busIndex);
+        }
+    }
+
+    // Check if bus is fully booked. Held seats are not booked yet.
+    bool isBusFullyBooked(int busIndex) {
+        return buses[busIndex].seats.available() == 0 && heldSeats(buses[busIndex].busId) == 0;
+    }
+
+    // Seats held on a bus
+    int heldSeats(int busId) {
+        lock_guard<mutex> hold(holdLock);
+        auto it = heldSeatsByBus.find(busId);
+        return it == heldSeatsByBus.end() ? 0 : it->second;
+    }
+
+    // Current hold expiry tick
+    uint64_t holdTick() {
+        auto elapsed = chrono::steady_clock::now() - holdClockOrigin;
+        return (uint64_t)chrono::duration_cast<chrono::milliseconds>(elapsed).count() / HOLD_TICK_MS;
+    }
+
+    // Bus a hold is on, or -1 if the hold is gone or has expired
+    int holdBus(int holdId) {
+        lock_guard<mutex> hold(holdLock);
+        auto it = holds.find(holdId);
+        return it == holds.end() || it->second.timer == -1 ? -1 : it->second.busId;
+    }
+
+    // Remove a hold that has not expired. The caller holds stateLock and the
+    // bus's lock, and keeps the seat claimed or releases it.
+    bool takeHold(int holdId, SeatHold& taken) {
+        lock_guard<mutex> hold(holdLock);
+        auto it = holds.find(holdId);
+        if (it == holds.end() || it->second.timer == -1) {
+            return false;
+        }
+        taken = it->second;
+        holdTimers.cancel(taken.timer);
+        forgetHold(it);
+        return true;
+    }
+
+    // Drop a hold from the table. The caller holds holdLock.
+    void forgetHold(PooledMap<int, SeatHold>::iterator it) {
+        auto count = heldSeatsByBus.find(it->second.busId);
+        if (--count->second == 0) {
+            heldSeatsByBus.erase(count);
+        }
+        holds.erase(it);
+    }
+
+    // Free the seats of expired holds. Expired timers only mark their
+    // holds; each hold is then removed under its bus's lock together with
+    // its seat, so a booking never sees a bus with neither.
+    void expireHolds() {
+        shared_lock<shared_mutex> state(stateLock);
+        vector<pair<int, int>> expired; // (hold ID, bus ID)
+        {
+            lock_guard<mutex> hold(holdLock);
+            holdTimers.advance(holdTick(), [&](int holdId) {
+                SeatHold& held = holds.find(holdId)->second;
+                held.timer = -1;
+                expired.push_back(make_pair(holdId, held.busId));
+            });
+        }
+        for (const auto& entry : expired) {
+            lock_guard<mutex> guard(busLock(entry.second));
+            int seatNumber;
+            {
+                lock_guard<mutex> hold(holdLock);
+                auto it = holds.find(entry.first);
+                seatNumber = it->second.seatNumber;
+                forgetHold(it);
+            }
+            int busIndex = findBusById(entry.second);
+            if (busIndex != -1) {
+                endHold(busIndex, seatNumber);
+            }
+        }
+    }
+
+    // Expire holds every tick until the service shuts down
+    void runHoldReaper() {
+        while (true) {
+            {
+                unique_lock<mutex> hold(holdLock);
+                holdReaperWake.wait_for(hold, chrono::milliseconds(HOLD_TICK_MS),
+                                        [this] { return stoppingHoldReaper; });
+                if (stoppingHoldReaper) {
+                    return;
+                }
+            }
+            expireHolds();
+        }
+    }
+
+    // Claim or release every held seat in the seat maps. The caller holds
+    // stateLock exclusively.
+    void setHeldSeats(bool claimed) {
+        lock_guard<mutex> hold(holdLock);
+        for (const auto& entry : holds) {
+            int busIndex = findBusById(entry.second.busId);
+            if (busIndex == -1) {
+                continue;
+            }
+            if (claimed) {
+                buses[busIndex].seats.claim(entry.second.seatNumber - 1);
+            } else {
+                buses[busIndex].seats.release(entry.second.seatNumber - 1);
+            }
+        }
+    }
+
+    // The first ID from id on that this service's shard may allocate
+    int alignId(int id) const {
+        return id + ((shard.index - id % shard.count) % shard.count + shard.count) % shard.count;
+    }
+
+    static int64_t steadyMillis() {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Poll the owner's journal every FOLLOW_POLL_MS until the service is
+    // destroyed
+    void runFollower() {
+        while (true) {
+            pollFollowedJournal();
+            unique_lock<mutex> guard(followerLock);
+            followerWake.wait_for(guard, chrono::milliseconds(FOLLOW_POLL_MS), [this] { return stoppingFollower; });
+            if (stoppingFollower) {
+                return;
+            }
+        }
+    }
+
+    // Apply the records the owner has appended to the followed journal
+    // since the last poll, a batch at a time so readers are not held up
+    void applyFollowedRecords() {
+        if (!followedJournal) {
+            return;
+        }
+        int read;
+        do {
+            unique_lock<shared_mutex> state(stateLock);
+            unique_lock<shared_mutex> index(indexLock);
+            read = Journal::readRecords(followedJournal, followedOffset, FOLLOW_BATCH_RECORDS,
+                                        [&](JournalRecordType type, const char* data, uint32_t length) {
+                                            applyJournalRecord(type, data, length, followedIds);
+                                        });
+        } while (read == FOLLOW_BATCH_RECORDS);
+    }
+
+    // One poll: apply what the owner has appended, and move on to its new
+    // journal once it has checkpointed
+    void pollFollowedJournal() {
+        if (!followerLoaded) {
+            {
+                unique_lock<shared_mutex> state(stateLock);
+                unique_lock<shared_mutex> index(indexLock);
+                followerLoaded = followCheckpoint();
+            }
+            if (!followerLoaded) {
+                return; // A checkpoint is being written; try again next poll
+            }
+        }
+        applyFollowedRecords();
+        long journalSize;
+        if (isFileAtPath(followedJournal, JOURNAL_FILE, journalSize) || journalSize < 0) {
+            followerLagBytes = max(0L, journalSize - followedOffset);
+            if (followerLagBytes == 0) {
+                followerCaughtUpAt = steadyMillis();
+            }
+            return;
+        }
+        
+        // A new journal. Every record of the old one was written before the
+        // new one replaced it, so finish the old one first.
+        applyFollowedRecords();
+        FILE* next = fopen(JOURNAL_FILE, "rb");
+        if (!next) {
+            return;
+        }
+        JournalMarker marker;
+        long offset;
+        bool continues = Journal::readMarker(next, marker, offset) ? marker.previousStamp == followedStamp
+                                                                   : !followedJournal && followedStamp == 0;
+        if (!continues) {
+            // A whole journal went by between polls
+            fclose(next);
+            unique_lock<shared_mutex> state(stateLock);
+            unique_lock<shared_mutex> index(indexLock);
+            followerLoaded = followCheckpoint();
+            return;
+        }
+        if (followedJournal) {
+            fclose(followedJournal);
+        }
+        followedJournal = next;
+        followedStamp = offset > 0 ? marker.checkpointStamp : 0;
+        followedOffset = offset;
+        compactStores(); // The owner compacted as it checkpointed, so do the same
+        applyFollowedRecords();
+    }
+
+    // Replace what is loaded with the owner's latest checkpoint and open
+    // the journal that follows it. Files from different checkpoints, or a
+    // journal newer than the files, mean a checkpoint is being written; the
+    // old state is then kept if that shows before anything is replaced.
+    // The caller holds stateLock and indexLock exclusively, or is the
+    // constructor. Returns false if no consistent checkpoint was loaded.
+    bool followCheckpoint() {
+        uint64_t stamp = readCheckpointStamp(CHECKPOINT_FILES[0]);
+        for (const char* path : CHECKPOINT_FILES) {
+            if (readCheckpointStamp(path) != stamp) {
+                return false;
+            }
+        }
+        for (int attempt = 0; attempt < FOLLOW_LOAD_ATTEMPTS; attempt++) {
+            clearFollowedState();
+            bool consistent = loadCheckpoint();
+            rebuildIndexes();
+            checkpointStamp = loadedStamps[0];
+            if (consistent && openFollowedJournal()) {
+                followedIds = CheckpointIds{nextBusId, nextTicketId, nextBillId, nextWaitId};
+                return true;
+            }
+        }
+        followerLoadProblems++; // Checkpoint files changed while loading; retried next poll
+        return false;
+    }
+
+    // Open the journal that follows the loaded checkpoint. Returns false
+    // if the journal follows a newer one.
+    bool openFollowedJournal() {
+        FILE* in = fopen(JOURNAL_FILE, "rb");
+        JournalMarker marker;
+        long offset = 0;
+        uint64_t stamp = in && Journal::readMarker(in, marker, offset) ? marker.checkpointStamp : 0;
+        if (stamp > checkpointStamp) {
+            if (in) {
+                fclose(in);
+            }
+            return false;
+        }
+        // An older journal holds records the checkpoint already has, which
+        // are skipped or change nothing, as on a restart
+        if (followedJournal) {
+            fclose(followedJournal);
+        }
+        followedJournal = in;
+        followedStamp = stamp;
+        followedOffset = offset;
+        return true;
+    }
+
+    // Empty the stores a checkpoint reload replaces. Strings and bills are
+    // kept, as the checkpoint only adds to them. The caller holds stateLock
+    // and indexLock exclusively.
+    void clearFollowedState() {
+        buses.clear();
+        busFileMap.close();
+        tickets.coreStore().clear();
+        tickets.detailStore().clear();
+        ticketFileMap.close();
+        passengerFileMap.close();
+        busHistory.clear();
+        freeTicketSlots.clear();
+        freeBusSlots.clear();
+        lock_guard<mutex> waiting(waitlistLock);
+        waitlists.clear();
+        waitlistKeys.clear();
+    }
+
+    // Copy buses by store index, each under its bus lock. The caller holds
+    // stateLock.
+    template <typename Indexes, typename Buses>
+    void copyBuses(const Indexes& busIndexes, Buses& result) {
+        result.reserve(result.size() + busIndexes.size());
+        for (int busIndex : busIndexes) {
+            lock_guard<mutex> guard(busLock(buses[busIndex].busId));
+            result.push_back(buses[busIndex]);
+        }
+    }
+
+    // Put store indexes of buses in bus ID order. Buses added into slots
+    // freed by compaction are stored out of order. The caller holds
+    // stateLock.
+    void sortByBusId(vector<int>& busIndexes) {
+        sort(busIndexes.begin(), busIndexes.end(), [this](int a, int b) {
+            return buses[a].busId < buses[b].busId;
+        });
+    }
+
+    // Check the fields of a bus about to be added
+    OperationStatus validateBus(const Bus& bus) {
+        if (bus.busNumber[0] == '\0' || bus.source[0] == '\0' || bus.destination[0] == '\0' ||
+            bus.totalSeats < 1 || bus.totalSeats > MAX_SEATS || bus.ticketPrice < 0) {
+            return STATUS_INVALID_BUS;
+        }
+        if (!isValidFutureDate(bus.travelDate)) {
+            return STATUS_INVALID_DATE;
+        }
+        if (!isValidTime(bus.departureTime) || !isValidTime(bus.arrivalTime)) {
+            return STATUS_INVALID_TIME;
+        }
+        return STATUS_OK;
+    }
+
+public:
+    ReservationService(FsyncPolicy fsyncPolicy = FSYNC_EVERY_COMMIT, OpenMode mode = OPEN_READ_WRITE,
+                       ShardSpec shardSpec = ShardSpec{0, 1}) {
+        shard = shardSpec;
+        nextTicketId = 1001;
+        liveTicketCount = 0;
+        nextBusId = 101;
+        nextBillId = 501;
+        nextHoldId = alignId(1);
+        nextWaitId = 1;
+        holdClockOrigin = chrono::steady_clock::now();
+        stoppingHoldReaper = false;
+        memset(&systemTotals, 0, sizeof(systemTotals));
+        readOnly = mode != OPEN_READ_WRITE;
+        checkpointStamp = 0;
+        following = mode == OPEN_FOLLOWER;
+        followerLoaded = false;
+        followedJournal = nullptr;
+        followedStamp = 0;
+        followedOffset = 0;
+        memset(&followedIds, 0, sizeof(followedIds));
+        stoppingFollower = false;
+        followerLagBytes = 0;
+        followerCaughtUpAt = steadyMillis();
+        followerLoadProblems = 0;
+        startedUp = false;
+        reuseTicketSlots = true;
+        checkpointRequested = false;
+        stoppingCheckpointer = false;
+        
+        // A read-only service leaves the journal closed, so every change
+        // fails with STATUS_JOURNAL_FAILED
+        if (!readOnly) {
+            journal.open(fsyncPolicy);
+        }
+        loadData(); // Load last checkpoint and replay the journal
+        nextTicketId = alignId(nextTicketId);
+        nextBusId = alignId(nextBusId);
+        nextBillId = alignId(nextBillId);
+        nextWaitId = alignId(nextWaitId);
+        startedUp = true;
+        if (following) {
+            follower = thread(&ReservationService::runFollower, this);
+        }
+        if (!readOnly) {
+            checkpointer = thread(&ReservationService::runCheckpointer, this);
+        }
+    }
+
+    ~ReservationService() {
+        if (follower.joinable()) {
+            {
+                lock_guard<mutex> guard(followerLock);
+                stoppingFollower = true;
+            }
+            followerWake.notify_one();
+            follower.join();
+        }
+        if (followedJournal) {
+            fclose(followedJournal);
+        }
+        if (holdReaper.joinable()) {
+            {
+                lock_guard<mutex> hold(holdLock);
+                stoppingHoldReaper = true;
+            }
+            holdReaperWake.notify_one();
+            holdReaper.join();
+        }
+        if (checkpointer.joinable()) {
+            {
+                lock_guard<mutex> guard(checkpointerLock);
+                stoppingCheckpointer = true;
+            }
+            checkpointerWake.notify_one();
+            checkpointer.join();
+        }
+        checkpoint(); // Save data when program closes
+    }
+
+    // ---- Thread-safe reservation API ----
+
+    // Add a bus. Assigns bus.busId on success.
+    OperationResult addBusRecord(Bus& bus) {
+        OperationResult result = {STATUS_OK, 0, 0, 0, 0, 0, 0};
+        OperationTimer timer(METRIC_ADD_BUS, &result.status);
+        result.status = validateBus(bus);
+        if (result.status != STATUS_OK) {
+            return result;
+        }
+        {
+            unique_lock<shared_mutex> state(stateLock);
+            if (findBusByNumber(bus.busNumber) != -1) {
+                result.status = STATUS_DUPLICATE_BUS_NUMBER;
+                return result;
+            }
+            bus.busId = nextBusId;
+            bus.isActive = true;
+            bus.seats.reset(bus.totalSeats);
+            if (!journal.append(JOURNAL_ADD_BUS, &bus, sizeof(Bus))) {
+                result.status = STATUS_JOURNAL_FAILED;
+                return result;
+            }
+            applyAddBus(bus);
+            result.busId = bus.busId;
+        }
+        maybeCheckpoint();
+        return result;
+    }
+
+    // Book a seat (1-based, or 0 for the first free seat). The seat is
+    // claimed with compare-and-set under the bus's own lock, so bookings on
+    // different buses run in parallel and a seat is never sold twice.
+    // Generates the bus bill when the booking fills the bus.
+    OperationResult reserveSeat(int busId, int seatNumber, const Passenger& passenger) {
+        OperationResult result = {STATUS_OK, busId, 0, 0, 0, 0, 0};
+        OperationTimer timer(METRIC_BOOK, &result.status);
+        {
+            shared_lock<shared_mutex> state(stateLock);
+            int busIndex = findBusById(busId);
+            if (busIndex == -1) {
+                result.status = STATUS_BUS_NOT_FOUND;
+                return result;
+            }
+            Bus& bus = buses[busIndex];
+            lock_guard<mutex> guard(busLock(busId));
+            
+            if (seatNumber == 0) {
+                int seat;
+                do {
+                    if (!bus.seats.findFreeSeats(1, false, &seat)) {
+                        result.status = STATUS_BUS_FULL;
+                        return result;
+                    }
+                } while (!bus.seats.claim(seat));
+                seatNumber = seat + 1;
+            } else if (seatNumber < 1 || seatNumber > bus.totalSeats) {
+                result.status = STATUS_INVALID_SEAT;
+                return result;
+            } else if (!bus.seats.claim(seatNumber - 1)) {
+                result.status = bus.seats.available() == 0 ? STATUS_BUS_FULL : STATUS_SEAT_TAKEN;
+                return result;
+            }
+            
+            // Create ticket
+            Ticket newTicket = makeTicket(bus, seatNumber, passenger);
+            
+            // The booking is acknowledged only once it is journaled
+            if (!journal.append(JOURNAL_BOOK_TICKET, &newTicket, sizeof(Ticket))) {
+                bus.seats.release(seatNumber - 1);
+                result.status = STATUS_JOURNAL_FAILED;
+                return result;
+            }
+            {
+                unique_lock<shared_mutex> index(indexLock);
+                storeTicket(newTicket);
+            }
+            
+            result.ticketId = newTicket.ticketId;
+            result.seatNumber = seatNumber;
+            result.fare = newTicket.fare;
+            if (isBusFullyBooked(busIndex)) {
+                result.billId = createBusBill(busIndex);
+            }
+        }
+        maybeCheckpoint();
+        return result;
+    }
+
+    // Hold a seat (1-based, or 0 for the first free seat) for a number of
+    // seconds, e.g. while the customer pays. Nobody else can book the seat
+    // until the hold is confirmed, released or expires; an expired hold's
+    // seat is freed by a background thread within one HOLD_TICK_MS.
+    HoldResult holdSeat(int busId, int seatNumber, int seconds) {
+        HoldResult result = {STATUS_OK, 0, busId, 0, 0, seconds};
+        OperationTimer timer(METRIC_HOLD, &result.status);
+        if (seconds < 1 || seconds > HOLD_MAX_SECONDS) {
+            result.status = STATUS_BAD_REQUEST;
+            return result;
+        }
+        if (readOnly) {
+            result.status = STATUS_JOURNAL_FAILED; // Could never be confirmed
+            return result;
+        }
+        shared_lock<shared_mutex> state(stateLock);
+        int busIndex = findBusById(busId);
+        if (busIndex == -1) {
+            result.status = STATUS_BUS_NOT_FOUND;
+            return result;
+        }
+        Bus& bus = buses[busIndex];
+        lock_guard<mutex> guard(busLock(busId));
+        
+        if (seatNumber == 0) {
+            int seat;
+            do {
+                if (!bus.seats.findFreeSeats(1, false, &seat)) {
+                    result.status = STATUS_BUS_FULL;
+                    return result;
+                }
+            } while (!bus.seats.claim(seat));
+            seatNumber = seat + 1;
+        } else if (seatNumber < 1 || seatNumber > bus.totalSeats) {
+            result.status = STATUS_INVALID_SEAT;
+            return result;
+        } else if (!bus.seats.claim(seatNumber - 1)) {
+            result.status = bus.seats.available() == 0 ? STATUS_BUS_FULL : STATUS_SEAT_TAKEN;
+            return result;
+        }
+        
+        lock_guard<mutex> hold(holdLock);
+        if (!holdReaper.joinable()) {
+            holdReaper = thread(&ReservationService::runHoldReaper, this);
+        }
+        uint64_t ticks = ((uint64_t)seconds * 1000 + HOLD_TICK_MS - 1) / HOLD_TICK_MS;
+        int holdId = nextHoldId;
+        nextHoldId += shard.count;
+        holds[holdId] = SeatHold{busId, seatNumber, holdTimers.schedule(holdTick() + ticks, holdId)};
+        heldSeatsByBus[busId]++;
+        result.holdId = holdId;
+        result.seatNumber = seatNumber;
+        result.fare = bus.ticketPrice;
+        return result;
+    }
+
+    // Turn a hold into a booked ticket for the passenger. Fails with
+    // STATUS_HOLD_NOT_FOUND once the hold has expired or been released.
+    OperationResult confirmHold(int holdId, const Passenger& passenger) {
+        OperationResult result = {STATUS_OK, 0, 0, 0, 0, 0, 0};
+        OperationTimer timer(METRIC_BOOK, &result.status);
+        {
+            shared_lock<shared_mutex> state(stateLock);
+            int busId = holdBus(holdId);
+            int busIndex = busId == -1 ? -1 : findBusById(busId);
+            if (busIndex == -1) {
+                result.status = STATUS_HOLD_NOT_FOUND;
+                return result;
+            }
+            Bus& bus = buses[busIndex];
+            lock_guard<mutex> guard(busLock(busId));
+            SeatHold held;
+            if (!takeHold(holdId, held)) {
+                result.status = STATUS_HOLD_NOT_FOUND; // Expired while we waited
+                return result;
+            }
+            
+            Ticket newTicket = makeTicket(bus, held.seatNumber, passenger);
+            if (!journal.append(JOURNAL_BOOK_TICKET, &newTicket, sizeof(Ticket))) {
+                bus.seats.release(held.seatNumber - 1);
+                result.status = STATUS_JOURNAL_FAILED;
+                return result;
+            }
+            {
+                unique_lock<shared_mutex> index(indexLock);
+                storeTicket(newTicket);
+            }
+            
+            result.busId = busId;
+            result.ticketId = newTicket.ticketId;
+            result.seatNumber = held.seatNumber;
+            result.fare = newTicket.fare;
+            if (isBusFullyBooked(busIndex)) {
+                result.billId = createBusBill(busIndex);
+            }
+        }
+        maybeCheckpoint();
+        return result;
+    }
+
+    // Give up a hold and free its seat
+    OperationResult releaseHold(int holdId) {
+        OperationResult result = {STATUS_OK, 0, 0, 0, 0, 0, 0};
+        OperationTimer timer(METRIC_HOLD, &result.status);
+        shared_lock<shared_mutex> state(stateLock);
+        int busId = holdBus(holdId);
+        int busIndex = busId == -1 ? -1 : findBusById(busId);
+        if (busIndex == -1) {
+            result.status = STATUS_HOLD_NOT_FOUND;
+            return result;
+        }
+        lock_guard<mutex> guard(busLock(busId));
+        SeatHold held;
+        if (!takeHold(holdId, held)) {
+            result.status = STATUS_HOLD_NOT_FOUND;
+            return result;
+        }
+        endHold(busIndex, held.seatNumber);
+        result.busId = busId;
+        result.seatNumber = held.seatNumber;
+        return result;
+    }
+
+    // Put a passenger on a full bus's waitlist. They are booked into the
+    // next seat that is cancelled or whose hold ends, ahead of everyone
+    // with a lower priority.
+    WaitlistResult joinWaitlist(int busId, const Passenger& passenger, int priority = 0) {
+        WaitlistResult result = {STATUS_OK, 0, 0};
+        OperationTimer timer(METRIC_WAITLIST, &result.status);
+        if (priority < 0 || priority > WAITLIST_MAX_PRIORITY) {
+            result.status = STATUS_BAD_REQUEST;
+            return result;
+        }
+        {
+            shared_lock<shared_mutex> state(stateLock);
+            int busIndex = findBusById(busId);
+            if (busIndex == -1) {
+                result.status = STATUS_BUS_NOT_FOUND;
+                return result;
+            }
+            lock_guard<mutex> guard(busLock(busId));
+            if (buses[busIndex].seats.available() > 0) {
+                result.status = STATUS_SEATS_AVAILABLE;
+                return result;
+            }
+            
+            WaitlistEntry entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.waitId = atomicFetchAdd(&nextWaitId, shard.count);
+            entry.busId = busId;
+            entry.priority = priority;
+            entry.passenger = passenger;
+            entry.joinedTime = time(nullptr);
+            if (!journal.append(JOURNAL_JOIN_WAITLIST, &entry, sizeof(entry))) {
+                result.status = STATUS_JOURNAL_FAILED;
+                return result;
+            }
+            applyJoinWaitlist(entry);
+            result.waitId = entry.waitId;
+            
+            // Counting is linear in the passengers ahead, who are few
+            lock_guard<mutex> waiting(waitlistLock);
+            auto first = waitlists.lower_bound(WaitlistKey{busId, INT_MAX, INT_MIN});
+            result.ahead = (int)distance(first, waitlists.find(waitlistKeys.find(entry.waitId)->second));
+        }
+        maybeCheckpoint();
+        return result;
+    }
+
+    // Take a passenger off their waitlist
+    OperationResult leaveWaitlist(int waitId) {
+        OperationResult result = {STATUS_OK, 0, 0, 0, 0, 0, 0};
+        OperationTimer timer(METRIC_WAITLIST, &result.status);
+        {
+            shared_lock<shared_mutex> state(stateLock);
+            {
+                lock_guard<mutex> waiting(waitlistLock);
+                auto it = waitlistKeys.find(waitId);
+                if (it == waitlistKeys.end()) {
+                    result.status = STATUS_WAITLIST_NOT_FOUND;
+                    return result;
+                }
+                result.busId = it->second.busId;
+            }
+            lock_guard<mutex> guard(busLock(result.busId));
+            {
+                // A cancellation may have promoted them while we waited
+                lock_guard<mutex> waiting(waitlistLock);
+                if (waitlistKeys.find(waitId) == waitlistKeys.end()) {
+                    result.status = STATUS_WAITLIST_NOT_FOUND;
+                    return result;
+                }
+            }
+            if (!journal.append(JOURNAL_LEAVE_WAITLIST, &waitId, sizeof(waitId))) {
+                result.status = STATUS_JOURNAL_FAILED;
+                return result;
+            }
+            applyLeaveWaitlist(waitId);
+        }
+        maybeCheckpoint();
+        return result;
+    }
+
+    // A bus's waitlist in promotion order
+    vector<WaitlistEntry> getWaitlist(int busId) {
+        vector<WaitlistEntry> result;
+        lock_guard<mutex> waiting(waitlistLock);
+        auto it = waitlists.lower_bound(WaitlistKey{busId, INT_MAX, INT_MIN});
+        for (; it != waitlists.end() && it->first.busId == busId; ++it) {
+            result.push_back(it->second);
+        }
+        return result;
+    }
+
+    // Book a group of seats, on one bus or several, as one atomic
+    // operation: every seat is booked or none is. Requests for seat 0 get
+    // free seats of their bus; with adjacent set, all of a bus's seat-0
+    // requests share one block of consecutive seats. Every bus lock the
+    // group needs is taken once, in stripe order, and the tickets go to the
+    // journal as a single record, so a replay never sees half a group.
+    // Buses the group fills get their bills.
+    GroupBookingResult reserveGroup(const vector<BookingRequest>& requests, bool adjacent) {
+        GroupBookingResult result = {STATUS_OK, -1, {}};
+        OperationTimer timer(METRIC_BOOK_GROUP, &result.status);
+        if (requests.empty() || requests.size() > (size_t)GROUP_MAX_SEATS) {
+            result.status = STATUS_BAD_REQUEST;
+            return result;
+        }
+        int count = (int)requests.size();
+        {
+            shared_lock<shared_mutex> state(stateLock);
+            vector<int> busIndexes(count);
+            vector<int> stripes;
+            for (int i = 0; i < count; i++) {
+                busIndexes[i] = findBusById(requests[i].busId);
+                if (busIndexes[i] == -1) {
+                    result.status = STATUS_BUS_NOT_FOUND;
+                    result.failedRequest = i;
+                    return result;
+                }
+                stripes.push_back(requests[i].busId % BUS_LOCK_STRIPES);
+            }
+            sort(stripes.begin(), stripes.end());
+            stripes.erase(unique(stripes.begin(), stripes.end()), stripes.end());
+            vector<unique_lock<mutex>> guards;
+            for (int stripe : stripes) {
+                guards.emplace_back(busLocks[stripe]);
+            }
+            
+            // Claim the requested seats first, so seats picked for seat-0
+            // requests never take one that is asked for by number
+            vector<int> seatNumbers(count, 0);
+            auto releaseClaimed = [&]() {
+                for (int i = 0; i < count; i++) {
+                    if (seatNumbers[i] != 0) {
+                        buses[busIndexes[i]].seats.release(seatNumbers[i] - 1);
+                    }
+                }
+            };
+            for (int i = 0; i < count; i++) {
+                Bus& bus = buses[busIndexes[i]];
+                int seatNumber = requests[i].seatNumber;
+                if (seatNumber == 0) {
+                    continue;
+                }
+                if (seatNumber < 1 || seatNumber > bus.totalSeats || !bus.seats.claim(seatNumber - 1)) {
+                    result.status = seatNumber < 1 || seatNumber > bus.totalSeats ? STATUS_INVALID_SEAT : STATUS_SEAT_TAKEN;
+                    result.failedRequest = i;
+                    releaseClaimed();
+                    return result;
+                }
+                seatNumbers[i] = seatNumber;
+            }
+            
+            // Then pick seats for the seat-0 requests, one bus at a time
+            vector<int> pending; // Seat-0 requests, grouped by bus
+            for (int i = 0; i < count; i++) {
+                if (requests[i].seatNumber == 0) {
+                    pending.push_back(i);
+                }
+            }
+            stable_sort(pending.begin(), pending.end(), [&](int a, int b) {
+                return requests[a].busId < requests[b].busId;
+            });
+            for (size_t start = 0, end; start < pending.size(); start = end) {
+                end = start;
+                while (end < pending.size() && requests[pending[end]].busId == requests[pending[start]].busId) {
+                    end++;
+                }
+                Bus& bus = buses[busIndexes[pending[start]]];
+                int wanted = (int)(end - start);
+                int seats[MAX_SEATS];
+                if (!bus.seats.findFreeSeats(wanted, adjacent, seats)) {
+                    result.status = adjacent && bus.seats.available() >= wanted ? STATUS_NO_ADJACENT_SEATS : STATUS_BUS_FULL;
+                    result.failedRequest = pending[start];
+                    releaseClaimed();
+                    return result;
+                }
+                for (int k = 0; k < wanted; k++) {
+                    bus.seats.claim(seats[k]); // Cannot fail: we hold the bus lock
+                    seatNumbers[pending[start + k]] = seats[k] + 1;
+                }
+            }
+            
+            // Create the tickets, with consecutive IDs of this shard
+            vector<Ticket> newTickets(count);
+            int firstTicketId = atomicFetchAdd(&nextTicketId, count * shard.count);
+            int64_t bookingTime = time(nullptr);
+            for (int i = 0; i < count; i++) {
+                newTickets[i] = makeTicket(buses[busIndexes[i]], seatNumbers[i], requests[i].passenger,
+                                           firstTicketId + i * shard.count, bookingTime);
+            }
+            if (!journal.append(JOURNAL_BOOK_GROUP, newTickets.data(), (uint32_t)(count * sizeof(Ticket)))) {
+                releaseClaimed();
+                result.status = STATUS_JOURNAL_FAILED;
+                return result;
+            }
+            {
+                unique_lock<shared_mutex> index(indexLock);
+                for (const Ticket& ticket : newTickets) {
+                    storeTicket(ticket);
+                }
+            }
+            
+            // Fill in results; the last booking on a bus the group filled gets its bill
+            result.bookings.resize(count);
+            for (int i = 0; i < count; i++) {
+                const Ticket& ticket = newTickets[i];
+                result.bookings[i] = OperationResult{STATUS_OK, ticket.busId, ticket.ticketId,
+                                                     ticket.seatNumber, ticket.fare, 0, 0};
+            }
+            for (int i = 0; i < count; i++) {
+                bool lastOnBus = true;
+                for (int later = i + 1; later < count && lastOnBus; later++) {
+                    lastOnBus = requests[later].busId != requests[i].busId;
+                }
+                if (lastOnBus && isBusFullyBooked(busIndexes[i])) {
+                    result.bookings[i].billId = createBusBill(busIndexes[i]);
+                }
+            }
+        }
+        maybeCheckpoint();
+        return result;
+    }
+
+    // Cancel a booked ticket and free its seat, or give the seat to the
+    // first passenger on the bus's waitlist
+    OperationResult cancelReservation(int ticketId) {
+        OperationResult result = {STATUS_OK, 0, ticketId, 0, 0, 0, 0};
+        OperationTimer timer(METRIC_CANCEL, &result.status);
+        {
+            shared_lock<shared_mutex> state(stateLock);
+            int ticketIndex;
+            int busId = 0;
+            {
+                shared_lock<shared_mutex> index(indexLock);
+                ticketIndex = findTicketById(ticketId);
+                if (ticketIndex != -1) {
+                    busId = tickets.core(ticketIndex).busId;
+                }
+            }
+            if (ticketIndex == -1) {
+                result.status = STATUS_TICKET_NOT_FOUND;
+                return result;
+            }
+            int busIndex = findBusById(busId);
+            if (busIndex == -1) {
+                result.status = STATUS_BUS_NOT_FOUND;
+                return result;
+            }
+            lock_guard<mutex> guard(busLock(busId));
+            TicketCore& ticket = tickets.core(ticketIndex);
+            {
+                // Another thread may have cancelled it while we waited, and
+                // compaction may have given its slot to a new ticket since
+                shared_lock<shared_mutex> index(indexLock);
+                if (!ticket.isBooked || ticket.ticketId != ticketId) {
+                    result.status = STATUS_TICKET_NOT_FOUND;
+                    return result;
+                }
+            }
+            // The seat goes to the head of the waitlist, if anyone waits,
+            // in the same journal record as the cancellation
+            WaitlistEntry waiter;
+            if (nextWaiter(ticket.busId, waiter)) {
+                result.promotedTicketId = promoteWaiter(busIndex, ticket.seatNumber, ticketId);
+                if (result.promotedTicketId == 0) {
+                    result.status = STATUS_JOURNAL_FAILED;
+                    return result;
+                }
+            } else {
+                if (!journal.append(JOURNAL_CANCEL_TICKET, &ticketId, sizeof(ticketId))) {
+                    result.status = STATUS_JOURNAL_FAILED;
+                    return result;
+                }
+                buses[busIndex].seats.release(ticket.seatNumber - 1);
+                {
+                    unique_lock<shared_mutex> index(indexLock);
+                    ticket.isBooked = false;
+                    unindexLiveTicket(ticketIndex);
+                }
+            }
+            result.busId = ticket.busId;
+            result.seatNumber = ticket.seatNumber;
+            result.fare = ticket.fare;
+        }
+        maybeCheckpoint();
+        return result;
+    }
+
+    // Delete a bus that has no bookings or holds, or is fully booked. A fully booked
+    // bus without a bill gets one once the delete is journaled.
+    OperationResult deleteBusRecord(int busId) {
+        OperationResult result = {STATUS_OK, busId, 0, 0, 0, 0, 0};
+        OperationTimer timer(METRIC_DELETE_BUS, &result.status);
+        {
+            unique_lock<shared_mutex> state(stateLock);
+            int busIndex = findBusById(busId);
+            if (busIndex == -1) {
+                result.status = STATUS_BUS_NOT_FOUND;
+                return result;
+            }
+            bool isFullyBooked = isBusFullyBooked(busIndex);
+            if ((hasActiveBookings(busId) && !isFullyBooked) || heldSeats(busId) > 0) {
+                result.status = STATUS_BUS_HAS_BOOKINGS;
+                return result;
+            }
+            if (!journal.append(JOURNAL_DELETE_BUS, &busId, sizeof(busId))) {
+                result.status = STATUS_JOURNAL_FAILED;
+                return result;
+            }
+            if (isFullyBooked && billIndexByBus.find(busId) == billIndexByBus.end()) {
+                result.billId = createBusBill(busIndex);
+            }
+            unique_lock<shared_mutex> index(indexLock);
+            applyDeleteBus(busId);
+        }
+        maybeCheckpoint();
+        return result;
+    }
+
+    // ---- Bulk loading ----
+
+    // Add a batch of buses under one lock and one journal commit. Returns
+    // one result per bus; accepted buses get their IDs assigned. Duplicate
+    // bus numbers, also within the batch, are caught by the bus number
+    // index. Bulk loads do not checkpoint; call checkpoint() when done.
+    vector<OperationResult> addBusBatch(vector<Bus>& batch) {
+        vector<OperationResult> results(batch.size(), OperationResult{STATUS_OK, 0, 0, 0, 0, 0, 0});
+        vector<Bus> accepted;
+        accepted.reserve(batch.size());
+        
+        unique_lock<shared_mutex> state(stateLock);
+        unordered_map<string, int> batchNumbers; // Bus numbers accepted so far in this batch
+        for (size_t i = 0; i < batch.size(); i++) {
+            Bus& bus = batch[i];
+            results[i].status = validateBus(bus);
+            if (results[i].status != STATUS_OK) {
+                continue;
+            }
+            if (findBusByNumber(bus.busNumber) != -1 ||
+                !batchNumbers.emplace(bus.busNumber, (int)i).second) {
+                results[i].status = STATUS_DUPLICATE_BUS_NUMBER;
+                continue;
+            }
+            bus.busId = nextBusId + (int)accepted.size() * shard.count;
+            bus.isActive = true;
+            bus.seats.reset(bus.totalSeats);
+            results[i].busId = bus.busId;
+            accepted.push_back(bus);
+        }
+        if (accepted.empty()) {
+            return results;
+        }
+        
+        if (!journal.appendBatch(JOURNAL_ADD_BUS, accepted.data(), sizeof(Bus), (int)accepted.size())) {
+            for (OperationResult& result : results) {
+                if (result.status == STATUS_OK) {
+                    result.status = STATUS_JOURNAL_FAILED;
+                    result.busId = 0;
+                }
+            }
+            return results;
+        }
+        busIndexById.reserve(busIndexById.size() + accepted.size());
+        busIndexByNumber.reserve(busIndexByNumber.size() + accepted.size());
+        for (const Bus& bus : accepted) {
+            applyAddBus(bus);
+        }
+        return results;
+    }
+
+    // Book a batch of seats under one lock and one journal commit. Each
+    // request succeeds or fails on its own, with the same rules as
+    // reserveSeat(), including bills for buses the batch fills.
+    // Bulk loads do not checkpoint; call checkpoint() when done.
+    vector<OperationResult> importBookings(const vector<BookingRequest>& batch) {
+        vector<OperationResult> results(batch.size(), OperationResult{STATUS_OK, 0, 0, 0, 0, 0, 0});
+        vector<Ticket> newTickets;
+        vector<int> ticketRows; // Request index of each new ticket
+        newTickets.reserve(batch.size());
+        
+        unique_lock<shared_mutex> state(stateLock);
+        for (size_t i = 0; i < batch.size(); i++) {
+            const BookingRequest& request = batch[i];
+            OperationResult& result = results[i];
+            result.busId = request.busId;
+            int busIndex = findBusById(request.busId);
+            if (busIndex == -1) {
+                result.status = STATUS_BUS_NOT_FOUND;
+                continue;
+            }
+            Bus& bus = buses[busIndex];
+            int seatNumber = request.seatNumber;
+            if (seatNumber == 0) {
+                int seat;
+                if (!bus.seats.findFreeSeats(1, false, &seat)) {
+                    result.status = STATUS_BUS_FULL;
+                    continue;
+                }
+                bus.seats.claim(seat);
+                seatNumber = seat + 1;
+            } else if (seatNumber < 1 || seatNumber > bus.totalSeats) {
+                result.status = STATUS_INVALID_SEAT;
+                continue;
+            } else if (!bus.seats.claim(seatNumber - 1)) {
+                result.status = bus.seats.available() == 0 ? STATUS_BUS_FULL : STATUS_SEAT_TAKEN;
+                continue;
+            }
+            
+            newTickets.push_back(makeTicket(bus, seatNumber, request.passenger));
+            ticketRows.push_back((int)i);
+        }
+        if (newTickets.empty()) {
+            return results;
+        }
+        
+        if (!journal.appendBatch(JOURNAL_BOOK_TICKET, newTickets.data(), sizeof(Ticket), (int)newTickets.size())) {
+            for (size_t t = 0; t < newTickets.size(); t++) {
+                buses[findBusById(newTickets[t].busId)].seats.release(newTickets[t].seatNumber - 1);
+                results[ticketRows[t]].status = STATUS_JOURNAL_FAILED;
+            }
+            return results;
+        }
+        {
+            unique_lock<shared_mutex> index(indexLock);
+            ticketIndexById.reserve(ticketIndexById.size() + newTickets.size());
+            for (const Ticket& ticket : newTickets) {
+                storeTicket(ticket);
+            }
+        }
+        
+        // Fill in results; the last booking on a bus that is now full gets its bill
+        unordered_map<int, int> lastTicketOnBus; // Bus ID -> position in newTickets
+        for (size_t t = 0; t < newTickets.size(); t++) {
+            const Ticket& ticket = newTickets[t];
+            OperationResult& result = results[ticketRows[t]];
+            result.ticketId = ticket.ticketId;
+            result.seatNumber = ticket.seatNumber;
+            result.fare = ticket.fare;
+            lastTicketOnBus[ticket.busId] = (int)t;
+        }
+        for (const auto& entry : lastTicketOnBus) {
+            int busIndex = findBusById(entry.first);
+            if (isBusFullyBooked(busIndex)) {
+                results[ticketRows[entry.second]].billId = createBusBill(busIndex);
+            }
+        }
+        return results;
+    }
+
+    // ---- Thread-safe queries. Results are copies. ----
+
+    // Copy an active bus
+    bool getBus(int busId, Bus& bus) {
+        OperationTimer timer(METRIC_LOOKUP);
+        shared_lock<shared_mutex> state(stateLock);
+        int busIndex = findBusById(busId);
+        if (busIndex == -1) {
+            return false;
+        }
+        lock_guard<mutex> guard(busLock(busId));
+        bus = buses[busIndex];
+        return true;
+    }
+
+    // Copy an active bus by bus number
+    bool getBusByNumber(const char* busNumber, Bus& bus) {
+        OperationTimer timer(METRIC_LOOKUP);
+        shared_lock<shared_mutex> state(stateLock);
+        int busIndex = findBusByNumber(busNumber);
+        if (busIndex == -1) {
+            return false;
+        }
+        lock_guard<mutex> guard(busLock(buses[busIndex].busId));
+        bus = buses[busIndex];
+        return true;
+    }
+
+    // Copy a ticket, including cancelled tickets not yet compacted
+    bool getTicket(int ticketId, Ticket& ticket) {
+        OperationTimer timer(METRIC_LOOKUP);
+        shared_lock<shared_mutex> index(indexLock);
+        int ticketIndex = findTicketRecord(ticketId);
+        if (ticketIndex == -1) {
+            return false;
+        }
+        ticket = tickets.get(ticketIndex);
+        return true;
+    }
+
+    // Copy a bill
+    bool getBill(int billId, BusBill& bill) {
+        OperationTimer timer(METRIC_LOOKUP);
+        shared_lock<shared_mutex> index(indexLock);
+        int billIndex = findBillById(billId);
+        if (billIndex == -1) {
+            return false;
+        }
+        bill = busBills[billIndex];
+        return true;
+    }
+
+    // Active buses on a route travelling between two packed dates
+    // (inclusive). The result and the scratch space for the search come
+    // from the caller's arena, so a caller that resets one arena per
+    // request searches without touching the heap.
+    ArenaVector<Bus> searchRoute(Arena& arena, const char* source, const char* destination,
+                                 int fromDate = 0, int toDate = INT_MAX) {
+        OperationTimer timer(METRIC_SEARCH);
+        ArenaVector<int> found{ArenaAllocator<int>(arena)};
+        ArenaVector<Bus> result{ArenaAllocator<Bus>(arena)};
+        shared_lock<shared_mutex> state(stateLock);
+        findBusesOnRoute(found, source, destination, fromDate, toDate);
+        copyBuses(found, result);
+        return result;
+    }
+
+    vector<Bus> searchRoute(const char* source, const char* destination,
+                            int fromDate = 0, int toDate = INT_MAX) {
+        Arena arena;
+        ArenaVector<Bus> found = searchRoute(arena, source, destination, fromDate, toDate);
+        return vector<Bus>(found.begin(), found.end());
+    }
+
+    // Active buses departing from a city between two packed dates
+    // (inclusive), in the caller's arena
+    ArenaVector<Bus> searchDepartures(Arena& arena, const char* source, int fromDate, int toDate) {
+        OperationTimer timer(METRIC_SEARCH);
+        ArenaVector<int> found{ArenaAllocator<int>(arena)};
+        ArenaVector<Bus> result{ArenaAllocator<Bus>(arena)};
+        shared_lock<shared_mutex> state(stateLock);
+        findDepartures(found, source, fromDate, toDate);
+        copyBuses(found, result);
+        return result;
+    }
+
+    vector<Bus> searchDepartures(const char* source, int fromDate, int toDate) {
+        Arena arena;
+        ArenaVector<Bus> found = searchDepartures(arena, source, fromDate, toDate);
+        return vector<Bus>(found.begin(), found.end());
+    }
+
+    // Plan journeys from one city to another, changing buses where needed.
+    // Journeys leave on the travel date (a packed date) no earlier than
+    // earliestDeparture (minutes after midnight) and may run into the
+    // following JOURNEY_DAYS - 1 dates. Every bus must have a free seat for
+    // each passenger, and a connection leaves at least transferMinutes
+    // after the previous bus arrives.
+    // Round k of the search scans the timetable once in departure order and
+    // finds the earliest arrival at every city using at most k buses, so
+    // the result holds the fastest journey for each number of legs that
+    // arrives earlier than every journey with fewer legs, fewest legs
+    // first. Scratch space comes from the caller's arena.
+    ArenaVector<Journey> planJourney(Arena& arena, const char* source, const char* destination,
+                                     int date, int earliestDeparture = 0, int passengers = 1,
+                                     int transferMinutes = JOURNEY_MIN_TRANSFER) {
+        OperationTimer timer(METRIC_PLAN);
+        ArenaVector<Journey> result{ArenaAllocator<Journey>(arena)};
+        shared_lock<shared_mutex> state(stateLock);
+        const JourneyTimetable& timetable = journeyTimetable(date);
+        const vector<int>& cityIds = timetable.cityIds;
+        int origin = (int)(find(cityIds.begin(), cityIds.end(), strings.find(source)) - cityIds.begin());
+        int target = (int)(find(cityIds.begin(), cityIds.end(), strings.find(destination)) - cityIds.begin());
+        int cityCount = (int)cityIds.size();
+        if (origin == cityCount || target == cityCount || origin == target) {
+            return result;
+        }
+        
+        // arrival[k * cityCount + city] is the earliest arrival using at
+        // most k buses; via[] is the connection that achieved it in round
+        // k, or -1 when round k did not improve on round k - 1
+        ArenaVector<int> arrival((JOURNEY_MAX_LEGS + 1) * cityCount, INT_MAX, ArenaAllocator<int>(arena));
+        ArenaVector<int> via((JOURNEY_MAX_LEGS + 1) * cityCount, -1, ArenaAllocator<int>(arena));
+        arrival[origin] = earliestDeparture;
+        const vector<JourneyConnection>& connections = timetable.connections;
+        for (int round = 1; round <= JOURNEY_MAX_LEGS; round++) {
+            const int* previous = &arrival[(round - 1) * cityCount];
+            int* current = &arrival[round * cityCount];
+            int* currentVia = &via[round * cityCount];
+            copy(previous, previous + cityCount, current);
+            bool improved = false;
+            for (int c = 0; c < (int)connections.size(); c++) {
+                const JourneyConnection& connection = connections[c];
+                if (connection.departAt >= current[target]) {
+                    break; // Nothing leaving later can arrive sooner
+                }
+                int ready = previous[connection.fromCity];
+                if (ready == INT_MAX || connection.arriveAt >= current[connection.toCity]) {
+                    continue;
+                }
+                if (connection.fromCity != origin) {
+                    ready += transferMinutes;
+                }
+                if (connection.departAt < ready ||
+                    buses[connection.busIndex].seats.available() < passengers) {
+                    continue;
+                }
+                current[connection.toCity] = connection.arriveAt;
+                currentVia[connection.toCity] = c;
+                improved = true;
+            }
+            if (current[target] < previous[target]) {
+                result.push_back(traceJourney(timetable, via, cityCount, round, target));
+            }
+            if (!improved) {
+                break;
+            }
+        }
+        return result;
+    }
+
+    vector<Journey> planJourney(const char* source, const char* destination, int date,
+                                int earliestDeparture = 0, int passengers = 1,
+                                int transferMinutes = JOURNEY_MIN_TRANSFER) {
+        Arena arena;
+        ArenaVector<Journey> found = planJourney(arena, source, destination, date, earliestDeparture,
+                                                 passengers, transferMinutes);
+        return vector<Journey>(found.begin(), found.end());
+    }
+
+    // All active buses in ID order
+    vector<Bus> listBuses() {
+        shared_lock<shared_mutex> state(stateLock);
+        vector<int> active;
+        for (int i = 0; i < buses.size(); i++) {
+            if (buses[i].isActive) {
+                active.push_back(i);
+            }
+        }
+        sortByBusId(active);
+        vector<Bus> result;
+        copyBuses(active, result);
+        return result;
+    }
+
+    // Tickets matching a query, in ticket slot order: booking order, except
+    // that bookings made since a compaction fill the slots it freed. The
+    // conditions run as vectorized filters over ticketColumns, one chunk
+    // at a time.
+    vector<Ticket> findTickets(const ScanQuery& query) {
+        OperationTimer timer(METRIC_SCAN);
+        vector<Ticket> result;
+        int sourceId = -1, destinationId = -1;
+        if (query.source && query.source[0] && (sourceId = findStringId(query.source)) == -1) {
+            return result;
+        }
+        if (query.destination && query.destination[0] &&
+            (destinationId = findStringId(query.destination)) == -1) {
+            return result;
+        }
+        
+        shared_lock<shared_mutex> index(indexLock);
+        uint64_t keep[STORE_CHUNK_SIZE / 64];
+        int count;
+        for (int start = 0; start < ticketColumns.busIds.size(); start += count) {
+            const int32_t* busIds = ticketColumns.busIds.run(start, count);
+            selectAll(keep, count);
+            if (!freeTicketSlots.empty()) {
+                filterInt32Range(busIds, count, 1, INT_MAX, keep); // Free slots have bus ID 0
+            }
+            if (query.bookedState != -1) {
+                filterByteEquals(&ticketColumns.booked[start], count, (uint8_t)query.bookedState, keep);
+            }
+            if (query.busId != 0) {
+                filterInt32Range(busIds, count, query.busId, query.busId, keep);
+            }
+            if (sourceId != -1) {
+                filterInt32Range(&ticketColumns.sourceIds[start], count, sourceId, sourceId, keep);
+            }
+            if (destinationId != -1) {
+                filterInt32Range(&ticketColumns.destinationIds[start], count, destinationId, destinationId, keep);
+            }
+            if (query.fromDate != 0 || query.toDate != INT_MAX) {
+                filterInt32Range(&ticketColumns.travelDates[start], count, query.fromDate, query.toDate, keep);
+            }
+            if (query.minFare > 0 || query.maxFare < DBL_MAX) {
+                filterDoubleRange(&ticketColumns.fares[start], count, query.minFare, query.maxFare, keep);
+            }
+            forEachSelected(keep, count, [&](int row) {
+                result.push_back(tickets.get(start + row));
+            });
+        }
+        return result;
+    }
+
+    // Active buses matching a query, in ID order. Bus fields are gathered
+    // into columns for each query rather than kept up to date: there are
+    // few buses, and their free seat counts change with every booking.
+    vector<Bus> findBuses(const ScanQuery& query) {
+        OperationTimer timer(METRIC_SCAN);
+        shared_lock<shared_mutex> state(stateLock);
+        int sourceId = -1, destinationId = -1;
+        if (query.source && query.source[0] && (sourceId = strings.find(query.source)) == -1) {
+            return vector<Bus>();
+        }
+        if (query.destination && query.destination[0] &&
+            (destinationId = strings.find(query.destination)) == -1) {
+            return vector<Bus>();
+        }
+        
+        int busCount = buses.size();
+        vector<uint8_t> active(busCount);
+        vector<int32_t> busIds(busCount), travelDates(busCount), sourceIds(busCount),
+                        destinationIds(busCount), freeSeats(busCount);
+        vector<double> prices(busCount);
+        for (int i = 0; i < busCount; i++) {
+            const Bus& bus = buses[i];
+            active[i] = bus.isActive;
+            busIds[i] = bus.busId;
+            travelDates[i] = packDate(bus.travelDate);
+            sourceIds[i] = bus.sourceId;
+            destinationIds[i] = bus.destinationId;
+            freeSeats[i] = bus.seats.available();
+            prices[i] = bus.ticketPrice;
+        }
+        
+        vector<int> matches;
+        uint64_t keep[STORE_CHUNK_SIZE / 64];
+        for (int start = 0; start < busCount; start += STORE_CHUNK_SIZE) {
+            int count = min(STORE_CHUNK_SIZE, busCount - start);
+            selectAll(keep, count);
+            filterByteEquals(&active[start], count, 1, keep);
+            if (query.busId != 0) {
+                filterInt32Range(&busIds[start], count, query.busId, query.busId, keep);
+            }
+            if (sourceId != -1) {
+                filterInt32Range(&sourceIds[start], count, sourceId, sourceId, keep);
+            }
+            if (destinationId != -1) {
+                filterInt32Range(&destinationIds[start], count, destinationId, destinationId, keep);
+            }
+            if (query.fromDate != 0 || query.toDate != INT_MAX) {
+                filterInt32Range(&travelDates[start], count, query.fromDate, query.toDate, keep);
+            }
+            if (query.minFreeSeats > 0) {
+                filterInt32Range(&freeSeats[start], count, query.minFreeSeats, INT_MAX, keep);
+            }
+            if (query.minFare > 0 || query.maxFare < DBL_MAX) {
+                filterDoubleRange(&prices[start], count, query.minFare, query.maxFare, keep);
+            }
+            forEachSelected(keep, count, [&](int row) {
+                matches.push_back(start + row);
+            });
+        }
+        sortByBusId(matches);
+        vector<Bus> result;
+        copyBuses(matches, result);
+        return result;
+    }
+
+    // Visit every stored ticket, booked or cancelled (until compacted), in
+    // ticket slot order. Bookings and cancellations wait while this runs,
+    // so the visitor must not call back into the service.
+    template <typename Fn>
+    void forEachTicket(Fn visit) {
+        shared_lock<shared_mutex> index(indexLock);
+        for (int i = 0; i < tickets.size(); i++) {
+            if (tickets.core(i).ticketId != 0) {
+                visit(tickets.get(i));
+            }
+        }
+    }
+
+    // Visit a copy of every stored ticket, booked or cancelled, in ticket
+    // slot order. Tickets are copied SCAN_CHUNK_SIZE slots at a time and
+    // the index lock is released between chunks, so long exports do not
+    // hold up bookings and the visitor may call back into the service.
+    template <typename Fn>
+    void scanTickets(Fn visit) {
+        vector<Ticket> chunk;
+        chunk.reserve(SCAN_CHUNK_SIZE);
+        int next = 0;
+        while (true) {
+            chunk.clear();
+            int last;
+            {
+                shared_lock<shared_mutex> index(indexLock);
+                last = min(tickets.size(), next + SCAN_CHUNK_SIZE);
+                for (int i = next; i < last; i++) {
+                    if (tickets.core(i).ticketId != 0) {
+                        chunk.push_back(tickets.get(i));
+                    }
+                }
+            }
+            if (last <= next) {
+                return;
+            }
+            next = last;
+            for (const Ticket& ticket : chunk) {
+                visit(ticket);
+            }
+        }
+    }
+
+    // Visit every active bill. Bills never change once stored, so no lock
+    // is held and the visitor may call back into the service.
+    template <typename Fn>
+    void forEachBill(Fn visit) {
+        int count;
+        {
+            shared_lock<shared_mutex> index(indexLock);
+            count = busBills.size();
+        }
+        for (int i = 0; i < count; i++) {
+            if (busBills[i].isActive) {
+                visit(busBills[i]);
+            }
+        }
+    }
+
+    // Check if any bus is active
+    bool hasActiveBuses() {
+        shared_lock<shared_mutex> state(stateLock);
+        return !busIndexById.empty();
+    }
+
+    // Check if any ticket is booked
+    bool hasBookings() {
+        shared_lock<shared_mutex> index(indexLock);
+        return liveTicketCount > 0;
+    }
+
+    // ---- Revenue dashboard. Every query is answered from running totals. ----
+
+    // Totals for one bus, including a deleted one
+    bool getBusStats(int busId, RevenueRollup& totals) {
+        shared_lock<shared_mutex> state(stateLock);
+        shared_lock<shared_mutex> index(indexLock);
+        auto it = busStats.find(busId);
+        if (it == busStats.end()) {
+            return false;
+        }
+        totals = it->second.totals;
+        return true;
+    }
+
+    // Totals across every bus
+    RevenueRollup getSystemTotals() {
+        shared_lock<shared_mutex> state(stateLock);
+        shared_lock<shared_mutex> index(indexLock);
+        return systemTotals;
+    }
+
+    // Totals per route, ordered by source and destination
+    vector<RouteRevenue> routeReport() {
+        shared_lock<shared_mutex> state(stateLock);
+        shared_lock<shared_mutex> index(indexLock);
+        vector<RouteRevenue> report;
+        report.reserve(routeRollups.size());
+        for (const auto& entry : routeRollups) {
+            report.push_back(RouteRevenue{strings.text(entry.first.first), strings.text(entry.first.second),
+                                          entry.second});
+        }
+        sort(report.begin(), report.end(), [](const RouteRevenue& a, const RouteRevenue& b) {
+            int order = strcmp(a.source, b.source);
+            return order != 0 ? order < 0 : strcmp(a.destination, b.destination) < 0;
+        });
+        return report;
+    }
+
+    // Totals per travel day between two packed dates (inclusive)
+    vector<DayRevenue> dayReport(int fromDate = 0, int toDate = INT_MAX) {
+        shared_lock<shared_mutex> state(stateLock);
+        shared_lock<shared_mutex> index(indexLock);
+        vector<DayRevenue> report;
+        for (auto it = dayRollups.lower_bound(fromDate); it != dayRollups.end() && it->first <= toDate; ++it) {
+            report.push_back(DayRevenue{it->first, it->second});
+        }
+        return report;
+    }
+
+    // Text of an interned bus number or city name. The text of an ID never
+    // changes, so the pointer stays valid for the life of the service.
+    const char* stringText(int id) const {
+        return strings.text(id);
+    }
+
+    // ID of an interned string, or -1 if no record uses it
+    int findStringId(const char* text) {
+        shared_lock<shared_mutex> state(stateLock);
+        return strings.find(text);
+    }
+
+    // Whether changes are refused: a read-only snapshot or a follower
+    bool isReadOnly() const {
+        return readOnly;
+    }
+
+    // Which IDs this service allocates
+    ShardSpec shardSpec() const {
+        return shard;
+    }
+
+    // Current store sizes, for metrics
+    ServiceGauges gauges() {
+        ServiceGauges result;
+        memset(&result, 0, sizeof(result));
+        {
+            shared_lock<shared_mutex> state(stateLock);
+            for (int i = 0; i < buses.size(); i++) {
+                if (buses[i].isActive) {
+                    result.buses++;
+                    result.freeSeats += buses[i].seats.available();
+                }
+            }
+            result.strings = strings.size();
+            result.freeSlots = (int)freeBusSlots.size();
+        }
+        {
+            shared_lock<shared_mutex> index(indexLock);
+            result.tickets = tickets.size() - (int)freeTicketSlots.size();
+            result.freeSlots += (int)freeTicketSlots.size();
+            result.bookedTickets = systemTotals.passengers;
+            result.bills = busBills.size();
+        }
+        {
+            lock_guard<mutex> hold(holdLock);
+            result.heldSeats = (int)holds.size();
+        }
+        {
+            lock_guard<mutex> waiting(waitlistLock);
+            result.waitlisted = (int)waitlistKeys.size();
+        }
+        result.journalBytes = readOnly ? 0 : journal.bytes();
+        if (following) {
+            result.replicaLagBytes = followerLagBytes;
+            result.replicaLagMillis = (long)(steadyMillis() - followerCaughtUpAt);
+            result.replicaLoadProblems = followerLoadProblems;
+        }
+        return result;
+    }
+
+    // Problems found while loading the data files at startup
+    const vector<string>& startupWarnings() const {
+        return warnings;
+    }
+
+    // Record a problem found while loading the data files. A follower
+    // reloading the owner's checkpoint after startup only counts its
+    // problems, in the replica load problems gauge.
+    void warn(const string& warning) {
+        if (startedUp) {
+            followerLoadProblems++;
+            return;
+        }
+        warnings.push_back(warning);
+    }
+
+    // Write the first count records at the indexes keep(index) accepts to
+    // <path>.tmp as a versioned, checksummed data file, and sync it.
+    // saveData() renames the temp files into place.
+    template <typename Records, typename Keep>
+    bool writeDataFile(const char* path, const Records& records, int count, int nextId, Keep keep) {
+        typedef typename decay<decltype(records[0])>::type T;
+        static_assert(sizeof(T) % 8 == 0, "records must be whole checksum words");
+        string tempPath = string(path) + ".tmp";
+        ofstream file(tempPath.c_str(), ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        
+        DataFileHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = DATA_FILE_MAGIC;
+        header.version = DATA_FILE_VERSION;
+        header.recordSize = sizeof(T);
+        header.nextId = nextId;
+        header.payloadChecksum = computeBlockChecksum(nullptr, 0);
+        header.checkpointStamp = checkpointStamp;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        
+        // Records are checksummed as one contiguous byte stream
+        for (int i = 0; i < count; i++) {
+            if (!keep(i)) {
+                continue;
+            }
+            const T& record = records[i];
+            header.payloadChecksum = computeBlockChecksum(&record, sizeof(T), header.payloadChecksum);
+            file.write(reinterpret_cast<const char*>(&record), sizeof(T));
+            header.recordCount++;
+        }
+        
+        header.headerChecksum = computeBlockChecksum(&header, offsetof(DataFileHeader, headerChecksum));
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.close();
+        
+        return !file.fail() && syncPath(tempPath.c_str());
+    }
+
+    template <typename Records>
+    bool writeDataFile(const char* path, const Records& records, int count, int nextId) {
+        return writeDataFile(path, records, count, nextId, [](int) { return true; });
+    }
+
+    // Stamp of the checkpoint that wrote a data file, or 0 if the file is
+    // missing or its header is damaged
+    uint64_t readCheckpointStamp(const string& path) {
+        ifstream file(path.c_str(), ios::binary);
+        DataFileHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != DATA_FILE_MAGIC ||
+            header.headerChecksum != computeBlockChecksum(&header, offsetof(DataFileHeader, headerChecksum))) {
+            return 0;
+        }
+        return header.checkpointStamp;
+    }
+
+    // Finish a checkpoint that stopped part way through renaming its temp
+    // files: any temp file stamped like the newest data file belongs to it.
+    // Temp files with older stamps are from checkpoints that never started
+    // renaming and are left to be overwritten.
+    void recoverCheckpoint() {
+        for (const char* path : CHECKPOINT_FILES) {
+            checkpointStamp = max(checkpointStamp, readCheckpointStamp(path));
+        }
+        if (checkpointStamp == 0) {
+            return;
+        }
+        for (const char* path : CHECKPOINT_FILES) {
+            string tempPath = string(path) + ".tmp";
+            if (readCheckpointStamp(path) == checkpointStamp || readCheckpointStamp(tempPath) != checkpointStamp) {
+                continue;
+            }
+            if (readOnly) {
+                warn(string(path) + " is from an unfinished checkpoint; open read-write to finish it");
+            } else if (replaceFile(tempPath.c_str(), path)) {
+                warn(string(path) + " restored from an unfinished checkpoint");
+            } else {
+                warn(string(path) + " could not be restored from " + tempPath);
+            }
+        }
+    }
+
+    // Map a data file and serve its records in place from the store.
+    // Files that fail validation are renamed to <path>.bad and ignored.
+    template <typename T>
+    void loadDataFile(const char* path, MappedFile& fileMap, RecordStore<T>& store, int& nextId) {
+        if (!fileMap.open(path)) {
+            loadedStamps.push_back(0);
+            return; // No checkpoint yet
+        }
+        
+        const char* problem = nullptr;
+        DataFileHeader header;
+        if (fileMap.size() < sizeof(header)) {
+            problem = "file is truncated";
+        } else {
+            memcpy(&header, fileMap.bytes(), sizeof(header));
+            if (header.magic != DATA_FILE_MAGIC) {
+                problem = "unrecognised format";
+            } else if (header.headerChecksum != computeBlockChecksum(&header, offsetof(DataFileHeader, headerChecksum))) {
+                problem = "header checksum mismatch";
+            } else if (header.version != DATA_FILE_VERSION || header.recordSize != sizeof(T)) {
+                problem = "written by an incompatible version";
+            } else if (header.recordCount > (uint64_t)INT_MAX ||
+                       fileMap.size() - sizeof(header) < header.recordCount * sizeof(T)) {
+                problem = "file is truncated";
+            } else if (header.payloadChecksum != computeBlockChecksum(fileMap.bytes() + sizeof(header),
+                                                                     header.recordCount * sizeof(T))) {
+                problem = "record checksum mismatch";
+            }
+        }
+        
+        if (problem) {
+            fileMap.close();
+            if (readOnly) {
+                warn(string(path) + " ignored (" + problem + ")");
+                loadedStamps.push_back(0);
+                return;
+            }
+            loadedStamps.push_back(0);
+            string badPath = string(path) + ".bad";
+            replaceFile(path, badPath.c_str());
+            warn(string(path) + " ignored (" + problem + "), moved to " + badPath);
+            return;
+        }
+        
+        store.attach(reinterpret_cast<T*>(fileMap.bytes() + sizeof(header)), (int)header.recordCount);
+        nextId = header.nextId;
+        loadedStamps.push_back(header.checkpointStamp);
+    }
+
+    // Load a data file into a store that is only ever appended to. An
+    // empty store is served from the file in place; a store holding an
+    // older checkpoint's records keeps them and gets the rest passed to
+    // add(record), so pointers into it stay valid.
+    template <typename T, typename AddFn>
+    void loadAppendOnlyFile(const char* path, MappedFile& fileMap, RecordStore<T>& store, int& nextId,
+                            AddFn add) {
+        if (store.size() == 0) {
+            loadDataFile(path, fileMap, store, nextId);
+            return;
+        }
+        MappedFile newFileMap;
+        RecordStore<T> loaded;
+        loadDataFile(path, newFileMap, loaded, nextId);
+        for (int i = store.size(); i < loaded.size(); i++) {
+            add(loaded[i]);
+        }
+    }
+
+    // Copy what the next checkpoint writes and give it a new stamp. The
+    // caller holds stateLock exclusively.
+    void takeSnapshot() {
+        checkpointStamp++;
+        snapshot.ids = CheckpointIds{nextBusId, nextTicketId, nextBillId, nextWaitId};
+        snapshot.stringCount = strings.size();
+        snapshot.ticketCount = tickets.size();
+        snapshot.billCount = busBills.size();
+        // Holds are not journaled, so their seats are written as free.
+        // stateLock is held exclusively, so no booking sees them free.
+        setHeldSeats(false);
+        copyRecords(buses, buses.size(), snapshot.buses);
+        setHeldSeats(true);
+        copyRecords(tickets.coreStore(), snapshot.ticketCount, snapshot.ticketCores);
+        snapshot.waiting.clear();
+        {
+            lock_guard<mutex> guard(waitlistLock);
+            for (const auto& entry : waitlists) {
+                snapshot.waiting.push_back(entry.second);
+            }
+        }
+        snapshot.history.clear();
+        for (const auto& entry : busHistory) {
+            snapshot.history.push_back(entry.second);
+        }
+        unique_lock<shared_mutex> index(indexLock);
+        reuseTicketSlots = false;
+    }
+
+    // Save data to file function: write the snapshot. Every file of a
+    // checkpoint carries its stamp, and all of them are written and synced
+    // before any is renamed into place, so a crash part way through the
+    // renames can be finished by recoverCheckpoint(). Compacted files are
+    // not supersets of the ones they replace, so they must never be mixed
+    // with another checkpoint's.
+    bool saveData() {
+        const CheckpointSnapshot& saved = snapshot;
+        bool ok = writeDataFile("strings.dat", strings.store(), saved.stringCount, saved.stringCount);
+        ok = ok && writeDataFile("buses.dat", saved.buses, (int)saved.buses.size(), saved.ids.nextBusId,
+                                 [&saved](int i) {
+                                     return saved.buses[i].busId != 0;
+                                 });
+        auto ticketKept = [&saved](int i) {
+            return saved.ticketCores[i].ticketId != 0;
+        };
+        ok = ok && writeDataFile("passengers.dat", tickets.detailStore(), saved.ticketCount,
+                                 saved.ids.nextTicketId, ticketKept);
+        ok = ok && writeDataFile("tickets.dat", saved.ticketCores, saved.ticketCount, saved.ids.nextTicketId,
+                                 ticketKept);
+        ok = ok && writeDataFile("busbills.dat", busBills, saved.billCount, saved.ids.nextBillId);
+        ok = ok && writeDataFile("waitlist.dat", saved.waiting, (int)saved.waiting.size(), saved.ids.nextWaitId);
+        ok = ok && writeDataFile("bushistory.dat", saved.history, (int)saved.history.size(), 0);
+        
+        for (const char* path : CHECKPOINT_FILES) {
+            ok = ok && replaceFile((string(path) + ".tmp").c_str(), path);
+        }
+        return ok;
+    }
+
+    // Write a full checkpoint now, waiting for one the checkpointer is
+    // writing
+    void checkpoint() {
+        if (readOnly) {
+            return;
+        }
+        lock_guard<mutex> checkpointing(checkpointLock);
+        writeCheckpoint();
+    }
+
+    // Compact the stores and checkpoint them, starting a fresh journal.
+    // Compaction takes the locks a chunk at a time; only the snapshot and
+    // the journal rotation hold stateLock exclusively throughout. The records before the snapshot are kept in
+    // the previous journal until every data file has been replaced, so a
+    // crash while writing loses nothing. The caller holds checkpointLock.
+    void writeCheckpoint() {
+        uint64_t startedAt = metricTicks();
+        bool rotated;
+        compactStores();
+        {
+            unique_lock<shared_mutex> state(stateLock);
+            takeSnapshot();
+            rotated = journal.rotate(checkpointStamp);
+        }
+        bool saved = saveData();
+        {
+            unique_lock<shared_mutex> index(indexLock);
+            reuseTicketSlots = true;
+        }
+        recordLatency(METRIC_SAVE, startedAt, !saved || !rotated);
+        if (saved) {
+            journal.dropPrevious();
+        }
+    }
+
+    // Load both halves of the ticket store. If one of the files was set
+    // aside as damaged, the other is cut back to match it and the journal
+    // supplies what it can.
+    void loadTickets() {
+        int detailNextId = nextTicketId;
+        loadDataFile("tickets.dat", ticketFileMap, tickets.coreStore(), nextTicketId);
+        loadDataFile("passengers.dat", passengerFileMap, tickets.detailStore(), detailNextId);
+        int coreCount = tickets.coreStore().size();
+        int detailCount = tickets.detailStore().size();
+        if (coreCount != detailCount) {
+            tickets.coreStore().truncate(detailCount);
+            tickets.detailStore().truncate(coreCount);
+            nextTicketId = coreCount < detailCount ? nextTicketId : detailNextId;
+            warn("tickets.dat and passengers.dat disagree; kept the first " +
+                               to_string(min(coreCount, detailCount)) + " tickets");
+        }
+    }
+
+    // Load data from file function. Checkpoint records are mapped rather
+    // than read one by one, so startup cost does not grow with record size.
+    void loadData() {
+        uint64_t startedAt = metricTicks();
+        recoverCheckpoint();
+        if (following) {
+            followerLoaded = followCheckpoint();
+            applyFollowedRecords();
+            recordLatency(METRIC_LOAD, startedAt, !followerLoaded || !warnings.empty());
+            return;
+        }
+        loadCheckpoint();
+        rebuildIndexes();
+        
+        // Replay events journaled since the last checkpoint, then fold them
+        // into a fresh checkpoint (this also drops any torn tail record)
+        CheckpointIds checkpointIds = {nextBusId, nextTicketId, nextBillId, nextWaitId};
+        int replayed = 0;
+        long intactBytes = Journal::replay([&](JournalRecordType type, const char* data, uint32_t length) {
+            applyJournalRecord(type, data, length, checkpointIds);
+            replayed++;
+        });
+        recordLatency(METRIC_LOAD, startedAt, !warnings.empty());
+        if (!readOnly && (replayed > 0 || journal.bytes() > intactBytes)) {
+            checkpoint();
+        }
+    }
+
+    // Load the stores from the checkpoint files; the indexes are left to
+    // rebuildIndexes(). The stores must be empty, except that strings and
+    // bills may hold an older checkpoint's (see loadAppendOnlyFile()).
+    // Returns false if the files were not all written by one checkpoint.
+    bool loadCheckpoint() {
+        loadedStamps.clear();
+        int stringCount = 0;
+        loadAppendOnlyFile("strings.dat", stringFileMap, strings.store(), stringCount,
+                           [&](const InternedString& entry) {
+                               strings.intern(entry.text);
+                           });
+        strings.rebuildIndex();
+        loadDataFile("buses.dat", busFileMap, buses, nextBusId);
+        loadTickets();
+        loadAppendOnlyFile("busbills.dat", billFileMap, busBills, nextBillId, [&](const BusBill& bill) {
+            busBills.push_back(bill);
+        });
+        
+        // Compaction history lives in its map only, and must be in place
+        // before the revenue totals are rebuilt
+        {
+            MappedFile historyFileMap;
+            RecordStore<BusHistory> history;
+            int unusedNextId = 0;
+            loadDataFile("bushistory.dat", historyFileMap, history, unusedNextId);
+            for (int i = 0; i < history.size(); i++) {
+                busHistory[history[i].busId] = history[i];
+            }
+        }
+        
+        // Waitlists live in their index only; the file is not kept mapped
+        {
+            MappedFile waitlistFileMap;
+            RecordStore<WaitlistEntry> waiting;
+            loadDataFile("waitlist.dat", waitlistFileMap, waiting, nextWaitId);
+            for (int i = 0; i < waiting.size(); i++) {
+                applyJoinWaitlist(waiting[i]);
+            }
+        }
+        return count(loadedStamps.begin(), loadedStamps.end(), loadedStamps[0]) == (long)loadedStamps.size();
+    }
+};
+
+// Read one key without echoing it
+int readKey() {
+#ifdef _WIN32
+    return _getch();
+#else
+    termios oldSettings, newSettings;
+    bool isTerminal = tcgetattr(STDIN_FILENO, &oldSettings) == 0;
+    if (isTerminal) {
+        newSettings = oldSettings;
+        newSettings.c_lflag &= ~(ICANON | ECHO);
+        tcsetattr(STDIN_FILENO, TCSANOW, &newSettings);
+    }
+    int ch = getchar();
+    if (isTerminal) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &oldSettings);
+    }
+    
+    // Report keys the way _getch() does. Enter is left in the input buffer,
+    // as it is on Windows where _getch() bypasses the stream.
+    if (ch == '\n' || ch == EOF) {
+        if (ch == '\n') {
+            ungetc(ch, stdin);
+        }
+        return 13;
+    } else if (ch == 127) {
+        return 8;
+    }
+    return ch;
+#endif
+}
+
+// Console client for the reservation service: menus, prompts and
+// formatted output. All reservation logic lives in ReservationService.
+class BusReservationSystem {
+private:
+    ReservationService& service;
+    
+    const char* USERNAME = "admin";
+    const char* PASSWORD = "********";
+
+public:
+    BusReservationSystem(ReservationService& reservationService) : service(reservationService) {
+    }
+
+    // Clear screen function
+    void clearScreen() {
+        #ifdef _WIN32
+            system("cls");
+        #else
+            cout << "\033[2J\033[H" << flush; // ANSI clear, no shell fork
+        #endif
+    }
+
+    // Display decorated header
+    void displayHeader(const char* title) {
+        int titleLength = strlen(title);
+        int totalWidth = 60;
+        int padding = (totalWidth - titleLength) / 2;
+        
+        cout << "\n";
+        cout << "+" << string(totalWidth-2, '=') << "+\n";
+        cout << "|" << string(padding-1, ' ') << title << string(totalWidth-padding-titleLength-1, ' ') << "|\n";
+        cout << "+" << string(totalWidth-2, '=') << "+\n";
+    }
+
+    // Login function
+    bool login() {
+        char username[50];
+        char password[50];
+        char ch;
+        int attempts = 0;
+        const int MAX_ATTEMPTS = 3;
+
+        while (attempts < MAX_ATTEMPTS) {
+            clearScreen();
+            displayHeader("LOGIN");
+            
+            cout << "\nUsername: ";
+            cin >> username;
+#ifndef _WIN32
+            // The password is read from the same stream here, so skip the
+            // Enter that ended the username
+            if (cin.peek() == '\n') {
+                cin.get();
+            }
+#endif
+            
+            cout << "Password: ";
+            // Hide password with asterisks
+            int i = 0;
+            while (true) {
+                ch = readKey();
+                if (ch == 13) { // Enter key
+                    password[i] = '\0';
+                    break;
+                } else if (ch == 8) { // Backspace
+                    if (i > 0) {
+                        i--;
+                        cout << "\b \b"; // Move back, erase, move back again
+                    }
+                } else {
+                    password[i++] = ch;
+                    cout << "*";
+                }
+            }
+            
+            if (compareString(username, USERNAME) && compareString(password, PASSWORD)) {
+                clearScreen();
+                displayHeader("LOGIN SUCCESSFUL");
+                cout << "\nWelcome to Bus Ticket Reservation System!\n";
+                cout << "Press Enter to continue...";
+                cin.ignore();
+                cin.get();
+                return true;
+            } else {
+                attempts++;
+                clearScreen();
+                displayHeader("LOGIN FAILED");
+                cout << "\nIncorrect username or password! " << (MAX_ATTEMPTS - attempts) << " attempts remaining.\n";
+                cout << "Press Enter to continue...";
+                cin.ignore();
+                cin.get();
+            }
+        }
+
+        clearScreen();
+        displayHeader("ACCESS DENIED");
+        cout << "\nToo many failed attempts. Program is closing.\n";
+        return false;
+    }
+
+    // Show menu function
+    void showMenu() {
+        int choice = 0;
+        do {
+            clearScreen();
+            displayHeader("BUS TICKET RESERVATION SYSTEM");
+            
+            cout << "\n";
+            cout << "============================================\n";
+            cout << "[]  1. Add New Bus                         []\n";
+            cout << "[]  2. View All Buses                      []\n";
+            cout << "[]  3. Search Bus                          []\n";
+            cout << "[]  4. Book Ticket                         []\n";
+            cout << "[]  5. View Ticket                         []\n";
+            cout << "[]  6. Cancel Ticket                       []\n";
+            cout << "[]  7. View All Bookings                   []\n";
+            cout << "[]  8. Delete Bus Record                   []\n";
+            cout << "[]  9. View Bus Bill History               []\n";
+            cout << "[]  10. Exit                               []\n";
+            cout << "============================================\n";
+            cout << "\nYour choice: ";
+            
+            // Invalid input handling
+            if (!(cin >> choice)) {
+                if (cin.eof()) {
+                    return; // Input closed
+                }
+                clearInputBuffer();
+                clearScreen();
+                displayHeader("INVALID INPUT");
+                cout << "\nPlease enter a number between 1 and 10.\n";
+                cout << "Press Enter to continue...";
+                cin.ignore();
+                cin.get();
+                continue;
+            }
+
+            switch (choice) {
+                case 1:
+                    clearScreen();
+                    addBus();
+                    cout << "\nPress Enter to continue...";
+                    cin.ignore();
+                    cin.get();
+                    break;
+                case 2:
+                    clearScreen();
+                    viewAllBuses();
+                    cout << "\nPress Enter to continue...";
+                    cin.ignore();
+                    cin.get();
+                    break;
+                case 3:
+                    clearScreen();
+                    searchBus();
+                    cout << "\nPress Enter to continue...";
+                    cin.ignore();
+                    cin.get();
+                    break;
+                case 4:
+                    clearScreen();
+                    bookTicket();
+                    cout << "\nPress Enter to continue...";
+                    cin.ignore();
+                    cin.get();
+                    break;
+                case 5:
+                    clearScreen();
+                    viewTicket();
+                    cout << "\nPress Enter to continue...";
+                    cin.ignore();
+                    cin.get();
+                    break;
+                case 6:
+                    clearScreen();
+                    cancelTicket();
+                    cout << "\nPress Enter to continue...";
+                    cin.ignore();
+                    cin.get();
+                    break;
+                case 7:
+                    clearScreen();
+                    viewAllBookings();
+                    cout << "\nPress Enter to continue...";
+                    cin.ignore();
+                    cin.get();
+                    break;
+                case 8:
+                    clearScreen();
+                    deleteBus();
+                    cout << "\nPress Enter to continue...";
+                    cin.ignore();
+                    cin.get();
+                    break;
+                case 9:
+                    clearScreen();
+                    viewBusBillHistory();
+                    cout << "\nPress Enter to continue...";
+                    cin.ignore();
+                    cin.get();
+                    break;
+                case 10:
+                    clearScreen();
+                    displayHeader("THANK YOU");
+                    cout << "\nExiting program... Thank you for using our service!\n";
+                    break;
+                default:
+                    clearScreen();
+                    displayHeader("INVALID CHOICE");
+                    cout << "\nPlease enter a number between 1 and 10.\n";
+                    cout << "Press Enter to continue...";
+                    cin.ignore();
+                    cin.get();
+            }
+        } while (choice != 10);
+    }
+
+    // Add new bus function
+    void addBus() {
+        Bus newBus;
+        clearInputBuffer();
+        
+        cout << "\n========== ADD NEW BUS ==========\n";
+        
+        cout << "Bus Number: ";
+        cin.getline(newBus.busNumber, 20);
+        
+        // Check if bus number already exists
+        Bus existing;
+        if (service.getBusByNumber(newBus.busNumber, existing)) {
+            cout << "This bus number already exists!\n";
+            return;
+        }
+        
+        cout << "Source: ";
+        cin.getline(newBus.source, 50);
+        
+        cout << "Destination: ";
+        cin.getline(newBus.destination, 50);
+
+        // Travel date with validation
+        bool validDate = false;
+        while (!validDate) {
+            cout << "Travel Date (DD/MM/YYYY): ";
+            cin.getline(newBus.travelDate, 11);
+            
+            if (isValidFutureDate(newBus.travelDate)) {
+                validDate = true;
+            } else {
+                cout << "Error: Please enter a valid date in DD/MM/YYYY format. The date must be today or a future date.\n";
+            }
+        }
+        
+        // Departure time with AM/PM
+        char tempTime[10];
+        char ampm[3];
+        cout << "Departure Time (HH:MM): ";
+        cin.getline(tempTime, 10);
+        cout << "AM/PM: ";
+        cin.getline(ampm, 3);
+        
+        // Combine time with AM/PM. Longer input than HH:MM is cut short
+        // here and then rejected as an invalid time.
+        snprintf(newBus.departureTime, sizeof(newBus.departureTime), "%.6s %.2s", tempTime, ampm);
+        
+        // Arrival time with AM/PM
+        cout << "Arrival Time (HH:MM): ";
+        cin.getline(tempTime, 10);
+        cout << "AM/PM: ";
+        cin.getline(ampm, 3);
+        
+        // Combine time with AM/PM
+        snprintf(newBus.arrivalTime, sizeof(newBus.arrivalTime), "%.6s %.2s", tempTime, ampm);
+        
+        cout << "Total Seats: ";
+        cin >> newBus.totalSeats;
+        
+        if (newBus.totalSeats > MAX_SEATS) {
+            cout << "Maximum seat limit is " << MAX_SEATS << "!\n";
+            newBus.totalSeats = MAX_SEATS;
+        } else if (newBus.totalSeats < 1) {
+            cout << "A bus needs at least 1 seat!\n";
+            newBus.totalSeats = 1;
+        }
+        
+        cout << "Ticket Price: ";
+        cin >> newBus.ticketPrice;
+        
+        OperationResult result = service.addBusRecord(newBus);
+        if (result.status == STATUS_DUPLICATE_BUS_NUMBER) {
+            cout << "This bus number already exists!\n";
+            return;
+        } else if (result.status != STATUS_OK) {
+            cout << "\nBus could not be saved: " << statusMessage(result.status) << ".\n";
+            return;
+        }
+        cout << "\nBus added successfully with ID: " << newBus.busId << "\n";
+    }
+
+    // View all buses function
+    void viewAllBuses() {
+        cout << "\n========== ALL BUSES ==========\n";
+        
+        vector<Bus> buses = service.listBuses();
+        if (buses.empty()) {
+            cout << "No buses available.\n";
+            return;
+        }
+        
+        cout << "ID    Bus Number    Source          Destination     Travel Date    Departure    Arrival      Total Seats  Available    Price\n";
+        cout << "----------------------------------------------------------------------------------------------------------------\n";
+        
+        for (const Bus& bus : buses) {
+            int availableSeats = countAvailableSeats(bus);
+            
+            printf("%-5d %-13s %-15s %-15s %-14s %-12s %-12s %-12d %-12d %.2f\n", 
+                   bus.busId, bus.busNumber, bus.source, bus.destination,
+                   bus.travelDate, bus.departureTime, bus.arrivalTime, 
+                   bus.totalSeats, availableSeats, bus.ticketPrice);
+        }
+    }
+
+    // Search bus function
+    void searchBus() {
+        int choice;
+        clearInputBuffer();
+        
+        cout << "\n========== SEARCH BUS ==========\n";
+        cout << "Search by:\n";
+        cout << "1. Source and Destination\n";
+        cout << "2. Bus Number\n";
+        cout << "3. Departures from a City (Date Range)\n";
+        cout << "4. Journeys with Connections\n";
+        cout << "Your choice: ";
+        cin >> choice;
+        
+        clearInputBuffer();
+        
+        if (choice == 1) {
+            char source[50], destination[50];
+            cout << "Enter Source: ";
+            cin.getline(source, 50);
+            cout << "Enter Destination: ";
+            cin.getline(destination, 50);
+            
+            vector<Bus> matches = service.searchRoute(source, destination);
+            cout << "\n----- Buses from " << source << " to " << destination << " -----\n";
+            
+            cout << "ID    Bus Number    Departure      Arrival        Available    Price\n";
+            cout << "----------------------------------------------------------------\n";
+            
+            for (const Bus& bus : matches) {
+                int availableSeats = countAvailableSeats(bus);
+                
+                printf("%-5d %-13s %-15s %-15s %-12d %.2f\n", 
+                       bus.busId, bus.busNumber, bus.departureTime, 
+                       bus.arrivalTime, availableSeats, bus.ticketPrice);
+            }
+            
+            if (matches.empty()) {
+                cout << "No buses found for the specified route.\n";
+            }
+        } else if (choice == 2) {
+            char busNumber[20];
+            cout << "Enter Bus Number: ";
+            cin.getline(busNumber, 20);
+            
+            Bus bus;
+            if (service.getBusByNumber(busNumber, bus)) {
+                int availableSeats = countAvailableSeats(bus);
+                
+                cout << "\n----- Bus Details -----\n";
+                cout << "Bus ID: " << bus.busId << endl;
+                cout << "Bus Number: " << bus.busNumber << endl;
+                cout << "Route: " << bus.source << " to " << bus.destination << endl;
+                cout << "Departure Time: " << bus.departureTime << endl;
+                cout << "Arrival Time: " << bus.arrivalTime << endl;
+                cout << "Total Seats: " << bus.totalSeats << endl;
+                cout << "Available Seats: " << availableSeats << endl;
+                cout << "Ticket Price: " << bus.ticketPrice << endl;
+            } else {
+                cout << "Bus with number " << busNumber << " not found.\n";
+            }
+        } else if (choice == 3) {
+            char source[50], fromDate[11], toDate[11];
+            cout << "Enter Source: ";
+            cin.getline(source, 50);
+            cout << "From Date (DD/MM/YYYY): ";
+            cin.getline(fromDate, 11);
+            cout << "To Date (DD/MM/YYYY): ";
+            cin.getline(toDate, 11);
+            
+            int from = packDate(fromDate);
+            int to = packDate(toDate);
+            if (from == 0 || to == 0) {
+                cout << "Error: Please enter dates in DD/MM/YYYY format.\n";
+                return;
+            }
+            
+            vector<Bus> matches = service.searchDepartures(source, from, to);
+            cout << "\n----- Departures from " << source << " (" << fromDate << " - " << toDate << ") -----\n";
+            
+            cout << "ID    Bus Number    Destination     Travel Date    Departure    Available    Price\n";
+            cout << "------------------------------------------------------------------------------------\n";
+            
+            for (const Bus& bus : matches) {
+                int availableSeats = countAvailableSeats(bus);
+                
+                printf("%-5d %-13s %-15s %-14s %-12s %-12d %.2f\n", 
+                       bus.busId, bus.busNumber, bus.destination, bus.travelDate,
+                       bus.departureTime, availableSeats, bus.ticketPrice);
+            }
+            
+            if (matches.empty()) {
+                cout << "No departures found for the specified city and dates.\n";
+            }
+        } else if (choice == 4) {
+            planJourney();
+        } else {
+            cout << "Invalid choice!\n";
+        }
+    }
+
+    // Show the journeys between two cities on a date, with changes of bus
+    void planJourney() {
+        char source[50], destination[50], travelDate[11];
+        int passengers;
+        cout << "Enter Source: ";
+        cin.getline(source, 50);
+        cout << "Enter Destination: ";
+        cin.getline(destination, 50);
+        cout << "Travel Date (DD/MM/YYYY): ";
+        cin.getline(travelDate, 11);
+        cout << "Number of Passengers: ";
+        cin >> passengers;
+        clearInputBuffer();
+        
+        int date = packDate(travelDate);
+        if (date == 0) {
+            cout << "Error: Please enter dates in DD/MM/YYYY format.\n";
+            return;
+        }
+        if (passengers < 1 || passengers > MAX_SEATS) {
+            cout << "Invalid number of passengers!\n";
+            return;
+        }
+        
+        vector<Journey> journeys = service.planJourney(source, destination, date, 0, passengers);
+        cout << "\n----- Journeys from " << source << " to " << destination << " on " << travelDate << " -----\n";
+        for (size_t j = 0; j < journeys.size(); j++) {
+            const Journey& journey = journeys[j];
+            char departure[9], arrival[9];
+            formatMinutes(journey.legs[0].departAt, departure);
+            formatMinutes(journey.legs[journey.legCount - 1].arriveAt, arrival);
+            printf("\nOption %d: %d bus%s, departs %s, arrives %s%s, fare %.2f per passenger\n",
+                   (int)j + 1, journey.legCount, journey.legCount == 1 ? "" : "es", departure, arrival,
+                   journey.legs[journey.legCount - 1].arriveAt >= 24 * 60 ? " (next day)" : "", journey.fare);
+            cout << "ID    Bus Number    From            To              Date         Departure  Arrival    Available\n";
+            cout << "----------------------------------------------------------------------------------------------\n";
+            for (int l = 0; l < journey.legCount; l++) {
+                const Bus& bus = journey.legs[l].bus;
+                printf("%-5d %-13s %-15s %-15s %-12s %-10s %-10s %d\n",
+                       bus.busId, bus.busNumber, bus.source, bus.destination, bus.travelDate,
+                       bus.departureTime, bus.arrivalTime, countAvailableSeats(bus));
+            }
+        }
+        
+        if (journeys.empty()) {
+            cout << "No journeys found for the specified cities and date.\n";
+        }
+    }
+
+    // Book ticket function
+    void bookTicket() {
+        clearScreen();
+        displayHeader("BOOK TICKET");
+        
+        int busId;
+        
+        // Show all buses
+        viewAllBuses();
+        
+        if (!service.hasActiveBuses()) {
+            cout << "\nNo buses available. Press Enter to return to main menu...";
+            cin.ignore();
+            cin.get();
+            return;
+        }
+        
+        // Get travel details first
+        clearInputBuffer();
+        cout << "\n----- Travel Details -----\n";
+        
+        // Travel date with validation
+        bool validDate = false;
+        char requestedDate[11];
+        
+        while (!validDate) {
+            cout << "Travel Date (DD/MM/YYYY): ";
+            cin.getline(requestedDate, 11);
+            
+            if (isValidFutureDate(requestedDate)) {
+                validDate = true;
+            } else {
+                cout << "Error: Please enter a valid date in DD/MM/YYYY format. The date must be today or a future date.\n";
+            }
+        }
+        
+        cout << "Source: ";
+        char requestedSource[50];
+        cin.getline(requestedSource, 50);
+        
+        cout << "Destination: ";
+        char requestedDestination[50];
+        cin.getline(requestedDestination, 50);
+        
+        // Show available buses for the requested date and route
+        cout << "\nAvailable Buses for " << requestedDate << " from " << requestedSource << " to " << requestedDestination << ":\n";
+        
+        cout << "+------+-------------+-----------+-----------+-----------+--------+\n";
+        cout << "| ID   | Bus Number  | Departure | Arrival   | Available | Price  |\n";
+        cout << "+------+-------------+-----------+-----------+-----------+--------+\n";
+        
+        int date = packDate(requestedDate);
+        vector<Bus> matches = service.searchRoute(requestedSource, requestedDestination, date, date);
+        for (const Bus& bus : matches) {
+            int availableSeats = countAvailableSeats(bus);
+            
+            printf("| %-4d | %-11s | %-9s | %-9s | %-9d | %-6.2f |\n", 
+                   bus.busId, bus.busNumber, bus.departureTime, 
+                   bus.arrivalTime, availableSeats, bus.ticketPrice);
+            
+            cout << "+------+-------------+-----------+-----------+-----------+--------+\n";
+        }
+        
+        if (matches.empty()) {
+            cout << "No buses available for the specified date and route.\n";
+            cout << "Press Enter to return to main menu...";
+            cin.ignore();
+            cin.get();
+            return;
+        }
+        
+        // Now ask for bus ID
+        cout << "\nEnter Bus ID: ";
+        cin >> busId;
+        
+        // Find the bus
+        Bus selectedBus;
+        
+        if (!service.getBus(busId, selectedBus)) {
+            cout << "Bus with ID " << busId << " not found.\n";
+            cout << "Press Enter to return to main menu...";
+            cin.ignore();
+            cin.get();
+            return;
+        }
+        
+        // Verify that the bus matches the requested details
+        if (!compareString(selectedBus.travelDate, requestedDate) ||
+            !compareString(selectedBus.source, requestedSource) ||
+            !compareString(selectedBus.destination, requestedDestination)) {
+            cout << "Selected bus does not match the requested travel details.\n";
+            cout << "Press Enter to return to main menu...";
+            cin.ignore();
+            cin.get();
+            return;
+        }
+        
+        // Check if seats are available
+        int availableSeats = countAvailableSeats(selectedBus);
+        if (availableSeats == 0) {
+            cout << "Sorry, no seats available for this bus.\n";
+            joinWaitlist(selectedBus);
+            cout << "Press Enter to return to main menu...";
+            cin.ignore();
+            cin.get();
+            return;
+        }
+        
+        // Several seats are booked together as a group
+        int seatCount;
+        cout << "Number of Seats (1-" << availableSeats << "): ";
+        cin >> seatCount;
+        if (seatCount < 1 || seatCount > availableSeats) {
+            cout << "Invalid number of seats!\n";
+            cout << "Press Enter to return to main menu...";
+            cin.ignore();
+            cin.get();
+            return;
+        }
+        if (seatCount > 1) {
+            bookGroup(selectedBus, seatCount);
+            return;
+        }
+        
+        // Show seat layout
+        cout << "\n----- Seat Layout -----\n";
+        cout << "Available: O | Booked: X\n\n";
+        
+        for (int i = 0; i < selectedBus.totalSeats; i++) {
+            printf("%3d%s  ", (i + 1), (selectedBus.seats.isFree(i) ? " O" : " X"));
+            if ((i + 1) % 4 == 0) cout << endl;
+        }
+        cout << endl;
+        
+        // Get seat number
+        int seatNumber;
+        cout << "Enter Seat Number (1-" << selectedBus.totalSeats << ", 0 for first available): ";
+        cin >> seatNumber;
+        
+        if (seatNumber < 0 || seatNumber > selectedBus.totalSeats) {
+            cout << "Invalid seat number!\n";
+            cout << "Press Enter to return to main menu...";
+            cin.ignore();
+            cin.get();
+            return;
+        }
+        
+        // Check if seat is available (0 lets the service pick one at booking)
+        if (seatNumber != 0 && !selectedBus.seats.isFree(seatNumber - 1)) {
+            cout << "Seat " << seatNumber << " is already booked!\n";
+            cout << "Press Enter to return to main menu...";
+            cin.ignore();
+            cin.get();
+            return;
+        }
+        
+        // Get passenger details
+        Passenger passenger;
+        clearInputBuffer();
+        
+        cout << "\n----- Passenger Details -----\n";
+        cout << "Name: ";
+        cin.getline(passenger.name, 50);
+        
+        cout << "Contact Number: ";
+        cin.getline(passenger.contactNumber, 15);
+        
+        cout << "Age: ";
+        cin >> passenger.age;
+        
+        clearInputBuffer();
+        cout << "Gender (M/F): ";
+        cin.getline(passenger.gender, 2);
+        
+        // Book the seat
+        OperationResult result = service.reserveSeat(busId, seatNumber, passenger);
+        Ticket newTicket;
+        if (result.status == STATUS_OK && !service.getTicket(result.ticketId, newTicket)) {
+            result.status = STATUS_TICKET_NOT_FOUND;
+        }
+        if (result.status != STATUS_OK) {
+            if (result.status == STATUS_SEAT_TAKEN || result.status == STATUS_BUS_FULL) {
+                cout << "Seat " << seatNumber << " was booked by someone else!\n";
+            } else {
+                cout << "Ticket could not be booked: " << statusMessage(result.status) << ".\n";
+            }
+            cout << "Press Enter to return to main menu...";
+            cin.ignore();
+            cin.get();
+            return;
+        }
+        char travelDate[11], bookingDate[30];
+        formatDate(newTicket.travelDate, travelDate);
+        formatDateTime(newTicket.bookingTime, bookingDate);
+        
+        // Print ticket in a nice format
+        clearScreen();
+        displayHeader("TICKET BOOKED SUCCESSFULLY");
+        
+        cout << "\n+------------------------------------------+\n";
+        cout << "|           TICKET DETAILS                 |\n";
+        cout << "+------------------------------------------+\n";
+        cout << "| Ticket ID      : " << setw(23) << left << newTicket.ticketId << "|\n";
+        cout << "| Bus Number     : " << setw(23) << left << selectedBus.busNumber << "|\n";
+        cout << "| Travel Date    : " << setw(23) << left << travelDate << "|\n";
+        cout << "| From           : " << setw(23) << left << service.stringText(newTicket.sourceId) << "|\n";
+        cout << "| To             : " << setw(23) << left << service.stringText(newTicket.destinationId) << "|\n";
+        cout << "| Departure Time : " << setw(23) << left << selectedBus.departureTime << "|\n";
+        cout << "+------------------------------------------+\n";
+        cout << "|           PASSENGER DETAILS              |\n";
+        cout << "+------------------------------------------+\n";
+        cout << "| Name           : " << setw(23) << left << passenger.name << "|\n";
+        cout << "| Seat Number    : " << setw(23) << left << newTicket.seatNumber << "|\n";
+        cout << "| Fare           : Rs. " << setw(20) << left << newTicket.fare << "|\n";
+        cout << "| Booking Date   : " << setw(23) << left << bookingDate << "|\n";
+        cout << "+------------------------------------------+\n";
+        
+        cout << "\nPlease note down your Ticket ID for future reference: " << newTicket.ticketId << "\n";
+        
+        // Show the bill if this booking filled the bus
+        if (result.billId != 0) {
+            printBusBill(result.billId);
+        }
+    }
+
+    // Offer a place on a full bus's waitlist
+    void joinWaitlist(const Bus& selectedBus) {
+        clearInputBuffer();
+        char answer[4];
+        cout << "Join the waitlist for this bus? (Y/N): ";
+        cin.getline(answer, sizeof(answer));
+        if (toupper((unsigned char)answer[0]) != 'Y') {
+            return;
+        }
+        
+        Passenger passenger;
+        cout << "\n----- Passenger Details -----\n";
+        cout << "Name: ";
+        cin.getline(passenger.name, 50);
+        cout << "Contact Number: ";
+        cin.getline(passenger.contactNumber, 15);
+        cout << "Age: ";
+        cin >> passenger.age;
+        clearInputBuffer();
+        cout << "Gender (M/F): ";
+        cin.getline(passenger.gender, 2);
+        cout << "Priority passenger (senior citizen or disabled)? (Y/N): ";
+        cin.getline(answer, sizeof(answer));
+        int priority = toupper((unsigned char)answer[0]) == 'Y' ? 1 : 0;
+        
+        WaitlistResult result = service.joinWaitlist(selectedBus.busId, passenger, priority);
+        if (result.status == STATUS_SEATS_AVAILABLE) {
+            cout << "A seat has just become free on this bus. Please book it instead.\n";
+        } else if (result.status != STATUS_OK) {
+            cout << "Could not join the waitlist: " << statusMessage(result.status) << ".\n";
+        } else {
+            cout << "\nAdded to the waitlist. Waitlist ID: " << result.waitId << "\n";
+            cout << "Passengers ahead: " << result.ahead << "\n";
+            cout << "A ticket is booked automatically when a seat is cancelled.\n";
+        }
+        cout << "\n";
+    }
+
+    // Book several seats on one bus in one go. Either every passenger gets
+    // a seat or nobody does.
+    void bookGroup(const Bus& selectedBus, int seatCount) {
+        clearInputBuffer();
+        char answer[4];
+        cout << "Seat the group together? (Y/N): ";
+        cin.getline(answer, sizeof(answer));
+        bool adjacent = answer[0] == 'Y' || answer[0] == 'y';
+        
+        vector<BookingRequest> requests(seatCount);
+        for (int i = 0; i < seatCount; i++) {
+            BookingRequest& request = requests[i];
+            memset(&request, 0, sizeof(request));
+            request.busId = selectedBus.busId;
             
-            cout << "\nUsername: ";
-            cin >> username;
+            cout << "\n----- Passenger " << (i + 1) << " of " << seatCount << " -----\n";
+            cout << "Name: ";
+            cin.getline(request.passenger.name, sizeof(request.passenger.name));
             
-            cout << "Password: ";
-            // Hide password with asterisks
-            int i = 0;
-            while (true) {
-                ch = _getch();
-                if (ch == 13) { // Enter key
-                    password[i] = '\0';
-                    break;
-                } else if (ch == 8) { // Backspace
-                    if (i > 0) {
-                        i--;
-                        cout << "\b \b"; // Move back, erase, move back again
+            cout << "Contact Number: ";
+            cin.getline(request.passenger.contactNumber, sizeof(request.passenger.contactNumber));
+            
+            cout << "Age: ";
+            cin >> request.passenger.age;
+            
+            clearInputBuffer();
+            cout << "Gender (M/F): ";
+            cin.getline(request.passenger.gender, sizeof(request.passenger.gender));
+        }
+        
+        GroupBookingResult result = service.reserveGroup(requests, adjacent);
+        if (result.status != STATUS_OK) {
+            cout << "\nGroup could not be booked: " << statusMessage(result.status) << ".\n";
+            return;
+        }
+        
+        clearScreen();
+        displayHeader("GROUP BOOKED SUCCESSFULLY");
+        cout << "\nBus " << selectedBus.busNumber << ", " << selectedBus.travelDate << " at "
+             << selectedBus.departureTime << "\n\n";
+        cout << "+-----------+------+----------------------+------------+\n";
+        cout << "| Ticket ID | Seat | Passenger            | Fare       |\n";
+        cout << "+-----------+------+----------------------+------------+\n";
+        double totalFare = 0;
+        int billId = 0;
+        for (int i = 0; i < seatCount; i++) {
+            const OperationResult& booking = result.bookings[i];
+            printf("| %-9d | %-4d | %-20.20s | %-10.2f |\n", booking.ticketId, booking.seatNumber,
+                   requests[i].passenger.name, booking.fare);
+            totalFare += booking.fare;
+            billId = booking.billId != 0 ? booking.billId : billId;
+        }
+        cout << "+-----------+------+----------------------+------------+\n";
+        printf("Total fare: Rs. %.2f for %d seats\n", totalFare, seatCount);
+        cout << "\nPlease note down the Ticket IDs for future reference.\n";
+        
+        // Show the bill if the group filled the bus
+        if (billId != 0) {
+            printBusBill(billId);
+        }
+    }
+
+    // View ticket function
+    void viewTicket() {
+        clearScreen();
+        displayHeader("VIEW TICKET DETAILS");
+        
+        int ticketId;
+        
+        cout << "\nEnter Ticket ID: ";
+        cin >> ticketId;
+        
+        Ticket ticket;
+        
+        if (!service.getTicket(ticketId, ticket) || !ticket.isBooked) {
+            cout << "\nTicket with ID " << ticketId << " not found or has been cancelled.\n";
+            return;
+        }
+        
+        // Find the bus
+        Bus bus;
+        
+        if (!service.getBus(ticket.busId, bus)) {
+            cout << "\nBus information not found for this ticket.\n";
+            return;
+        }
+        
+        char travelDate[11], bookingDate[30];
+        formatDate(ticket.travelDate, travelDate);
+        formatDateTime(ticket.bookingTime, bookingDate);
+        
+        // Print ticket details
+        cout << "\n+------------------------------------------+\n";
+        cout << "|           TICKET DETAILS                 |\n";
+        cout << "+------------------------------------------+\n";
+        cout << "| Ticket ID      : " << setw(23) << left << ticket.ticketId << "|\n";
+        cout << "| Bus Number     : " << setw(23) << left << bus.busNumber << "|\n";
+        cout << "| Travel Date    : " << setw(23) << left << travelDate << "|\n";
+        cout << "| From           : " << setw(23) << left << service.stringText(ticket.sourceId) << "|\n";
+        cout << "| To             : " << setw(23) << left << service.stringText(ticket.destinationId) << "|\n";
+        cout << "| Departure Time : " << setw(23) << left << bus.departureTime << "|\n";
+        cout << "+------------------------------------------+\n";
+        cout << "|           PASSENGER DETAILS              |\n";
+        cout << "+------------------------------------------+\n";
+        cout << "| Name           : " << setw(23) << left << ticket.passenger.name << "|\n";
+        cout << "| Contact        : " << setw(23) << left << ticket.passenger.contactNumber << "|\n";
+        cout << "| Age            : " << setw(23) << left << ticket.passenger.age << "|\n";
+        cout << "| Gender         : " << setw(23) << left << ticket.passenger.gender << "|\n";
+        cout << "+------------------------------------------+\n";
+        cout << "|           BOOKING DETAILS                |\n";
+        cout << "+------------------------------------------+\n";
+        cout << "| Seat Number    : " << setw(23) << left << ticket.seatNumber << "|\n";
+        cout << "| Fare           : Rs. " << setw(20) << left << ticket.fare << "|\n";
+        cout << "| Booking Date   : " << setw(23) << left << bookingDate << "|\n";
+        cout << "| Status         : " << setw(23) << left << (ticket.isBooked ? "Active" : "Cancelled") << "|\n";
+        cout << "+------------------------------------------+\n";
+    }
+
+    // Cancel ticket function
+    void cancelTicket() {
+        int ticketId;
+        
+        cout << "\n========== CANCEL TICKET ==========\n";
+        cout << "Enter Ticket ID: ";
+        cin >> ticketId;
+        
+        Ticket ticket;
+        
+        if (!service.getTicket(ticketId, ticket) || !ticket.isBooked) {
+            cout << "Ticket with ID " << ticketId << " not found or has already been cancelled.\n";
+            return;
+        }
+        
+        // Mark ticket as cancelled and its seat as available
+        OperationResult result = service.cancelReservation(ticketId);
+        
+        if (result.status == STATUS_BUS_NOT_FOUND) {
+            cout << "Bus information not found for this ticket.\n";
+            return;
+        } else if (result.status == STATUS_TICKET_NOT_FOUND) {
+            cout << "Ticket with ID " << ticketId << " not found or has already been cancelled.\n";
+            return;
+        } else if (result.status != STATUS_OK) {
+            cout << "Ticket could not be cancelled: " << statusMessage(result.status) << ".\n";
+            return;
+        }
+        
+        cout << "\nTicket with ID " << ticketId << " has been cancelled successfully.\n";
+        cout << "Refund amount: " << result.fare << endl;
+        if (result.promotedTicketId != 0) {
+            cout << "Seat " << result.seatNumber << " went to the next passenger on the waitlist (Ticket ID "
+                 << result.promotedTicketId << ").\n";
+        }
+    }
+
+    // View all bookings function
+    void viewAllBookings() {
+        clearScreen();
+        displayHeader("ALL BOOKINGS");
+        
+        if (!service.hasBookings()) {
+            cout << "\nNo bookings found.\n";
+            return;
+        }
+        
+        cout << "\n+----------+----------+--------------------+--------------+---------------+---------------+---------+----------+\n";
+        cout << "| Ticket ID|  Bus ID  |  Passenger Name    | Travel Date  |    Source     |  Destination  | Seat No.|  Status  |\n";
+        cout << "+----------+----------+--------------------+--------------+---------------+---------------+---------+----------+\n";
+        
+        // Show both active and cancelled tickets
+        service.forEachTicket([&](const Ticket& ticket) {
+            const char* status = ticket.isBooked ? "Active" : "Cancelled";
+            char travelDate[11];
+            formatDate(ticket.travelDate, travelDate);
+            
+            printf("| %-8d | %-8d | %-18s | %-12s | %-13s | %-13s | %-7d | %-8s |\n", 
+                   ticket.ticketId, ticket.busId, ticket.passenger.name, 
+                   travelDate, service.stringText(ticket.sourceId), service.stringText(ticket.destinationId), 
+                   ticket.seatNumber, status);
+            
+            cout << "+----------+----------+--------------------+--------------+---------------+---------------+---------+----------+\n";
+        });
+    }
+
+    // Delete bus function
+    void deleteBus() {
+        int busId;
+        
+        cout << "\n========== DELETE BUS RECORD ==========\n";
+        viewAllBuses();
+        
+        if (!service.hasActiveBuses()) {
+            return;
+        }
+        
+        cout << "\nEnter Bus ID to delete: ";
+        cin >> busId;
+        
+        // Find the bus
+        Bus bus;
+        
+        if (!service.getBus(busId, bus)) {
+            cout << "Bus with ID " << busId << " not found.\n";
+            return;
+        }
+        
+        // Check if there are active bookings for this bus
+        bool hasBookings = countAvailableSeats(bus) < bus.totalSeats;
+        bool isFullyBooked = countAvailableSeats(bus) == 0;
+        
+        if (hasBookings && !isFullyBooked) {
+            cout << "Cannot delete bus with active bookings that is not fully booked. Please cancel all tickets first.\n";
+            return;
+        }
+        
+        // Confirm deletion
+        char confirm;
+        cout << "Are you sure you want to delete Bus " << bus.busNumber 
+             << " (" << bus.source << " to " << bus.destination << ")? (y/n): ";
+        cin >> confirm;
+        
+        if (tolower(confirm) == 'y') {
+            // A fully booked bus not yet in bill history gets a bill first
+            OperationResult result = service.deleteBusRecord(busId);
+            if (result.status != STATUS_OK) {
+                cout << "Bus record could not be deleted: " << statusMessage(result.status) << ".\n";
+                return;
+            }
+            if (result.billId != 0) {
+                printBusBill(result.billId);
+            }
+            cout << "Bus record deleted successfully.\n";
+        } else {
+            cout << "Deletion cancelled.\n";
+        }
+    }
+
+    // View bus bill history function
+    void viewBusBillHistory() {
+        clearScreen();
+        displayHeader("BUS BILL HISTORY");
+        
+        bool found = false;
+        service.forEachBill([&](const BusBill& bill) {
+            found = true;
+            char travelDate[11], generatedDate[30];
+            formatDate(bill.travelDate, travelDate);
+            formatDateTime(bill.generatedTime, generatedDate);
+            {
+                cout << "\n+---------------------------------------------------------------+\n";
+                cout << "|                              BUS BILL " << setw(4) << left << bill.billId << "                       |\n";
+                cout << "+-------------------------------------------------------------------------+\n";
+                cout << "| Bus ID         : " << setw(42) << left << bill.busId << "        |\n";
+                cout << "| Bus Number     : " << setw(42) << left << service.stringText(bill.busNumberId) << "    |\n";
+                cout << "| Route          : " << setw(20) << left << service.stringText(bill.sourceId) << " to " << setw(19) << left << service.stringText(bill.destinationId) << "|\n";
+                cout << "| Travel Date    : " << setw(42) << left << travelDate << "   |\n";
+                cout << "| Departure Time : " << setw(42) << left << bill.departureTime << "|\n";
+                cout << "| Arrival Time   : " << setw(42) << left << bill.arrivalTime << "  |\n";
+                cout << "| Total Seats    : " << setw(42) << left << bill.totalSeats << "   |\n";
+                cout << "| Total Revenue  : Rs. " << setw(39) << left << fixed << setprecision(2) << bill.totalRevenue << "|\n";
+                cout << "| Generated On   : " << setw(42) << left << generatedDate << "|\n";
+                cout << "+-------------------------------------------------------------------------+\n";
+                cout << "|                     PASSENGER DETAILS                         |\n";
+                cout << "+-------------------------------------------------------------------------+\n";
+                cout << "| " << setw(25) << left << "Name" << setw(20) << left << "Contact" << setw(10) << left << "Seat No." << "|\n";
+                cout << "+-------------------------------------------------------------------------+\n";
+                
+                for (int j = 0; j < bill.passengerCount; j++) {
+                    int ticketId = bill.passengerIds[j];
+                    
+                    // Find the ticket
+                    Ticket ticket;
+                    if (service.getTicket(ticketId, ticket)) {
+                        cout << "| " << setw(25) << left << ticket.passenger.name 
+                             << setw(20) << left << ticket.passenger.contactNumber 
+                             << setw(10) << left << ticket.seatNumber << "|\n";
+                    }
+                }
+                
+                cout << "+------------------------------------------------------------------------+\n";
+                cout << "| Total Passengers: " << setw(5) << left << bill.passengerCount 
+                     << "            Total Revenue: Rs. " << setw(10) << left << fixed << setprecision(2) << bill.totalRevenue << "|\n";
+                cout << "+------------------------------------------------------------------------+\n\n";
+            }
+        });
+        
+        if (!found) {
+            cout << "\nNo bus bills found.\n";
+        }
+    }
+
+    // Clear input buffer
+    void clearInputBuffer() {
+        cin.clear();
+        int ch;
+        while ((ch = cin.get()) != '\n' && ch != EOF);
+    }
+
+    // Print a bill generated for a fully booked bus
+    void printBusBill(int billId) {
+        BusBill newBill;
+        if (!service.getBill(billId, newBill)) {
+            return;
+        }
+        
+        char travelDate[11], generatedDate[30];
+        formatDate(newBill.travelDate, travelDate);
+        formatDateTime(newBill.generatedTime, generatedDate);
+        
+        // Print bill
+        cout << "\n========== BUS BILL ==========\n";
+        cout << "Bill ID: " << newBill.billId << endl;
+        cout << "Bus Number: " << service.stringText(newBill.busNumberId) << endl;
+        cout << "Route: " << service.stringText(newBill.sourceId) << " to " << service.stringText(newBill.destinationId) << endl;
+        cout << "Travel Date: " << travelDate << endl;
+        cout << "Departure Time: " << newBill.departureTime << endl;
+        cout << "Arrival Time: " << newBill.arrivalTime << endl;
+        cout << "Total Seats: " << newBill.totalSeats << endl;
+        cout << "Total Passengers: " << newBill.passengerCount << endl;
+        cout << "Total Revenue: " << newBill.totalRevenue << endl;
+        cout << "Generated On: " << generatedDate << endl;
+        cout << "================================\n";
+        
+        cout << "\nBus has been fully booked.\n";
+        cout << "A bill has been generated and stored in history.\n";
+    }
+
+    // String compare function
+    bool compareString(const char* str1, const char* str2) {
+        return strcmp(str1, str2) == 0;
+    }
+
+    // Count available seats
+    int countAvailableSeats(const Bus& bus) {
+        return bus.seats.available();
+    }
+};
+
+// Zero-copy reader for CSV or TSV text held in a writable buffer. Rows are
+// split in place: delimiters and line ends are overwritten with '\0' and
+// the field pointers handed out point into the buffer. Quoted fields may
+// contain the delimiter and doubled quotes, but not line breaks.
+class DelimitedReader {
+private:
+    char* cursor;
+    char* end;
+    char delimiter;
+    int lineNumber;
+    string lastLine; // Copy of a final line with no line break to overwrite
+
+public:
+    DelimitedReader(char* data, size_t length, char fieldDelimiter)
+        : cursor(data), end(data + length), delimiter(fieldDelimiter), lineNumber(0) {}
+
+    // Line number of the row last returned
+    int line() const {
+        return lineNumber;
+    }
+
+    // Split the next non-blank row into at most maxFields fields. Returns
+    // the number of fields found (which may exceed maxFields), or -1 at
+    // the end of the input.
+    int nextRow(char* fields[], int maxFields) {
+        while (cursor < end) {
+            lineNumber++;
+            char* lineStart = cursor;
+            char* lineEnd = static_cast<char*>(memchr(cursor, '\n', end - cursor));
+            if (lineEnd) {
+                cursor = lineEnd + 1;
+            } else {
+                lastLine.assign(cursor, end - cursor);
+                cursor = end;
+                lineStart = &lastLine[0];
+                lineEnd = lineStart + lastLine.size();
+            }
+            if (lineEnd > lineStart && lineEnd[-1] == '\r') {
+                lineEnd--;
+            }
+            *lineEnd = '\0';
+            if (lineEnd == lineStart) {
+                continue; // Blank line
+            }
+            return splitRow(lineStart, lineEnd, fields, maxFields);
+        }
+        return -1;
+    }
+
+private:
+    // Split one line in place, unquoting quoted fields
+    int splitRow(char* p, char* lineEnd, char* fields[], int maxFields) {
+        int count = 0;
+        while (true) {
+            char* field = p;
+            if (*p == '"') {
+                // Shift the unquoted text left over the quotes
+                char* out = p;
+                p++;
+                while (p < lineEnd) {
+                    if (*p == '"') {
+                        if (p + 1 < lineEnd && p[1] == '"') {
+                            *out++ = '"';
+                            p += 2;
+                            continue;
+                        }
+                        p++;
+                        break;
                     }
-                } else {
-                    password[i++] = ch;
-                    cout << "*";
+                    *out++ = *p++;
                 }
+                while (p < lineEnd && *p != delimiter) {
+                    p++; // Ignore stray text after the closing quote
+                }
+                *out = '\0';
+            } else {
+                while (p < lineEnd && *p != delimiter) {
+                    p++;
+                }
+            }
+            if (count < maxFields) {
+                fields[count] = field;
+            }
+            count++;
+            if (p >= lineEnd) {
+                *p = '\0';
+                return count;
+            }
+            *p++ = '\0';
+        }
+    }
+};
+
+// Copy a text field into a fixed-size record field
+bool copyField(char* dest, size_t size, const char* src) {
+    if (strlen(src) >= size) {
+        return false;
+    }
+    strcpy(dest, src);
+    return true;
+}
+
+// Parse a whole field as an integer
+bool parseIntField(const char* text, int& value) {
+    char* parseEnd;
+    long parsed = strtol(text, &parseEnd, 10);
+    if (parseEnd == text || *parseEnd != '\0' || parsed < INT_MIN || parsed > INT_MAX) {
+        return false;
+    }
+    value = (int)parsed;
+    return true;
+}
+
+// Parse a whole field as a number
+bool parseDoubleField(const char* text, double& value) {
+    char* parseEnd;
+    value = strtod(text, &parseEnd);
+    return parseEnd != text && *parseEnd == '\0';
+}
+
+// Progress of one import run
+struct ImportStats {
+    long rows;
+    long imported;
+    long errors;
+};
+
+// Report one rejected row without stopping the import
+void reportImportError(const char* path, int line, const char* message, ImportStats& stats) {
+    cout << path << ":" << line << ": " << message << "\n";
+    stats.errors++;
+}
+
+// Open an import file and pick its delimiter: tab if the first line has
+// one, comma otherwise. Returns false if the file cannot be read.
+bool openImportFile(const char* path, MappedFile& fileMap, char& delimiter) {
+    if (!fileMap.open(path)) {
+        cout << path << ": cannot read file (missing or empty)\n";
+        return false;
+    }
+    const char* data = fileMap.bytes();
+    const char* lineEnd = static_cast<const char*>(memchr(data, '\n', fileMap.size()));
+    size_t firstLine = lineEnd ? lineEnd - data : fileMap.size();
+    delimiter = memchr(data, '\t', firstLine) ? '\t' : ',';
+    return true;
+}
+
+// Import buses from CSV/TSV with the columns
+//   busNumber, source, destination, travelDate, departureTime, arrivalTime, totalSeats, ticketPrice
+// An optional header row starting with "busNumber" is skipped. Rows are
+// validated like addBus() and added in batches.
+ImportStats importBuses(ReservationService& service, const char* path) {
+    ImportStats stats = {0, 0, 0};
+    MappedFile fileMap;
+    char delimiter;
+    if (!openImportFile(path, fileMap, delimiter)) {
+        stats.errors++;
+        return stats;
+    }
+    DelimitedReader reader(fileMap.bytes(), fileMap.size(), delimiter);
+    
+    vector<Bus> batch;
+    vector<int> batchLines;
+    batch.reserve(IMPORT_BATCH_SIZE);
+    auto flush = [&]() {
+        vector<OperationResult> results = service.addBusBatch(batch);
+        for (size_t i = 0; i < results.size(); i++) {
+            if (results[i].status == STATUS_OK) {
+                stats.imported++;
+            } else {
+                reportImportError(path, batchLines[i], statusMessage(results[i].status), stats);
+            }
+        }
+        batch.clear();
+        batchLines.clear();
+    };
+    
+    char* fields[8];
+    int count;
+    while ((count = reader.nextRow(fields, 8)) != -1) {
+        if (reader.line() == 1 && strcmp(fields[0], "busNumber") == 0) {
+            continue; // Header row
+        }
+        stats.rows++;
+        if (count != 8) {
+            reportImportError(path, reader.line(), "expected 8 fields", stats);
+            continue;
+        }
+        
+        Bus bus;
+        memset(&bus, 0, sizeof(bus));
+        if (!copyField(bus.busNumber, sizeof(bus.busNumber), fields[0]) ||
+            !copyField(bus.source, sizeof(bus.source), fields[1]) ||
+            !copyField(bus.destination, sizeof(bus.destination), fields[2]) ||
+            !copyField(bus.travelDate, sizeof(bus.travelDate), fields[3]) ||
+            !copyField(bus.departureTime, sizeof(bus.departureTime), fields[4]) ||
+            !copyField(bus.arrivalTime, sizeof(bus.arrivalTime), fields[5])) {
+            reportImportError(path, reader.line(), "field too long", stats);
+            continue;
+        }
+        if (!parseIntField(fields[6], bus.totalSeats) || !parseDoubleField(fields[7], bus.ticketPrice)) {
+            reportImportError(path, reader.line(), "totalSeats and ticketPrice must be numbers", stats);
+            continue;
+        }
+        batch.push_back(bus);
+        batchLines.push_back(reader.line());
+        if ((int)batch.size() == IMPORT_BATCH_SIZE) {
+            flush();
+        }
+    }
+    if (!batch.empty()) {
+        flush();
+    }
+    return stats;
+}
+
+// Import bookings from CSV/TSV with the columns
+//   busNumber, seatNumber, name, contactNumber, age, gender
+// Seat 0 books the first free seat. An optional header row starting with
+// "busNumber" is skipped.
+ImportStats importTickets(ReservationService& service, const char* path) {
+    ImportStats stats = {0, 0, 0};
+    MappedFile fileMap;
+    char delimiter;
+    if (!openImportFile(path, fileMap, delimiter)) {
+        stats.errors++;
+        return stats;
+    }
+    DelimitedReader reader(fileMap.bytes(), fileMap.size(), delimiter);
+    
+    unordered_map<string, int> busIds; // Bus number -> ID, cached across rows
+    vector<BookingRequest> batch;
+    vector<int> batchLines;
+    batch.reserve(IMPORT_BATCH_SIZE);
+    auto flush = [&]() {
+        vector<OperationResult> results = service.importBookings(batch);
+        for (size_t i = 0; i < results.size(); i++) {
+            if (results[i].status == STATUS_OK) {
+                stats.imported++;
+            } else {
+                reportImportError(path, batchLines[i], statusMessage(results[i].status), stats);
+            }
+        }
+        batch.clear();
+        batchLines.clear();
+    };
+    
+    char* fields[6];
+    int count;
+    while ((count = reader.nextRow(fields, 6)) != -1) {
+        if (reader.line() == 1 && strcmp(fields[0], "busNumber") == 0) {
+            continue; // Header row
+        }
+        stats.rows++;
+        if (count != 6) {
+            reportImportError(path, reader.line(), "expected 6 fields", stats);
+            continue;
+        }
+        
+        BookingRequest request;
+        memset(&request, 0, sizeof(request));
+        auto known = busIds.find(fields[0]);
+        if (known != busIds.end()) {
+            request.busId = known->second;
+        } else {
+            Bus bus;
+            if (!service.getBusByNumber(fields[0], bus)) {
+                reportImportError(path, reader.line(), statusMessage(STATUS_BUS_NOT_FOUND), stats);
+                continue;
+            }
+            busIds[fields[0]] = bus.busId;
+            request.busId = bus.busId;
+        }
+        if (!parseIntField(fields[1], request.seatNumber) || !parseIntField(fields[4], request.passenger.age)) {
+            reportImportError(path, reader.line(), "seatNumber and age must be numbers", stats);
+            continue;
+        }
+        if (!copyField(request.passenger.name, sizeof(request.passenger.name), fields[2]) ||
+            !copyField(request.passenger.contactNumber, sizeof(request.passenger.contactNumber), fields[3]) ||
+            !copyField(request.passenger.gender, sizeof(request.passenger.gender), fields[5])) {
+            reportImportError(path, reader.line(), "field too long", stats);
+            continue;
+        }
+        batch.push_back(request);
+        batchLines.push_back(reader.line());
+        if ((int)batch.size() == IMPORT_BATCH_SIZE) {
+            flush();
+        }
+    }
+    if (!batch.empty()) {
+        flush();
+    }
+    return stats;
+}
+
+// Run one import and print a summary. Returns the number of rows rejected.
+long runImport(ReservationService& service, const char* path, bool tickets) {
+    auto startedAt = chrono::steady_clock::now();
+    ImportStats stats = tickets ? importTickets(service, path) : importBuses(service, path);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startedAt).count();
+    printf("%s: imported %ld of %ld %s rows (%ld errors) in %.3f s, %.0f rows/min\n",
+           path, stats.imported, stats.rows, tickets ? "ticket" : "bus", stats.errors,
+           seconds, seconds > 0 ? stats.rows / seconds * 60 : 0.0);
+    return stats.errors;
+}
+
+// Output file written through a large buffer, so exports issue a few big
+// writes instead of one per field
+class BufferedFile {
+private:
+    FILE* file;
+    unique_ptr<char[]> buffer;
+    size_t used;
+    bool failed;
+
+public:
+    BufferedFile() : file(nullptr), buffer(new char[EXPORT_BUFFER_SIZE]), used(0), failed(false) {}
+
+    ~BufferedFile() {
+        close();
+    }
+
+    BufferedFile(const BufferedFile&) = delete;
+    BufferedFile& operator=(const BufferedFile&) = delete;
+
+    bool open(const char* path) {
+        file = fopen(path, "wb");
+        return file != nullptr;
+    }
+
+    void write(const void* data, size_t length) {
+        if (length > EXPORT_BUFFER_SIZE - used) {
+            flush();
+            if (length > (size_t)EXPORT_BUFFER_SIZE) {
+                failed = failed || fwrite(data, length, 1, file) != 1;
+                return;
+            }
+        }
+        memcpy(buffer.get() + used, data, length);
+        used += length;
+    }
+
+    void put(char ch) {
+        if (used == (size_t)EXPORT_BUFFER_SIZE) {
+            flush();
+        }
+        buffer[used++] = ch;
+    }
+
+    void flush() {
+        if (used > 0 && fwrite(buffer.get(), used, 1, file) != 1) {
+            failed = true;
+        }
+        used = 0;
+    }
+
+    // Flush and close. Returns false if any write failed.
+    bool close() {
+        if (!file) {
+            return !failed;
+        }
+        flush();
+        failed = fclose(file) != 0 || failed;
+        file = nullptr;
+        return !failed;
+    }
+};
+
+// Column types of the export formats
+enum ColumnType {
+    COLUMN_INT32 = 1,
+    COLUMN_FLOAT64 = 2,
+    COLUMN_STRING = 3
+};
+
+// CSV export writer. Columns are declared once, then each row is written
+// field by field in column order.
+class CsvWriter {
+private:
+    BufferedFile& out;
+    int columns;
+    int field; // Fields written in the current row
+
+    void separator() {
+        if (field++ > 0) {
+            out.put(',');
+        }
+    }
+
+public:
+    CsvWriter(BufferedFile& output) : out(output), columns(0), field(0) {}
+
+    // Declare a column; writes the header row as it goes
+    void addColumn(const char* name, ColumnType) {
+        if (columns++ > 0) {
+            out.put(',');
+        }
+        out.write(name, strlen(name));
+    }
+
+    void writeInt(int value) {
+        separator();
+        char text[16];
+        int length = 0;
+        unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+        do {
+            text[sizeof(text) - 1 - length++] = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude > 0);
+        if (value < 0) {
+            text[sizeof(text) - 1 - length++] = '-';
+        }
+        out.write(text + sizeof(text) - length, length);
+    }
+
+    void writeDouble(double value) {
+        separator();
+        char text[32];
+        int length = snprintf(text, sizeof(text), "%.2f", value);
+        out.write(text, length);
+    }
+
+    // Write a text field, quoted only when it contains a comma, quote or line break
+    void writeString(const char* value) {
+        separator();
+        size_t length = strlen(value);
+        if (strpbrk(value, ",\"\r\n") == nullptr) {
+            out.write(value, length);
+            return;
+        }
+        out.put('"');
+        for (size_t i = 0; i < length; i++) {
+            if (value[i] == '"') {
+                out.put('"');
+            }
+            out.put(value[i]);
+        }
+        out.put('"');
+    }
+
+    void endRow() {
+        out.put('\n');
+        field = 0;
+    }
+
+    void beginRows() {
+        out.put('\n'); // Ends the header row
+    }
+
+    void finish() {}
+};
+
+// Columnar binary export writer. Layout, little-endian:
+//   "BBXC", uint32 version, uint32 columnCount, uint32 reserved
+//   columnCount x { char name[24], uint32 type, uint32 reserved }
+//   row groups of up to EXPORT_GROUP_ROWS rows: uint32 rowCount,
+//   uint32 reserved, then each column's values for the group contiguously:
+//     COLUMN_INT32   rowCount x int32
+//     COLUMN_FLOAT64 rowCount x float64
+//     COLUMN_STRING  (rowCount + 1) x uint32 offsets, then the bytes
+//   an end marker: a row group header with rowCount 0 and no columns
+// Dates are stored as YYYYMMDD integers.
+class ColumnarWriter {
+private:
+    struct Column {
+        char name[24];
+        ColumnType type;
+        vector<int32_t> ints;
+        vector<double> doubles;
+        vector<uint32_t> offsets;
+        string bytes;
+    };
+
+    BufferedFile& out;
+    vector<Column> columns;
+    int field; // Column of the next value
+    int rows;  // Rows in the current group
+
+    void writeGroup() {
+        uint32_t groupHeader[2] = {(uint32_t)rows, 0};
+        out.write(groupHeader, sizeof(groupHeader));
+        for (Column& column : columns) {
+            if (column.type == COLUMN_INT32) {
+                out.write(column.ints.data(), column.ints.size() * sizeof(int32_t));
+                column.ints.clear();
+            } else if (column.type == COLUMN_FLOAT64) {
+                out.write(column.doubles.data(), column.doubles.size() * sizeof(double));
+                column.doubles.clear();
+            } else {
+                out.write(column.offsets.data(), column.offsets.size() * sizeof(uint32_t));
+                out.write(column.bytes.data(), column.bytes.size());
+                column.offsets.assign(1, 0);
+                column.bytes.clear();
+            }
+        }
+        rows = 0;
+    }
+
+public:
+    ColumnarWriter(BufferedFile& output) : out(output), field(0), rows(0) {}
+
+    void addColumn(const char* name, ColumnType type) {
+        Column column;
+        memset(column.name, 0, sizeof(column.name));
+        strncpy(column.name, name, sizeof(column.name) - 1);
+        column.type = type;
+        column.offsets.assign(1, 0);
+        columns.push_back(column);
+    }
+
+    void beginRows() {
+        uint32_t fileHeader[4] = {0, 1, (uint32_t)columns.size(), 0};
+        memcpy(&fileHeader[0], "BBXC", 4);
+        out.write(fileHeader, sizeof(fileHeader));
+        for (const Column& column : columns) {
+            uint32_t info[2] = {(uint32_t)column.type, 0};
+            out.write(column.name, sizeof(column.name));
+            out.write(info, sizeof(info));
+        }
+    }
+
+    void writeInt(int value) {
+        columns[field++].ints.push_back(value);
+    }
+
+    void writeDouble(double value) {
+        columns[field++].doubles.push_back(value);
+    }
+
+    void writeString(const char* value) {
+        Column& column = columns[field++];
+        column.bytes += value;
+        column.offsets.push_back((uint32_t)column.bytes.size());
+    }
+
+    void endRow() {
+        field = 0;
+        if (++rows == EXPORT_GROUP_ROWS) {
+            writeGroup();
+        }
+    }
+
+    void finish() {
+        if (rows > 0) {
+            writeGroup();
+        }
+        uint32_t endMarker[2] = {0, 0}; // Group header with no rows
+        out.write(endMarker, sizeof(endMarker));
+    }
+};
+
+// Row filter for exports. Zero or empty fields match everything.
+struct ExportFilter {
+    int fromDate; // Packed YYYYMMDD, inclusive
+    int toDate;
+    const char* source;
+    const char* destination;
+    int busId;
+    int sourceId;      // Set by resolve(): -1 for any city
+    int destinationId;
+
+    // Turn the city names into string IDs, so rows are matched without
+    // comparing text. A city the service has never seen matches nothing.
+    void resolve(ReservationService& service) {
+        sourceId = -1;
+        destinationId = -1;
+        if (source && source[0]) {
+            sourceId = service.findStringId(source);
+            if (sourceId < 0) {
+                sourceId = -2;
+            }
+        }
+        if (destination && destination[0]) {
+            destinationId = service.findStringId(destination);
+            if (destinationId < 0) {
+                destinationId = -2;
+            }
+        }
+    }
+
+    bool matches(int recordBusId, int recordSourceId, int recordDestinationId, int travelDate) const {
+        if (busId != 0 && recordBusId != busId) {
+            return false;
+        }
+        if (sourceId != -1 && recordSourceId != sourceId) {
+            return false;
+        }
+        if (destinationId != -1 && recordDestinationId != destinationId) {
+            return false;
+        }
+        return travelDate >= fromDate && travelDate <= toDate;
+    }
+};
+
+// Write matching tickets. Returns the number of rows written.
+template <typename Writer>
+long exportTickets(ReservationService& service, const ExportFilter& filter, Writer& writer, bool packDates) {
+    writer.addColumn("ticketId", COLUMN_INT32);
+    writer.addColumn("busId", COLUMN_INT32);
+    writer.addColumn("seatNumber", COLUMN_INT32);
+    writer.addColumn("name", COLUMN_STRING);
+    writer.addColumn("contactNumber", COLUMN_STRING);
+    writer.addColumn("age", COLUMN_INT32);
+    writer.addColumn("gender", COLUMN_STRING);
+    writer.addColumn("travelDate", packDates ? COLUMN_INT32 : COLUMN_STRING);
+    writer.addColumn("source", COLUMN_STRING);
+    writer.addColumn("destination", COLUMN_STRING);
+    writer.addColumn("fare", COLUMN_FLOAT64);
+    writer.addColumn("bookingDate", COLUMN_STRING);
+    writer.addColumn("status", COLUMN_STRING);
+    writer.beginRows();
+    
+    long rows = 0;
+    service.scanTickets([&](const Ticket& ticket) {
+        if (!filter.matches(ticket.busId, ticket.sourceId, ticket.destinationId, ticket.travelDate)) {
+            return;
+        }
+        writer.writeInt(ticket.ticketId);
+        writer.writeInt(ticket.busId);
+        writer.writeInt(ticket.seatNumber);
+        writer.writeString(ticket.passenger.name);
+        writer.writeString(ticket.passenger.contactNumber);
+        writer.writeInt(ticket.passenger.age);
+        writer.writeString(ticket.passenger.gender);
+        if (packDates) {
+            writer.writeInt(ticket.travelDate);
+        } else {
+            char travelDate[11];
+            formatDate(ticket.travelDate, travelDate);
+            writer.writeString(travelDate);
+        }
+        writer.writeString(service.stringText(ticket.sourceId));
+        writer.writeString(service.stringText(ticket.destinationId));
+        writer.writeDouble(ticket.fare);
+        char bookingDate[30];
+        formatDateTime(ticket.bookingTime, bookingDate);
+        writer.writeString(bookingDate);
+        writer.writeString(ticket.isBooked ? "Active" : "Cancelled");
+        writer.endRow();
+        rows++;
+    });
+    writer.finish();
+    return rows;
+}
+
+// Write matching active buses. Returns the number of rows written.
+template <typename Writer>
+long exportBuses(ReservationService& service, const ExportFilter& filter, Writer& writer, bool packDates) {
+    writer.addColumn("busId", COLUMN_INT32);
+    writer.addColumn("busNumber", COLUMN_STRING);
+    writer.addColumn("source", COLUMN_STRING);
+    writer.addColumn("destination", COLUMN_STRING);
+    writer.addColumn("travelDate", packDates ? COLUMN_INT32 : COLUMN_STRING);
+    writer.addColumn("departureTime", COLUMN_STRING);
+    writer.addColumn("arrivalTime", COLUMN_STRING);
+    writer.addColumn("totalSeats", COLUMN_INT32);
+    writer.addColumn("availableSeats", COLUMN_INT32);
+    writer.addColumn("ticketPrice", COLUMN_FLOAT64);
+    writer.beginRows();
+    
+    long rows = 0;
+    for (const Bus& bus : service.listBuses()) {
+        if (!filter.matches(bus.busId, bus.sourceId, bus.destinationId, packDate(bus.travelDate))) {
+            continue;
+        }
+        writer.writeInt(bus.busId);
+        writer.writeString(bus.busNumber);
+        writer.writeString(bus.source);
+        writer.writeString(bus.destination);
+        if (packDates) {
+            writer.writeInt(packDate(bus.travelDate));
+        } else {
+            writer.writeString(bus.travelDate);
+        }
+        writer.writeString(bus.departureTime);
+        writer.writeString(bus.arrivalTime);
+        writer.writeInt(bus.totalSeats);
+        writer.writeInt(bus.seats.available());
+        writer.writeDouble(bus.ticketPrice);
+        writer.endRow();
+        rows++;
+    }
+    writer.finish();
+    return rows;
+}
+
+// Write matching bills. Returns the number of rows written.
+template <typename Writer>
+long exportBills(ReservationService& service, const ExportFilter& filter, Writer& writer, bool packDates) {
+    writer.addColumn("billId", COLUMN_INT32);
+    writer.addColumn("busId", COLUMN_INT32);
+    writer.addColumn("busNumber", COLUMN_STRING);
+    writer.addColumn("source", COLUMN_STRING);
+    writer.addColumn("destination", COLUMN_STRING);
+    writer.addColumn("travelDate", packDates ? COLUMN_INT32 : COLUMN_STRING);
+    writer.addColumn("totalSeats", COLUMN_INT32);
+    writer.addColumn("passengerCount", COLUMN_INT32);
+    writer.addColumn("totalRevenue", COLUMN_FLOAT64);
+    writer.addColumn("generatedDate", COLUMN_STRING);
+    writer.beginRows();
+    
+    long rows = 0;
+    service.forEachBill([&](const BusBill& bill) {
+        if (!filter.matches(bill.busId, bill.sourceId, bill.destinationId, bill.travelDate)) {
+            return;
+        }
+        writer.writeInt(bill.billId);
+        writer.writeInt(bill.busId);
+        writer.writeString(service.stringText(bill.busNumberId));
+        writer.writeString(service.stringText(bill.sourceId));
+        writer.writeString(service.stringText(bill.destinationId));
+        if (packDates) {
+            writer.writeInt(bill.travelDate);
+        } else {
+            char travelDate[11];
+            formatDate(bill.travelDate, travelDate);
+            writer.writeString(travelDate);
+        }
+        writer.writeInt(bill.totalSeats);
+        writer.writeInt(bill.passengerCount);
+        writer.writeDouble(bill.totalRevenue);
+        char generatedDate[30];
+        formatDateTime(bill.generatedTime, generatedDate);
+        writer.writeString(generatedDate);
+        writer.endRow();
+        rows++;
+    });
+    writer.finish();
+    return rows;
+}
+
+// Export one kind of record with a writer
+template <typename Writer>
+long exportWith(ReservationService& service, const char* kind, const ExportFilter& filter,
+                Writer& writer, bool packDates) {
+    if (strcmp(kind, "tickets") == 0) {
+        return exportTickets(service, filter, writer, packDates);
+    } else if (strcmp(kind, "buses") == 0) {
+        return exportBuses(service, filter, writer, packDates);
+    }
+    return exportBills(service, filter, writer, packDates);
+}
+
+// Export tickets, buses or bills to CSV or the columnar format and print a
+// summary. Returns the process exit code.
+int runExport(ReservationService& service, const char* kind, bool columnar,
+              const char* path, ExportFilter filter) {
+    if (strcmp(kind, "tickets") != 0 && strcmp(kind, "buses") != 0 && strcmp(kind, "bills") != 0) {
+        cout << "Unknown export " << kind << ". Use tickets, buses or bills.\n";
+        return 1;
+    }
+    BufferedFile out;
+    if (!out.open(path)) {
+        cout << path << ": cannot create file\n";
+        return 1;
+    }
+    
+    auto startedAt = chrono::steady_clock::now();
+    filter.resolve(service);
+    long rows;
+    if (columnar) {
+        ColumnarWriter writer(out);
+        rows = exportWith(service, kind, filter, writer, true);
+    } else {
+        CsvWriter writer(out);
+        rows = exportWith(service, kind, filter, writer, false);
+    }
+    if (!out.close()) {
+        cout << path << ": write failed\n";
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startedAt).count();
+    printf("%s: exported %ld %s in %.3f s\n", path, rows, kind, seconds);
+    return 0;
+}
+
+// Print the revenue dashboard, or the per-route or per-day rollups.
+// Returns the process exit code.
+int runReport(ReservationService& service, const char* kind, int fromDate, int toDate) {
+    if (strcmp(kind, "dashboard") == 0) {
+        RevenueRollup totals = service.getSystemTotals();
+        printf("Revenue:        Rs. %.2f\n", totals.revenue);
+        printf("Passengers:     %d of %d seats (load factor %.1f%%)\n",
+               totals.passengers, totals.seats, totals.loadFactor() * 100);
+        printf("Bookings:       %ld (%ld cancelled)\n", totals.bookings, totals.cancellations);
+        return 0;
+    }
+    
+    if (strcmp(kind, "routes") == 0) {
+        printf("%-20s %-20s %14s %10s %8s %8s\n", "Source", "Destination", "Revenue", "Passengers", "Seats", "Load");
+        for (const RouteRevenue& route : service.routeReport()) {
+            printf("%-20s %-20s %14.2f %10d %8d %7.1f%%\n", route.source, route.destination,
+                   route.totals.revenue, route.totals.passengers, route.totals.seats,
+                   route.totals.loadFactor() * 100);
+        }
+        return 0;
+    }
+    
+    if (strcmp(kind, "days") == 0) {
+        printf("%-12s %14s %10s %8s %8s\n", "Travel Date", "Revenue", "Passengers", "Seats", "Load");
+        for (const DayRevenue& day : service.dayReport(fromDate, toDate)) {
+            char travelDate[11];
+            formatDate(day.date, travelDate);
+            printf("%-12s %14.2f %10d %8d %7.1f%%\n", travelDate, day.totals.revenue, day.totals.passengers,
+                   day.totals.seats, day.totals.loadFactor() * 100);
+        }
+        return 0;
+    }
+    
+    cout << "Unknown report " << kind << ". Use dashboard, routes or days.\n";
+    return 1;
+}
+
+// Render every operation's counters and latency quantiles, and the
+// service's gauges, in the Prometheus text exposition format
+string formatMetrics(ReservationService& service) {
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+    string text;
+    char line[256];
+    vector<OperationMetrics> operations;
+    for (int op = 0; op < METRIC_OPERATION_COUNT; op++) {
+        operations.push_back(metricsRegistry().collect((MetricOperation)op));
+    }
+    
+    text += "# TYPE bts_operation_calls_total counter\n";
+    for (int op = 0; op < METRIC_OPERATION_COUNT; op++) {
+        snprintf(line, sizeof(line), "bts_operation_calls_total{operation=\"%s\"} %llu\n",
+                 metricName((MetricOperation)op), (unsigned long long)operations[op].calls);
+        text += line;
+    }
+    text += "# TYPE bts_operation_failures_total counter\n";
+    for (int op = 0; op < METRIC_OPERATION_COUNT; op++) {
+        snprintf(line, sizeof(line), "bts_operation_failures_total{operation=\"%s\"} %llu\n",
+                 metricName((MetricOperation)op), (unsigned long long)operations[op].failures);
+        text += line;
+    }
+    text += "# TYPE bts_operation_latency_seconds summary\n";
+    for (int op = 0; op < METRIC_OPERATION_COUNT; op++) {
+        const OperationMetrics& metrics = operations[op];
+        const char* name = metricName((MetricOperation)op);
+        for (double q : quantiles) {
+            snprintf(line, sizeof(line), "bts_operation_latency_seconds{operation=\"%s\",quantile=\"%g\"} %.9f\n",
+                     name, q, metrics.quantile(q) / 1e9);
+            text += line;
+        }
+        snprintf(line, sizeof(line), "bts_operation_latency_seconds_sum{operation=\"%s\"} %.9f\n"
+                 "bts_operation_latency_seconds_count{operation=\"%s\"} %llu\n",
+                 name, metrics.totalNanos / 1e9, name, (unsigned long long)metrics.calls);
+        text += line;
+    }
+    
+    ServiceGauges gauges = service.gauges();
+    const struct {
+        const char* name;
+        long value;
+    } gaugeValues[] = {
+        {"bts_buses", gauges.buses},
+        {"bts_tickets", gauges.tickets},
+        {"bts_booked_tickets", gauges.bookedTickets},
+        {"bts_bills", gauges.bills},
+        {"bts_free_seats", gauges.freeSeats},
+        {"bts_held_seats", gauges.heldSeats},
+        {"bts_waitlisted", gauges.waitlisted},
+        {"bts_interned_strings", gauges.strings},
+        {"bts_free_slots", gauges.freeSlots},
+        {"bts_journal_bytes", gauges.journalBytes},
+        {"bts_replica_lag_bytes", gauges.replicaLagBytes},
+        {"bts_replica_lag_milliseconds", gauges.replicaLagMillis},
+        {"bts_replica_load_problems", gauges.replicaLoadProblems},
+    };
+    for (const auto& gauge : gaugeValues) {
+        snprintf(line, sizeof(line), "# TYPE %s gauge\n%s %ld\n", gauge.name, gauge.name, gauge.value);
+        text += line;
+    }
+    return text;
+}
+
+// Print the tickets or buses matching an ad-hoc query, then how long the
+// scan took. Returns the process exit code.
+int runQuery(ReservationService& service, const char* kind, const ScanQuery& query) {
+    bool forTickets = strcmp(kind, "tickets") == 0;
+    if (!forTickets && strcmp(kind, "buses") != 0) {
+        cout << "Unknown query " << kind << ". Use tickets or buses.\n";
+        return 1;
+    }
+    
+    auto startedAt = chrono::steady_clock::now();
+    vector<Ticket> tickets;
+    vector<Bus> buses;
+    if (forTickets) {
+        tickets = service.findTickets(query);
+    } else {
+        buses = service.findBuses(query);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startedAt).count();
+    
+    char travelDate[11];
+    if (forTickets) {
+        printf("%-8s %-6s %-5s %-20s %-11s %-15s %-15s %10s %s\n", "Ticket", "Bus", "Seat",
+               "Passenger", "Travel Date", "From", "To", "Fare", "Status");
+        for (const Ticket& ticket : tickets) {
+            formatDate(ticket.travelDate, travelDate);
+            printf("%-8d %-6d %-5d %-20s %-11s %-15s %-15s %10.2f %s\n", ticket.ticketId, ticket.busId,
+                   ticket.seatNumber, ticket.passenger.name, travelDate,
+                   service.stringText(ticket.sourceId), service.stringText(ticket.destinationId),
+                   ticket.fare, ticket.isBooked ? "Active" : "Cancelled");
+        }
+    } else {
+        printf("%-6s %-13s %-15s %-15s %-11s %-10s %5s %10s\n", "Bus", "Number", "From", "To",
+               "Travel Date", "Departure", "Free", "Price");
+        for (const Bus& bus : buses) {
+            printf("%-6d %-13s %-15s %-15s %-11s %-10s %5d %10.2f\n", bus.busId, bus.busNumber,
+                   bus.source, bus.destination, bus.travelDate, bus.departureTime,
+                   bus.seats.available(), bus.ticketPrice);
+        }
+    }
+    printf("%zu %s matched in %.2f ms (%s filters)\n", forTickets ? tickets.size() : buses.size(),
+           kind, seconds * 1000, simdLevelName(simdLevel));
+    return 0;
+}
+
+// Time the two ticket scans the service relies on, once over whole Ticket
+// records and once over the TicketCore half of a TicketStore: counting live
+// bookings per bus, and totalling booked fares per bus as a bill does.
+// Returns the process exit code.
+int runTicketBenchmark(int ticketCount) {
+    if (ticketCount < 1 || ticketCount > STORE_MAX_CHUNKS * STORE_CHUNK_SIZE) {
+        cout << "Ticket count must be between 1 and " << STORE_MAX_CHUNKS * STORE_CHUNK_SIZE << ".\n";
+        return 1;
+    }
+    const int busCount = max(1, ticketCount / MAX_SEATS);
+    RecordStore<Ticket> records;
+    TicketStore split;
+    unsigned int state = 1;
+    for (int i = 0; i < ticketCount; i++) {
+        state = state * 1103515245u + 12345u;
+        Ticket ticket;
+        memset(&ticket, 0, sizeof(ticket));
+        ticket.ticketId = 1001 + i;
+        ticket.busId = (int)((state >> 8) % busCount);
+        ticket.seatNumber = i % MAX_SEATS + 1;
+        snprintf(ticket.passenger.name, sizeof(ticket.passenger.name), "Passenger %d", i);
+        ticket.travelDate = 20300101;
+        ticket.bookingTime = 1900000000;
+        ticket.fare = 500 + (state >> 24);
+        ticket.isBooked = (state >> 4) % 10 != 0; // One in ten cancelled
+        records.push_back(ticket);
+        split.push_back(ticket);
+    }
+    
+    // Best of five runs, so the first pass warming the cache does not count
+    vector<int> liveCounts(busCount);
+    vector<double> fareTotals(busCount);
+    auto timeScan = [&](auto scan) {
+        double best = 1e30;
+        for (int run = 0; run < 5; run++) {
+            fill(liveCounts.begin(), liveCounts.end(), 0);
+            fill(fareTotals.begin(), fareTotals.end(), 0.0);
+            auto startedAt = chrono::steady_clock::now();
+            scan();
+            best = min(best, chrono::duration<double>(chrono::steady_clock::now() - startedAt).count());
+        }
+        return best;
+    };
+    
+    double liveWhole = timeScan([&]() {
+        for (int i = 0; i < records.size(); i++) {
+            const Ticket& ticket = records[i];
+            liveCounts[ticket.busId] += ticket.isBooked;
+        }
+    });
+    long liveCheck = accumulate(liveCounts.begin(), liveCounts.end(), 0L);
+    double liveSplit = timeScan([&]() {
+        for (int i = 0; i < split.size(); i++) {
+            const TicketCore& ticket = split.core(i);
+            liveCounts[ticket.busId] += ticket.isBooked;
+        }
+    });
+    bool liveSame = liveCheck == accumulate(liveCounts.begin(), liveCounts.end(), 0L);
+    
+    double fareWhole = timeScan([&]() {
+        for (int i = 0; i < records.size(); i++) {
+            const Ticket& ticket = records[i];
+            if (ticket.isBooked) {
+                fareTotals[ticket.busId] += ticket.fare;
             }
-            
-            if (compareString(username, USERNAME) && compareString(password, PASSWORD)) {
-                clearScreen();
-                displayHeader("LOGIN SUCCESSFUL");
-                cout << "\nWelcome to Bus Ticket Reservation System!\n";
-                cout << "Press Enter to continue...";
-                cin.ignore();
-                cin.get();
-                return true;
+        }
+    });
+    double fareCheck = accumulate(fareTotals.begin(), fareTotals.end(), 0.0);
+    double fareSplit = timeScan([&]() {
+        for (int i = 0; i < split.size(); i++) {
+            const TicketCore& ticket = split.core(i);
+            if (ticket.isBooked) {
+                fareTotals[ticket.busId] += ticket.fare;
+            }
+        }
+    });
+    bool fareSame = fareCheck == accumulate(fareTotals.begin(), fareTotals.end(), 0.0);
+    
+    printf("%d tickets on %d buses. Ticket: %zu bytes, TicketCore: %zu bytes\n",
+           ticketCount, busCount, sizeof(Ticket), sizeof(TicketCore));
+    printf("%-22s %12s %12s %8s\n", "Scan", "Ticket", "TicketCore", "Speedup");
+    printf("%-22s %9.2f ms %9.2f ms %7.2fx\n", "Live bookings per bus",
+           liveWhole * 1000, liveSplit * 1000, liveWhole / liveSplit);
+    printf("%-22s %9.2f ms %9.2f ms %7.2fx\n", "Booked fares per bus",
+           fareWhole * 1000, fareSplit * 1000, fareWhole / fareSplit);
+    if (!liveSame || !fareSame) {
+        cout << "Scan results differ between layouts.\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Benchmark settings
+struct BenchOptions {
+    int buses;
+    int routes;
+    long operations;     // Book, cancel and search calls across all threads
+    int threads;
+    double zipfExponent; // Skew of route popularity; 0 is uniform
+    unsigned int seed;
+    int rounds;          // Timed checkpoints and reloads
+    const char* directory; // Scratch directory for the benchmark's data files
+};
+
+// Read --buses, --routes, --operations, --threads, --zipf, --seed,
+// --rounds and --bench-dir
+BenchOptions parseBenchOptions(int argc, char* argv[]) {
+    BenchOptions options = {2000, 100, 200000, 4, 1.0, 42, 3, "bench-data"};
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--buses=", 8) == 0) {
+            options.buses = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--routes=", 9) == 0) {
+            options.routes = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--operations=", 13) == 0) {
+            options.operations = atol(argv[i] + 13);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            options.threads = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--zipf=", 7) == 0) {
+            options.zipfExponent = atof(argv[i] + 7);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            options.seed = (unsigned int)strtoul(argv[i] + 7, nullptr, 10);
+        } else if (strncmp(argv[i], "--rounds=", 9) == 0) {
+            options.rounds = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--bench-dir=", 12) == 0) {
+            options.directory = argv[i] + 12;
+        }
+    }
+    options.buses = max(1, options.buses);
+    options.routes = max(1, min(options.routes, options.buses));
+    options.operations = max(1L, options.operations);
+    options.threads = max(1, options.threads);
+    options.zipfExponent = max(0.0, options.zipfExponent);
+    options.rounds = max(1, options.rounds);
+    return options;
+}
+
+// Deterministic random source for the synthetic workload (splitmix64).
+// Route picks follow a Zipf distribution: route k is chosen with
+// probability proportional to 1 / (k + 1)^exponent, so low routes are hot.
+class WorkloadGenerator {
+private:
+    uint64_t state;
+    const vector<double>& routeCdf;
+
+public:
+    WorkloadGenerator(uint64_t seed, const vector<double>& cdf) : state(seed), routeCdf(cdf) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, n)
+    int below(int n) {
+        return (int)(next() % (uint64_t)n);
+    }
+
+    int hotRoute() {
+        double u = (double)(next() >> 11) / 9007199254740992.0; // [0, 1)
+        auto it = upper_bound(routeCdf.begin(), routeCdf.end(), u);
+        return it == routeCdf.end() ? (int)routeCdf.size() - 1 : (int)(it - routeCdf.begin());
+    }
+};
+
+// Cumulative Zipf probabilities for route ranks 0..routes-1
+vector<double> zipfCdf(int routes, double exponent) {
+    vector<double> cdf(routes);
+    double total = 0;
+    for (int k = 0; k < routes; k++) {
+        total += 1.0 / pow(k + 1.0, exponent);
+        cdf[k] = total;
+    }
+    for (double& value : cdf) {
+        value /= total;
+    }
+    return cdf;
+}
+
+// Latencies of one operation in nanoseconds, and how many calls failed
+struct BenchSamples {
+    vector<int64_t> latencies;
+    long failures;
+    uint64_t allocations; // Heap allocations made inside the timed calls
+};
+
+// What one benchmark thread measured
+struct BenchWorkerResult {
+    BenchSamples book;
+    BenchSamples cancel;
+    BenchSamples search;
+};
+
+// Time one call into samples; returns what the call returned
+template <typename Fn>
+auto timeCall(BenchSamples& samples, Fn call) -> decltype(call()) {
+    uint64_t allocatedBefore = threadHeapAllocations;
+    auto startedAt = chrono::steady_clock::now();
+    auto result = call();
+    int64_t nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - startedAt).count();
+    samples.allocations += threadHeapAllocations - allocatedBefore;
+    samples.latencies.push_back(nanos);
+    return result;
+}
+
+// Passenger booked by the benchmark
+Passenger benchPassenger() {
+    Passenger passenger;
+    memset(&passenger, 0, sizeof(passenger));
+    copyField(passenger.name, sizeof(passenger.name), "Bench Passenger");
+    copyField(passenger.contactNumber, sizeof(passenger.contactNumber), "9800000000");
+    passenger.age = 30;
+    copyField(passenger.gender, sizeof(passenger.gender), "F");
+    return passenger;
+}
+
+// Heap allocations made by this thread over cycles bookings and
+// cancellations on one bus, or -1 if one failed. The same cycles are run,
+// compacted and checkpointed first, so the stores and indexes have room.
+long steadyStateAllocations(ReservationService& service, int busId, int cycles) {
+    Passenger passenger = benchPassenger();
+    auto run = [&]() {
+        for (int i = 0; i < cycles; i++) {
+            OperationResult booked = service.reserveSeat(busId, 0, passenger);
+            if (booked.status != STATUS_OK || service.cancelReservation(booked.ticketId).status != STATUS_OK) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (!run()) {
+        return -1;
+    }
+    service.checkpoint();
+    uint64_t allocatedBefore = threadHeapAllocations;
+    if (!run()) {
+        return -1;
+    }
+    return (long)(threadHeapAllocations - allocatedBefore);
+}
+
+// One thread of the mixed workload: 55% bookings on a Zipf-chosen route,
+// 20% cancellations of a ticket this thread booked, 25% route searches.
+// Each thread draws from its own seeded generator, so the sequence of
+// calls is the same on every run.
+void runBenchWorker(ReservationService& service, const vector<vector<int>>& busesByRoute,
+                    const vector<string>& cities, const vector<double>& routeCdf,
+                    long operations, uint64_t seed, BenchWorkerResult& result) {
+    WorkloadGenerator generator(seed, routeCdf);
+    Passenger passenger = benchPassenger();
+    
+    result.book.failures = result.cancel.failures = result.search.failures = 0;
+    result.book.allocations = result.cancel.allocations = result.search.allocations = 0;
+    vector<int> heldTickets;
+    Arena searchArena;
+    for (long n = 0; n < operations; n++) {
+        int choice = generator.below(100);
+        int route = generator.hotRoute();
+        if (choice < 20 && !heldTickets.empty()) {
+            int pick = generator.below((int)heldTickets.size());
+            int ticketId = heldTickets[pick];
+            heldTickets[pick] = heldTickets.back();
+            heldTickets.pop_back();
+            OperationResult cancelled = timeCall(result.cancel, [&]() {
+                return service.cancelReservation(ticketId);
+            });
+            result.cancel.failures += cancelled.status != STATUS_OK;
+        } else if (choice < 75) {
+            const vector<int>& routeBuses = busesByRoute[route];
+            int busId = routeBuses[generator.below((int)routeBuses.size())];
+            OperationResult booked = timeCall(result.book, [&]() {
+                return service.reserveSeat(busId, 0, passenger);
+            });
+            if (booked.status == STATUS_OK) {
+                heldTickets.push_back(booked.ticketId);
             } else {
-                attempts++;
-                clearScreen();
-                displayHeader("LOGIN FAILED");
-                cout << "\nIncorrect username or password! " << (MAX_ATTEMPTS - attempts) << " attempts remaining.\n";
-                cout << "Press Enter to continue...";
-                cin.ignore();
-                cin.get();
+                result.book.failures++; // Usually a hot bus that is full
             }
+        } else {
+            size_t found = timeCall(result.search, [&]() {
+                searchArena.reset();
+                return service.searchRoute(searchArena, cities[route].c_str(), cities[route + 1].c_str()).size();
+            });
+            result.search.failures += found == 0;
         }
+    }
+}
 
-        clearScreen();
-        displayHeader("ACCESS DENIED");
-        cout << "\nToo many failed attempts. Program is closing.\n";
+// Summarise samples as one printed line and one results row
+void reportBench(CsvWriter& writer, const char* operation, BenchSamples& samples,
+                 double seconds, const BenchOptions& options) {
+    vector<int64_t>& latencies = samples.latencies;
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        if (latencies.empty()) {
+            return 0.0;
+        }
+        return latencies[min(latencies.size() - 1, (size_t)(p * latencies.size()))] / 1000.0;
+    };
+    double throughput = seconds > 0 ? latencies.size() / seconds : 0;
+    double allocationsPerCall = latencies.empty() ? 0 : (double)samples.allocations / latencies.size();
+    printf("%-10s %9zu %8ld %12.0f %10.1f %10.1f %10.1f %10.1f %12.1f %10.3f\n", operation, latencies.size(),
+           samples.failures, throughput, percentile(0.50), percentile(0.90), percentile(0.99),
+           percentile(0.999), latencies.empty() ? 0.0 : latencies.back() / 1000.0, allocationsPerCall);
+    
+    writer.writeString(operation);
+    writer.writeInt((int)latencies.size());
+    writer.writeInt((int)samples.failures);
+    writer.writeDouble(seconds);
+    writer.writeDouble(throughput);
+    writer.writeDouble(percentile(0.50));
+    writer.writeDouble(percentile(0.90));
+    writer.writeDouble(percentile(0.99));
+    writer.writeDouble(percentile(0.999));
+    writer.writeDouble(latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+    writer.writeDouble(allocationsPerCall);
+    writer.writeInt(options.threads);
+    writer.writeInt(options.buses);
+    writer.writeInt(options.routes);
+    writer.writeDouble(options.zipfExponent);
+    writer.writeInt((int)options.seed);
+    writer.endRow();
+}
+
+// Benchmark the reservation core in a scratch directory. Buses are spread
+// over the routes and 30 travel days. A mixed book/cancel/search workload
+// then runs on several threads, followed by timed checkpoints (saveData)
+// and reloads (loadData). Results go to stdout and, one row per operation,
+// to a CSV file with the columns
+//   operation, operations, failures, seconds, throughput,
+//   p50_us, p90_us, p99_us, p999_us, max_us, allocations_per_op,
+//   threads, buses, routes, zipf, seed
+// Returns the process exit code, which is 1 if bookings and cancellations
+// on a bus in steady state allocate from the heap.
+int runBenchmark(const char* resultsPath, const BenchOptions& options, FsyncPolicy fsyncPolicy) {
+    BufferedFile out;
+    if (!out.open(resultsPath)) {
+        cout << resultsPath << ": cannot create file\n";
+        return 1;
+    }
+    
+    // The benchmark owns its directory: start from empty data files
+#ifdef _WIN32
+    _mkdir(options.directory);
+    bool entered = _chdir(options.directory) == 0;
+#else
+    mkdir(options.directory, 0755);
+    bool entered = chdir(options.directory) == 0;
+#endif
+    if (!entered) {
+        cout << options.directory << ": cannot use as benchmark directory\n";
+        return 1;
+    }
+    for (const char* path : CHECKPOINT_FILES) {
+        remove(path);
+        remove((string(path) + ".tmp").c_str());
+    }
+    remove(JOURNAL_FILE);
+    remove(PREVIOUS_JOURNAL_FILE);
+    
+    // Route r runs from city r to city r + 1
+    vector<string> cities;
+    for (int i = 0; i <= options.routes; i++) {
+        cities.push_back("Bench City " + to_string(i));
+    }
+    time_t now = time(nullptr);
+    vector<Bus> newBuses(options.buses);
+    for (int i = 0; i < options.buses; i++) {
+        Bus& bus = newBuses[i];
+        memset(&bus, 0, sizeof(bus));
+        int route = i % options.routes;
+        snprintf(bus.busNumber, sizeof(bus.busNumber), "BENCH-%d", i);
+        copyField(bus.source, sizeof(bus.source), cities[route].c_str());
+        copyField(bus.destination, sizeof(bus.destination), cities[route + 1].c_str());
+        time_t travel = now + (time_t)(1 + (i / options.routes) % 30) * 86400;
+        struct tm day;
+#ifdef _WIN32
+        localtime_s(&day, &travel);
+#else
+        localtime_r(&travel, &day);
+#endif
+        formatDate((day.tm_year + 1900) * 10000 + (day.tm_mon + 1) * 100 + day.tm_mday, bus.travelDate);
+        copyField(bus.departureTime, sizeof(bus.departureTime), "08:00 AM");
+        copyField(bus.arrivalTime, sizeof(bus.arrivalTime), "02:30 PM");
+        bus.totalSeats = MAX_SEATS;
+        bus.ticketPrice = 500 + 10 * (route % 50);
+    }
+    
+    unique_ptr<ReservationService> service(new ReservationService(fsyncPolicy));
+    vector<vector<int>> busesByRoute(options.routes);
+    for (size_t i = 0; i < newBuses.size(); i += IMPORT_BATCH_SIZE) {
+        vector<Bus> batch(newBuses.begin() + i, newBuses.begin() + min(newBuses.size(), i + IMPORT_BATCH_SIZE));
+        vector<OperationResult> added = service->addBusBatch(batch);
+        for (size_t b = 0; b < added.size(); b++) {
+            if (added[b].status != STATUS_OK) {
+                cout << "Cannot create benchmark buses: " << statusMessage(added[b].status) << "\n";
+                return 1;
+            }
+            busesByRoute[(i + b) % options.routes].push_back(added[b].busId);
+        }
+    }
+    service->checkpoint();
+    
+    // Mixed workload
+    vector<double> routeCdf = zipfCdf(options.routes, options.zipfExponent);
+    vector<BenchWorkerResult> results(options.threads);
+    vector<thread> workers;
+    long perThread = options.operations / options.threads;
+    auto startedAt = chrono::steady_clock::now();
+    for (int t = 0; t < options.threads; t++) {
+        long operations = perThread + (t < options.operations % options.threads ? 1 : 0);
+        uint64_t seed = (uint64_t)options.seed * 1000003 + t;
+        workers.emplace_back(runBenchWorker, ref(*service), cref(busesByRoute), cref(cities),
+                             cref(routeCdf), operations, seed, ref(results[t]));
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    double workloadSeconds = chrono::duration<double>(chrono::steady_clock::now() - startedAt).count();
+    
+    // Steady-state booking on a bus of its own
+    Bus steadyBus = newBuses[0];
+    copyField(steadyBus.busNumber, sizeof(steadyBus.busNumber), "BENCH-STEADY");
+    OperationResult steadyAdded = service->addBusRecord(steadyBus);
+    long steadyAllocations = steadyAdded.status != STATUS_OK ? -1 :
+                             steadyStateAllocations(*service, steadyAdded.busId, BENCH_STEADY_CYCLES);
+    
+    BenchSamples book = {{}, 0, 0}, cancel = {{}, 0, 0}, search = {{}, 0, 0};
+    for (BenchWorkerResult& result : results) {
+        book.latencies.insert(book.latencies.end(), result.book.latencies.begin(), result.book.latencies.end());
+        cancel.latencies.insert(cancel.latencies.end(), result.cancel.latencies.begin(), result.cancel.latencies.end());
+        search.latencies.insert(search.latencies.end(), result.search.latencies.begin(), result.search.latencies.end());
+        book.failures += result.book.failures;
+        cancel.failures += result.cancel.failures;
+        search.failures += result.search.failures;
+        book.allocations += result.book.allocations;
+        cancel.allocations += result.cancel.allocations;
+        search.allocations += result.search.allocations;
+    }
+    
+    // Checkpoints of the state the workload left behind, then reloads of it
+    BenchSamples save = {{}, 0, 0}, load = {{}, 0, 0};
+    double saveSeconds = 0, loadSeconds = 0;
+    for (int round = 0; round < options.rounds; round++) {
+        timeCall(save, [&]() {
+            service->checkpoint();
+            return 0;
+        });
+        saveSeconds += save.latencies.back() / 1e9;
+    }
+    service.reset();
+    for (int round = 0; round < options.rounds; round++) {
+        timeCall(load, [&]() {
+            service.reset(new ReservationService(fsyncPolicy));
+            return 0;
+        });
+        loadSeconds += load.latencies.back() / 1e9;
+        load.failures += service->startupWarnings().empty() ? 0 : 1;
+        service.reset();
+    }
+    
+    printf("Buses: %d  Routes: %d  Zipf exponent: %.2f  Threads: %d  Seed: %u\n",
+           options.buses, options.routes, options.zipfExponent, options.threads, options.seed);
+    printf("Workload: %ld operations in %.3f s (%.0f operations/s)\n\n", options.operations,
+           workloadSeconds, options.operations / workloadSeconds);
+    printf("%-10s %9s %8s %12s %10s %10s %10s %10s %12s %10s\n", "Operation", "Count", "Failed",
+           "Per second", "p50 us", "p90 us", "p99 us", "p99.9 us", "Max us", "Allocs/op");
+    
+    CsvWriter writer(out);
+    const char* columns[] = {"operation", "operations", "failures", "seconds", "throughput",
+                             "p50_us", "p90_us", "p99_us", "p999_us", "max_us", "allocations_per_op",
+                             "threads", "buses", "routes", "zipf", "seed"};
+    for (const char* column : columns) {
+        writer.addColumn(column, COLUMN_STRING);
+    }
+    writer.beginRows();
+    reportBench(writer, "book", book, workloadSeconds, options);
+    reportBench(writer, "cancel", cancel, workloadSeconds, options);
+    reportBench(writer, "search", search, workloadSeconds, options);
+    reportBench(writer, "save", save, saveSeconds, options);
+    reportBench(writer, "load", load, loadSeconds, options);
+    writer.finish();
+    if (!out.close()) {
+        cout << resultsPath << ": write failed\n";
+        return 1;
+    }
+    printf("\nResults written to %s\n", resultsPath);
+    if (steadyAllocations != 0) {
+        printf("FAILED: steady-state bookings and cancellations %s\n",
+               steadyAllocations < 0 ? "did not complete" : "allocated from the heap");
+        return 1;
+    }
+    printf("Steady-state bookings and cancellations: no heap allocations in %d cycles\n", BENCH_STEADY_CYCLES);
+    return 0;
+}
+
+#ifdef __linux__
+// Set by SIGINT/SIGTERM to stop the server loop
+volatile sig_atomic_t serverStopRequested = 0;
+
+void requestServerStop(int) {
+    serverStopRequested = 1;
+}
+
+// Socket address given as unix:PATH, tcp:PORT or tcp:HOST:PORT
+struct SocketAddress {
+    sockaddr_storage storage;
+    socklen_t length;
+    bool isUnix;
+    char path[108];
+};
+
+// Parse a socket address. TCP addresses default to the loopback interface.
+bool parseSocketAddress(const char* text, SocketAddress& address) {
+    memset(&address, 0, sizeof(address));
+    if (strncmp(text, "unix:", 5) == 0) {
+        sockaddr_un* un = reinterpret_cast<sockaddr_un*>(&address.storage);
+        if (strlen(text + 5) == 0 || strlen(text + 5) >= sizeof(un->sun_path)) {
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, text + 5);
+        strcpy(address.path, text + 5);
+        address.length = sizeof(sockaddr_un);
+        address.isUnix = true;
+        return true;
+    }
+    if (strncmp(text, "tcp:", 4) != 0) {
+        return false;
+    }
+    
+    char host[64] = "127.0.0.1";
+    const char* port = text + 4;
+    const char* colon = strrchr(port, ':');
+    if (colon) {
+        if (colon - port >= (long)sizeof(host)) {
+            return false;
+        }
+        memcpy(host, port, colon - port);
+        host[colon - port] = '\0';
+        port = colon + 1;
+    }
+    int portNumber = atoi(port);
+    sockaddr_in* in = reinterpret_cast<sockaddr_in*>(&address.storage);
+    in->sin_family = AF_INET;
+    in->sin_port = htons((uint16_t)portNumber);
+    if (portNumber < 1 || portNumber > 65535 || inet_pton(AF_INET, host, &in->sin_addr) != 1) {
         return false;
     }
+    address.length = sizeof(sockaddr_in);
+    address.isUnix = false;
+    return true;
+}
 
-    // Show menu function
-    void showMenu() {
-        int choice;
-        do {
-            clearScreen();
-            displayHeader("BUS TICKET RESERVATION SYSTEM");
-            
-            cout << "\n";
-            cout << "============================================\n";
-            cout << "[]  1. Add New Bus                         []\n";
-            cout << "[]  2. View All Buses                      []\n";
-            cout << "[]  3. Search Bus                          []\n";
-            cout << "[]  4. Book Ticket                         []\n";
-            cout << "[]  5. View Ticket                         []\n";
-            cout << "[]  6. Cancel Ticket                       []\n";
-            cout << "[]  7. View All Bookings                   []\n";
-            cout << "[]  8. Delete Bus Record                   []\n";
-            cout << "[]  9. View Bus Bill History               []\n";
-            cout << "[]  10. Exit                               []\n";
-            cout << "============================================\n";
-            cout << "\nYour choice: ";
-            
-            // Invalid input handling
-            if (!(cin >> choice)) {
-                clearInputBuffer();
-                clearScreen();
-                displayHeader("INVALID INPUT");
-                cout << "\nPlease enter a number between 1 and 10.\n";
-                cout << "Press Enter to continue...";
-                cin.ignore();
-                cin.get();
+// Split a request line into tab-separated fields in place
+int splitFields(char* line, char* fields[], int maxFields) {
+    int count = 0;
+    fields[count++] = line;
+    for (char* p = line; *p && count < maxFields; p++) {
+        if (*p == '\t') {
+            *p = '\0';
+            fields[count++] = p + 1;
+        }
+    }
+    return count;
+}
+
+// Append an error response
+void writeError(string& out, OperationStatus status) {
+    char line[128];
+    snprintf(line, sizeof(line), "ERR\t%d\t%s\n", (int)status, statusMessage(status));
+    out += line;
+}
+
+// Read one response line from a blocking socket. Returns false on EOF.
+bool readResponseLine(int fd, string& buffer, size_t& start, string& line) {
+    while (true) {
+        size_t end = buffer.find('\n', start);
+        if (end != string::npos) {
+            line.assign(buffer, start, end - start);
+            start = end + 1;
+            return true;
+        }
+        buffer.erase(0, start);
+        start = 0;
+        char chunk[65536];
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            if (received < 0 && errno == EINTR) {
                 continue;
             }
+            return false;
+        }
+        buffer.append(chunk, received);
+    }
+}
 
-            switch (choice) {
-                case 1:
-                    clearScreen();
-                    addBus();
-                    cout << "\nPress Enter to continue...";
-                    cin.ignore();
-                    cin.get();
-                    break;
-                case 2:
-                    clearScreen();
-                    viewAllBuses();
-                    cout << "\nPress Enter to continue...";
-                    cin.ignore();
-                    cin.get();
-                    break;
-                case 3:
-                    clearScreen();
-                    searchBus();
-                    cout << "\nPress Enter to continue...";
-                    cin.ignore();
-                    cin.get();
-                    break;
-                case 4:
-                    clearScreen();
-                    bookTicket();
-                    cout << "\nPress Enter to continue...";
-                    cin.ignore();
-                    cin.get();
-                    break;
-                case 5:
-                    clearScreen();
-                    viewTicket();
-                    cout << "\nPress Enter to continue...";
-                    cin.ignore();
-                    cin.get();
-                    break;
-                case 6:
-                    clearScreen();
-                    cancelTicket();
-                    cout << "\nPress Enter to continue...";
-                    cin.ignore();
-                    cin.get();
-                    break;
-                case 7:
-                    clearScreen();
-                    viewAllBookings();
-                    cout << "\nPress Enter to continue...";
-                    cin.ignore();
-                    cin.get();
-                    break;
-                case 8:
-                    clearScreen();
-                    deleteBus();
-                    cout << "\nPress Enter to continue...";
-                    cin.ignore();
-                    cin.get();
-                    break;
-                case 9:
-                    clearScreen();
-                    viewBusBillHistory();
-                    cout << "\nPress Enter to continue...";
-                    cin.ignore();
-                    cin.get();
-                    break;
-                case 10:
-                    clearScreen();
-                    displayHeader("THANK YOU");
-                    cout << "\nExiting program... Thank you for using our service!\n";
-                    break;
-                default:
-                    clearScreen();
-                    displayHeader("INVALID CHOICE");
-                    cout << "\nPlease enter a number between 1 and 10.\n";
-                    cout << "Press Enter to continue...";
-                    cin.ignore();
-                    cin.get();
-            }
-        } while (choice != 0);
+// Send a whole buffer on a blocking socket
+bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// Connect a blocking socket to the server
+int connectToServer(const SocketAddress& address) {
+    int fd = socket(address.isUnix ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address.storage), address.length) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    if (!address.isUnix) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+// Router of a sharded deployment. Each shard is a server started with
+// --shard=K/N in a data directory of its own, so the IDs it hands out are
+// all K modulo N. The router adds a bus to the shard owning its route or
+// travel date, sends a request naming an ID to the shard owning that ID,
+// and fans out requests that span shards, merging the answers.
+//
+// Shard connections are non-blocking and share the server's epoll loop.
+// Each client's responses are released in request order as the shards
+// answer, so a slow shard holds up only the requests waiting on it. A
+// shard that fails, or leaves a response outstanding for
+// SHARD_RESPONSE_TIMEOUT_MS, is marked down. Its requests are then
+// answered with STATUS_SHARD_UNAVAILABLE at once, and it is reconnected
+// at most every SHARD_RETRY_MS.
+class ShardRouter {
+private:
+    typedef chrono::steady_clock Clock;
+
+    enum ShardState {
+        SHARD_DOWN,       // Reconnected once retryAt passes
+        SHARD_CONNECTING, // Connect in progress, until deadline
+        SHARD_CHECKING,   // Connected; waiting for the answer to SHARD until deadline
+        SHARD_UP
+    };
+
+    // How the response to a client request is put together
+    enum Merge {
+        MERGE_LOCAL, // Answered by the router itself
+        MERGE_ONE,   // One shard's response as it is
+        MERGE_LIST,  // OK count {fields}... from every shard, lists joined
+        MERGE_BUSES, // Joined like MERGE_LIST, in bus ID order
+        MERGE_STATS  // STATS from every shard, totals added up
+    };
+
+    // A client request and the shard responses it waits for
+    struct RoutedRequest {
+        Merge merge;
+        int pending;              // Shard responses still to come
+        bool unavailable;         // A shard it was sent to failed
+        vector<string> responses; // One per shard asked
+        string response;          // Complete once pending is 0
+    };
+    typedef shared_ptr<RoutedRequest> RequestPtr;
+
+    // A response a shard owes
+    struct Awaited {
+        RequestPtr request;
+        int client; // Connection the request came from
+        int slot;   // Index into request->responses
+        Clock::time_point sentAt;
+    };
+
+    // Connection to one shard
+    struct Shard {
+        SocketAddress address;
+        int fd;                  // -1 while down
+        ShardState state;
+        Clock::time_point retryAt; // Next reconnect while down, or the connect deadline
+        string output;           // Requests not yet sent
+        size_t outputSent;
+        bool wantWrite;          // Watching for writability
+        string input;            // Partial response line
+        deque<Awaited> awaited;  // In the order the shard answers
+        long forwarded;          // Requests sent, for metrics
+    };
+
+    vector<Shard> shards;
+    ShardKey shardBy;
+    int epollFd;
+    unordered_map<int, deque<RequestPtr>> clients; // Client fd -> its requests in order
+
+    // Shard owning a bus, ticket, waitlist or hold ID
+    int shardOfId(const char* id) const {
+        int count = (int)shards.size();
+        return (atoi(id) % count + count) % count;
+    }
+
+    // Shard owning the buses of a route
+    int shardOfRoute(const char* source, const char* destination) const {
+        uint32_t hash = computeChecksum(source, strlen(source));
+        hash = computeChecksum(destination, strlen(destination), computeChecksum("\t", 1, hash));
+        return (int)(hash % shards.size());
+    }
+
+    // Shard owning the buses of a DD/MM/YYYY date. Consecutive days go to
+    // consecutive shards, so a busy week is spread over all of them. A
+    // malformed date goes to shard 0, which rejects it.
+    int shardOfDate(const char* date) const {
+        int packed = packDate(date);
+        if (packed == 0) {
+            return 0;
+        }
+        // Days since 1 March of year 0 in the proleptic Gregorian calendar
+        int year = packed / 10000, month = packed / 100 % 100, day = packed % 100;
+        if (month <= 2) {
+            year--;
+            month += 12;
+        }
+        long days = year * 365L + year / 4 - year / 100 + year / 400 + (153 * (month - 3) + 2) / 5 + day - 1;
+        return (int)(days % (long)shards.size());
     }
 
-    // Add new bus function
-    void addBus() {
-        if (busCount >= MAX_BUSES) {
-            cout << "Maximum bus limit reached!\n";
+    // The answer a shard gives to SHARD when it is the shard expected
+    string expectedShardLine(int index) const {
+        return "OK\t" + to_string(index) + "\t" + to_string(shards.size());
+    }
+
+    // Watch a shard's socket, for writability too while output is queued
+    void watchShard(Shard& shard, int operation) {
+        shard.wantWrite = shard.state == SHARD_CONNECTING || shard.outputSent < shard.output.size();
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLRDHUP | (shard.wantWrite ? (uint32_t)EPOLLOUT : 0u);
+        event.data.fd = shard.fd;
+        epoll_ctl(epollFd, operation, shard.fd, &event);
+    }
+
+    // Complete a request whose last shard response is in
+    void finish(RoutedRequest& request) {
+        if (request.unavailable) {
+            writeError(request.response, STATUS_SHARD_UNAVAILABLE);
             return;
         }
-        
-        Bus newBus;
-        clearInputBuffer();
-        
-        cout << "\n========== ADD NEW BUS ==========\n";
-        newBus.busId = nextBusId++;
-        
-        cout << "Bus Number: ";
-        cin.getline(newBus.busNumber, 20);
-        
-        // Check if bus number already exists
-        for (int i = 0; i < busCount; i++) {
-            if (compareString(buses[i].busNumber, newBus.busNumber) && buses[i].isActive) {
-                cout << "This bus number already exists!\n";
-                return;
-            }
+        if (request.merge == MERGE_ONE) {
+            request.response = request.responses[0] + "\n";
+            return;
         }
-        
-        cout << "Source: ";
-        cin.getline(newBus.source, 50);
-        
-        cout << "Destination: ";
-        cin.getline(newBus.destination, 50);
+        auto failed = find_if(request.responses.begin(), request.responses.end(),
+                              [](const string& response) { return response.compare(0, 3, "OK\t") != 0; });
+        if (failed != request.responses.end()) {
+            request.response = *failed + "\n";
+        } else if (request.merge == MERGE_STATS) {
+            request.response = addStats(request.responses);
+        } else {
+            request.response = joinLists(request.responses, request.merge == MERGE_BUSES ? 7 : 3,
+                                         request.merge == MERGE_BUSES);
+        }
+        if (request.response.empty()) {
+            writeError(request.response, STATUS_SHARD_UNAVAILABLE);
+        }
+    }
 
-        // Travel date with validation
-        bool validDate = false;
-        while (!validDate) {
-            cout << "Travel Date (DD/MM/YYYY): ";
-            cin.getline(newBus.travelDate, 11);
-            
-            if (isValidFutureDate(newBus.travelDate)) {
-                validDate = true;
+    // Record one shard response for a request
+    void deliver(Awaited& awaited, const string* response, vector<int>& ready) {
+        RoutedRequest& request = *awaited.request;
+        if (response) {
+            request.responses[awaited.slot] = *response;
+        } else {
+            request.unavailable = true;
+        }
+        if (--request.pending == 0) {
+            finish(request);
+            ready.push_back(awaited.client);
+        }
+    }
+
+    // Take a shard down: every response it owes fails, and it is
+    // reconnected after SHARD_RETRY_MS
+    void failShard(Shard& shard, vector<int>& ready) {
+        if (shard.fd != -1) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, shard.fd, nullptr);
+            ::close(shard.fd);
+            shard.fd = -1;
+        }
+        for (Awaited& awaited : shard.awaited) {
+            deliver(awaited, nullptr, ready);
+        }
+        shard.awaited.clear();
+        shard.output.clear();
+        shard.outputSent = 0;
+        shard.input.clear();
+        shard.state = SHARD_DOWN;
+        shard.retryAt = Clock::now() + chrono::milliseconds(SHARD_RETRY_MS);
+    }
+
+    // Start connecting to a shard that is down
+    void startConnect(Shard& shard, vector<int>& ready) {
+        shard.fd = socket(shard.address.isUnix ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (shard.fd < 0) {
+            failShard(shard, ready);
+            return;
+        }
+        if (!shard.address.isUnix) {
+            int on = 1;
+            setsockopt(shard.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        int connected = connect(shard.fd, reinterpret_cast<const sockaddr*>(&shard.address.storage),
+                                shard.address.length);
+        if (connected != 0 && errno != EINPROGRESS) {
+            failShard(shard, ready);
+            return;
+        }
+        shard.state = connected == 0 ? SHARD_CHECKING : SHARD_CONNECTING;
+        shard.retryAt = Clock::now() + chrono::milliseconds(SHARD_RETRY_MS);
+        if (shard.state == SHARD_CHECKING) {
+            shard.output = "SHARD\n";
+        }
+        watchShard(shard, EPOLL_CTL_ADD);
+    }
+
+    // Send as much queued output as the shard's socket takes
+    void sendShard(Shard& shard, vector<int>& ready) {
+        while (shard.outputSent < shard.output.size()) {
+            ssize_t sent = send(shard.fd, shard.output.data() + shard.outputSent,
+                                shard.output.size() - shard.outputSent, MSG_NOSIGNAL);
+            if (sent > 0) {
+                shard.outputSent += sent;
+            } else if (sent < 0 && errno == EINTR) {
+                continue;
+            } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
             } else {
-                cout << "Error: Please enter a valid date in DD/MM/YYYY format. The date must be today or a future date.\n";
+                failShard(shard, ready);
+                return;
             }
         }
-        
-        // Departure time with AM/PM
-        char tempTime[10];
-        char ampm[3];
-        cout << "Departure Time (HH:MM): ";
-        cin.getline(tempTime, 10);
-        cout << "AM/PM: ";
-        cin.getline(ampm, 3);
-        
-        // Combine time with AM/PM
-        snprintf(newBus.departureTime, sizeof(newBus.departureTime), "%s %s", tempTime, ampm);
-        
-        // Arrival time with AM/PM
-        cout << "Arrival Time (HH:MM): ";
-        cin.getline(tempTime, 10);
-        cout << "AM/PM: ";
-        cin.getline(ampm, 3);
-        
-        // Combine time with AM/PM
-        snprintf(newBus.arrivalTime, sizeof(newBus.arrivalTime), "%s %s", tempTime, ampm);
-        
-        cout << "Total Seats: ";
-        cin >> newBus.totalSeats;
-        
-        if (newBus.totalSeats > MAX_SEATS) {
-            cout << "Maximum seat limit is " << MAX_SEATS << "!\n";
-            newBus.totalSeats = MAX_SEATS;
+        if (shard.outputSent == shard.output.size()) {
+            shard.output.clear();
+            shard.outputSent = 0;
         }
-        
-        cout << "Ticket Price: ";
-        cin >> newBus.ticketPrice;
-        
-        // Initialize all seats as available
-        for (int i = 0; i < newBus.totalSeats; i++) {
-            newBus.seatAvailability[i] = true;
+        if (shard.wantWrite != !shard.output.empty()) {
+            watchShard(shard, EPOLL_CTL_MOD);
         }
-        
-        newBus.isActive = true;
-        buses[busCount++] = newBus;
-        cout << "\nBus added successfully with ID: " << newBus.busId << "\n";
     }
 
-    // View all buses function
-    void viewAllBuses() {
-        cout << "\n========== ALL BUSES ==========\n";
-        
-        bool found = false;
-        for (int i = 0; i < busCount; i++) {
-            if (buses[i].isActive) {
-                found = true;
-                break;
+    // Read what a shard has answered and hand each response to its request
+    void readShard(Shard& shard, int index, vector<int>& ready) {
+        char buffer[65536];
+        bool closed = false;
+        while (true) {
+            ssize_t received = recv(shard.fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                shard.input.append(buffer, received);
+                continue;
+            }
+            if (received < 0 && errno == EINTR) {
+                continue;
             }
+            closed = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
         }
         
-        if (!found) {
-            cout << "No buses available.\n";
+        size_t start = 0, end;
+        while ((end = shard.input.find('\n', start)) != string::npos) {
+            string line = shard.input.substr(start, end - start);
+            start = end + 1;
+            if (shard.state == SHARD_CHECKING) {
+                if (line != expectedShardLine(index)) {
+                    failShard(shard, ready); // Started with a different --shard
+                    return;
+                }
+                shard.state = SHARD_UP;
+            } else if (!shard.awaited.empty()) {
+                deliver(shard.awaited.front(), &line, ready);
+                shard.awaited.pop_front();
+            }
+        }
+        shard.input.erase(0, start);
+        if (closed) {
+            failShard(shard, ready);
+        }
+    }
+
+    // Queue a request line for a shard
+    void queueFor(int index, const string& line, const RequestPtr& request, int client, int slot) {
+        Shard& shard = shards[index];
+        shard.output += line;
+        shard.forwarded++;
+        shard.awaited.push_back(Awaited{request, client, slot, Clock::now()});
+    }
+
+    // Route a request to one shard, or answer it at once if the shard is down
+    void forward(const string& line, int index, const RequestPtr& request, int client) {
+        request->merge = MERGE_ONE;
+        if (shards[index].state != SHARD_UP) {
+            writeError(request->response, STATUS_SHARD_UNAVAILABLE);
             return;
         }
-        
-        cout << "ID    Bus Number    Source          Destination     Travel Date    Departure    Arrival      Total Seats  Available    Price\n";
-        cout << "----------------------------------------------------------------------------------------------------------------\n";
-        
-        for (int i = 0; i < busCount; i++) {
-            if (buses[i].isActive) {
-                int availableSeats = countAvailableSeats(buses[i]);
-                
-                printf("%-5d %-13s %-15s %-15s %-14s %-12s %-12s %-12d %-12d %.2f\n", 
-                       buses[i].busId, buses[i].busNumber, buses[i].source, buses[i].destination,
-                       buses[i].travelDate, buses[i].departureTime, buses[i].arrivalTime, 
-                       buses[i].totalSeats, availableSeats, buses[i].ticketPrice);
+        request->responses.resize(1);
+        request->pending = 1;
+        queueFor(index, line, request, client, 0);
+    }
+
+    // Route a request to every shard, or answer it at once if one is down
+    void fanOut(const string& line, Merge merge, const RequestPtr& request, int client) {
+        request->merge = merge;
+        for (const Shard& shard : shards) {
+            if (shard.state != SHARD_UP) {
+                writeError(request->response, STATUS_SHARD_UNAVAILABLE);
+                return;
             }
         }
+        request->responses.resize(shards.size());
+        request->pending = (int)shards.size();
+        for (int i = 0; i < (int)shards.size(); i++) {
+            queueFor(i, line, request, client, i);
+        }
     }
 
-    // Search bus function
-    void searchBus() {
-        int choice;
-        clearInputBuffer();
-        
-        cout << "\n========== SEARCH BUS ==========\n";
-        cout << "Search by:\n";
-        cout << "1. Source and Destination\n";
-        cout << "2. Bus Number\n";
-        cout << "Your choice: ";
-        cin >> choice;
-        
-        clearInputBuffer();
-        
-        if (choice == 1) {
-            char source[50], destination[50];
-            cout << "Enter Source: ";
-            cin.getline(source, 50);
-            cout << "Enter Destination: ";
-            cin.getline(destination, 50);
-            
-            bool found = false;
-            cout << "\n----- Buses from " << source << " to " << destination << " -----\n";
-            
-            cout << "ID    Bus Number    Departure      Arrival        Available    Price\n";
-            cout << "----------------------------------------------------------------\n";
-            
-            for (int i = 0; i < busCount; i++) {
-                if (buses[i].isActive && compareString(buses[i].source, source) && compareString(buses[i].destination, destination)) {
-                    found = true;
-                    int availableSeats = countAvailableSeats(buses[i]);
-                    
-                    printf("%-5d %-13s %-15s %-15s %-12d %.2f\n", 
-                           buses[i].busId, buses[i].busNumber, buses[i].departureTime, 
-                           buses[i].arrivalTime, availableSeats, buses[i].ticketPrice);
-                }
+    // Join OK count {fields}... responses, each entry being width fields
+    static string joinLists(const vector<string>& responses, int width, bool byBusId) {
+        long total = 0;
+        vector<pair<int, string>> entries;
+        string joined;
+        for (const string& response : responses) {
+            total += atol(response.c_str() + 3);
+            size_t start = response.find('\t', 3);
+            if (start == string::npos) {
+                continue;
             }
-            
-            if (!found) {
-                cout << "No buses found for the specified route.\n";
+            if (!byBusId) {
+                joined.append(response, start, string::npos);
+                continue;
             }
-        } else if (choice == 2) {
-            char busNumber[20];
-            cout << "Enter Bus Number: ";
-            cin.getline(busNumber, 20);
-            
-            bool found = false;
-            
-            for (int i = 0; i < busCount; i++) {
-                if (buses[i].isActive && compareString(buses[i].busNumber, busNumber)) {
-                    found = true;
-                    int availableSeats = countAvailableSeats(buses[i]);
-                    
-                    cout << "\n----- Bus Details -----\n";
-                    cout << "Bus ID: " << buses[i].busId << endl;
-                    cout << "Bus Number: " << buses[i].busNumber << endl;
-                    cout << "Route: " << buses[i].source << " to " << buses[i].destination << endl;
-                    cout << "Departure Time: " << buses[i].departureTime << endl;
-                    cout << "Arrival Time: " << buses[i].arrivalTime << endl;
-                    cout << "Total Seats: " << buses[i].totalSeats << endl;
-                    cout << "Available Seats: " << availableSeats << endl;
-                    cout << "Ticket Price: " << buses[i].ticketPrice << endl;
-                    break;
+            while (start < response.size()) {
+                size_t end = start;
+                for (int f = 0; f < width && end != string::npos; f++) {
+                    end = response.find('\t', end + 1);
                 }
+                end = end == string::npos ? response.size() : end;
+                entries.emplace_back(atoi(response.c_str() + start + 1), response.substr(start, end - start));
+                start = end;
             }
-            
-            if (!found) {
-                cout << "Bus with number " << busNumber << " not found.\n";
+        }
+        sort(entries.begin(), entries.end());
+        for (const auto& entry : entries) {
+            joined += entry.second;
+        }
+        return "OK\t" + to_string(total) + joined + "\n";
+    }
+
+    // Add up STATS responses. Returns an empty string if one is malformed.
+    static string addStats(const vector<string>& responses) {
+        RevenueRollup totals;
+        memset(&totals, 0, sizeof(totals));
+        for (const string& response : responses) {
+            double revenue, loadFactor;
+            int passengers, seats;
+            long bookings, cancellations;
+            if (sscanf(response.c_str(), "OK\t%lf\t%d\t%d\t%lf\t%ld\t%ld", &revenue, &passengers, &seats,
+                       &loadFactor, &bookings, &cancellations) != 6) {
+                return string();
             }
-        } else {
-            cout << "Invalid choice!\n";
+            totals.revenue += revenue;
+            totals.passengers += passengers;
+            totals.seats += seats;
+            totals.bookings += bookings;
+            totals.cancellations += cancellations;
         }
+        char response[256];
+        snprintf(response, sizeof(response), "OK\t%.2f\t%d\t%d\t%.4f\t%ld\t%ld\n",
+                 totals.revenue, totals.passengers, totals.seats, totals.loadFactor(),
+                 (long)totals.bookings, (long)totals.cancellations);
+        return response;
     }
 
-    // Book ticket function
-    void bookTicket() {
-        clearScreen();
-        displayHeader("BOOK TICKET");
-        
-        int busId;
-        
-        // Show all buses
-        viewAllBuses();
-        
-        bool found = false;
-        for (int i = 0; i < busCount; i++) {
-            if (buses[i].isActive) {
-                found = true;
-                break;
+    // Whether a command's first argument is a bus, ticket, waitlist or hold ID
+    static bool isIdCommand(const char* command) {
+        static const char* const commands[] = {
+            "BOOK", "WAIT", "HOLD", "BUS", "WAITLIST", "DELBUS", "CANCEL", "TICKET", "UNWAIT", "CONFIRM", "RELEASE",
+        };
+        for (const char* idCommand : commands) {
+            if (strcmp(command, idCommand) == 0) {
+                return true;
             }
         }
-        
-        if (!found) {
-            cout << "\nNo buses available. Press Enter to return to main menu...";
-            cin.ignore();
-            cin.get();
-            return;
+        return false;
+    }
+
+public:
+    ShardRouter(const vector<SocketAddress>& addresses, ShardKey key) : shardBy(key), epollFd(-1) {
+        for (const SocketAddress& address : addresses) {
+            shards.push_back(Shard{address, -1, SHARD_DOWN, Clock::now(), string(), 0, false, string(),
+                                   deque<Awaited>(), 0});
         }
-        
-        // Get travel details first
-        clearInputBuffer();
-        cout << "\n----- Travel Details -----\n";
-        
-        // Travel date with validation
-        bool validDate = false;
-        char requestedDate[11];
-        
-        while (!validDate) {
-            cout << "Travel Date (DD/MM/YYYY): ";
-            cin.getline(requestedDate, 11);
-            
-            if (isValidFutureDate(requestedDate)) {
-                validDate = true;
-            } else {
-                cout << "Error: Please enter a valid date in DD/MM/YYYY format. The date must be today or a future date.\n";
+    }
+
+    ~ShardRouter() {
+        for (Shard& shard : shards) {
+            if (shard.fd != -1) {
+                ::close(shard.fd);
             }
         }
+    }
+
+    // Connect to every shard, blocking, and check with the SHARD command
+    // that each serves the slice of IDs the router expects. Returns an
+    // error message, or an empty string.
+    string connectAll() {
+        for (int i = 0; i < (int)shards.size(); i++) {
+            Shard& shard = shards[i];
+            shard.fd = connectToServer(shard.address);
+            if (shard.fd < 0) {
+                return "shard " + to_string(i) + ": cannot connect";
+            }
+            string buffer, line;
+            size_t start = 0;
+            if (!sendAll(shard.fd, "SHARD\n") || !readResponseLine(shard.fd, buffer, start, line)) {
+                return "shard " + to_string(i) + ": no answer to SHARD";
+            }
+            if (line != expectedShardLine(i)) {
+                return "shard " + to_string(i) + ": started with a different --shard";
+            }
+            fcntl(shard.fd, F_SETFL, fcntl(shard.fd, F_GETFL) | O_NONBLOCK);
+            shard.state = SHARD_UP;
+        }
+        return string();
+    }
+
+    // Join the server's epoll loop
+    void attach(int serverEpollFd) {
+        epollFd = serverEpollFd;
+        for (Shard& shard : shards) {
+            if (shard.fd != -1) {
+                watchShard(shard, EPOLL_CTL_ADD);
+            }
+        }
+    }
+
+    // Whether a descriptor is a shard connection
+    bool isShard(int fd) const {
+        for (const Shard& shard : shards) {
+            if (shard.fd == fd) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Queue one request line from a client for the shards that can answer
+    // it. The line is split in place. Call flush() once the client's
+    // requests are queued.
+    void route(int client, char* line) {
+        string request = string(line) + "\n";
+        char* fields[SERVER_MAX_FIELDS];
+        int count = splitFields(line, fields, SERVER_MAX_FIELDS);
+        const char* command = fields[0];
+        RequestPtr routed = make_shared<RoutedRequest>();
+        routed->merge = MERGE_LOCAL;
+        routed->pending = 0;
+        routed->unavailable = false;
+        clients[client].push_back(routed);
         
-        cout << "Source: ";
-        char requestedSource[50];
-        cin.getline(requestedSource, 50);
-        
-        cout << "Destination: ";
-        char requestedDestination[50];
-        cin.getline(requestedDestination, 50);
-        
-        // Show available buses for the requested date and route
-        cout << "\nAvailable Buses for " << requestedDate << " from " << requestedSource << " to " << requestedDestination << ":\n";
-        
-        cout << "+------+-------------+-----------+-----------+-----------+--------+\n";
-        cout << "| ID   | Bus Number  | Departure | Arrival   | Available | Price  |\n";
-        cout << "+------+-------------+-----------+-----------+-----------+--------+\n";
-        
-        bool busesFound = false;
-        for (int i = 0; i < busCount; i++) {
-            if (buses[i].isActive && 
-                compareString(buses[i].travelDate, requestedDate) &&
-                compareString(buses[i].source, requestedSource) &&
-                compareString(buses[i].destination, requestedDestination)) {
-                
-                busesFound = true;
-                int availableSeats = countAvailableSeats(buses[i]);
-                
-                printf("| %-4d | %-11s | %-9s | %-9s | %-9d | %-6.2f |\n", 
-                       buses[i].busId, buses[i].busNumber, buses[i].departureTime, 
-                       buses[i].arrivalTime, availableSeats, buses[i].ticketPrice);
-                
-                cout << "+------+-------------+-----------+-----------+-----------+--------+\n";
+        if (strcmp(command, "PING") == 0) {
+            routed->response = "OK\n";
+        } else if (strcmp(command, "METRICS") == 0 && count == 1) {
+            string text = formatMetrics();
+            routed->response = "OK\t" + to_string(count_if(text.begin(), text.end(), [](char c) { return c == '\n'; })) +
+                               "\n" + text;
+        } else if ((isIdCommand(command) || strcmp(command, "STATS") == 0) && count >= 2) {
+            forward(request, shardOfId(fields[1]), routed, client);
+        } else if (strcmp(command, "ADDBUS") == 0 && count == 9) {
+            forward(request, shardBy == SHARD_BY_ROUTE ? shardOfRoute(fields[2], fields[3]) : shardOfDate(fields[4]),
+                    routed, client);
+        } else if (strcmp(command, "GROUP") == 0 && count >= 8 && (count - 2) % 6 == 0) {
+            // Only one shard can book the whole group atomically
+            int owner = shardOfId(fields[2]);
+            for (int i = 8; i < count; i += 6) {
+                if (shardOfId(fields[i]) != owner) {
+                    writeError(routed->response, STATUS_CROSS_SHARD);
+                    return;
+                }
+            }
+            forward(request, owner, routed, client);
+        } else if (strcmp(command, "SEARCH") == 0 && (count == 3 || count == 5)) {
+            if (shardBy == SHARD_BY_ROUTE) {
+                forward(request, shardOfRoute(fields[1], fields[2]), routed, client);
+            } else if (count == 5 && strcmp(fields[3], fields[4]) == 0) {
+                forward(request, shardOfDate(fields[3]), routed, client);
+            } else {
+                fanOut(request, MERGE_LIST, routed, client);
+            }
+        } else if (strcmp(command, "PLAN") == 0 && count >= 4 && count <= 6) {
+            // Journeys change between routes, so only a date's shard has every leg
+            if (shardBy == SHARD_BY_DATE) {
+                forward(request, shardOfDate(fields[3]), routed, client);
+            } else {
+                writeError(routed->response, STATUS_CROSS_SHARD);
             }
+        } else if (strcmp(command, "BUSES") == 0 && count == 1) {
+            fanOut(request, MERGE_BUSES, routed, client);
+        } else if (strcmp(command, "STATS") == 0 && count == 1) {
+            fanOut(request, MERGE_STATS, routed, client);
+        } else {
+            writeError(routed->response, STATUS_BAD_REQUEST);
         }
-        
-        if (!busesFound) {
-            cout << "No buses available for the specified date and route.\n";
-            cout << "Press Enter to return to main menu...";
-            cin.ignore();
-            cin.get();
-            return;
+    }
+
+    // Start sending the queued requests, one write per shard. Clients
+    // whose requests failed go into ready.
+    void flush(vector<int>& ready) {
+        for (Shard& shard : shards) {
+            if (shard.state == SHARD_UP && !shard.output.empty() && !shard.wantWrite) {
+                sendShard(shard, ready);
+            }
         }
-        
-        // Now ask for bus ID
-        cout << "\nEnter Bus ID: ";
-        cin >> busId;
-        
-        // Find the bus
-        int busIndex = findBusById(busId);
-        
-        if (busIndex == -1) {
-            cout << "Bus with ID " << busId << " not found.\n";
-            cout << "Press Enter to return to main menu...";
-            cin.ignore();
-            cin.get();
+    }
+
+    // Handle readiness of a shard connection. Clients with responses
+    // completed go into ready.
+    void handleShardEvent(int fd, uint32_t events, vector<int>& ready) {
+        for (int i = 0; i < (int)shards.size(); i++) {
+            Shard& shard = shards[i];
+            if (shard.fd != fd) {
+                continue;
+            }
+            if (shard.state == SHARD_CONNECTING) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0 ||
+                    (events & (EPOLLERR | EPOLLHUP))) {
+                    failShard(shard, ready);
+                    return;
+                }
+                shard.state = SHARD_CHECKING;
+                shard.output = "SHARD\n";
+            }
+            if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                readShard(shard, i, ready);
+            }
+            if (shard.fd != -1 && (shard.wantWrite || !shard.output.empty())) {
+                sendShard(shard, ready);
+            }
             return;
         }
-        
-        // Verify that the bus matches the requested details
-        if (!compareString(buses[busIndex].travelDate, requestedDate) ||
-            !compareString(buses[busIndex].source, requestedSource) ||
-            !compareString(buses[busIndex].destination, requestedDestination)) {
-            cout << "Selected bus does not match the requested travel details.\n";
-            cout << "Press Enter to return to main menu...";
-            cin.ignore();
-            cin.get();
-            return;
+    }
+
+    // Reconnect shards that are due, and take down shards that missed a
+    // deadline. Clients whose requests failed go into ready.
+    void tick(vector<int>& ready) {
+        Clock::time_point now = Clock::now();
+        for (int i = 0; i < (int)shards.size(); i++) {
+            Shard& shard = shards[i];
+            if (shard.state == SHARD_DOWN && now >= shard.retryAt) {
+                startConnect(shard, ready);
+            } else if ((shard.state == SHARD_CONNECTING || shard.state == SHARD_CHECKING) && now >= shard.retryAt) {
+                failShard(shard, ready);
+            } else if (shard.state == SHARD_UP && !shard.awaited.empty() &&
+                       now - shard.awaited.front().sentAt > chrono::milliseconds(SHARD_RESPONSE_TIMEOUT_MS)) {
+                failShard(shard, ready); // Hung: stop holding its clients up
+            }
         }
-        
-        Bus& selectedBus = buses[busIndex];
-        
-        // Check if seats are available
-        int availableSeats = countAvailableSeats(selectedBus);
-        if (availableSeats == 0) {
-            cout << "Sorry, no seats available for this bus.\n";
-            cout << "Press Enter to return to main menu...";
-            cin.ignore();
-            cin.get();
+    }
+
+    // Append a client's completed responses, in request order
+    void takeResponses(int client, string& out) {
+        auto it = clients.find(client);
+        if (it == clients.end()) {
             return;
         }
-        
-        // Show seat layout
-        cout << "\n----- Seat Layout -----\n";
-        cout << "Available: O | Booked: X\n\n";
-        
-        for (int i = 0; i < selectedBus.totalSeats; i++) {
-            printf("%3d%s  ", (i + 1), (selectedBus.seatAvailability[i] ? " O" : " X"));
-            if ((i + 1) % 4 == 0) cout << endl;
+        deque<RequestPtr>& requests = it->second;
+        while (!requests.empty() && requests.front()->pending == 0) {
+            out += requests.front()->response;
+            requests.pop_front();
         }
-        cout << endl;
-        
-        // Get seat number
-        int seatNumber;
-        cout << "Enter Seat Number (1-" << selectedBus.totalSeats << "): ";
-        cin >> seatNumber;
-        
-        if (seatNumber < 1 || seatNumber > selectedBus.totalSeats) {
-            cout << "Invalid seat number!\n";
-            cout << "Press Enter to return to main menu...";
-            cin.ignore();
-            cin.get();
-            return;
+        if (requests.empty()) {
+            clients.erase(it);
         }
-        
-        // Check if seat is available
-        if (!selectedBus.seatAvailability[seatNumber - 1]) {
-            cout << "Seat " << seatNumber << " is already booked!\n";
-            cout << "Press Enter to return to main menu...";
-            cin.ignore();
-            cin.get();
-            return;
+    }
+
+    // Whether a client still waits for responses
+    bool hasPending(int client) const {
+        return clients.count(client) != 0;
+    }
+
+    // Forget a client that disconnected. Responses still owed for it are
+    // read and dropped.
+    void dropClient(int client) {
+        clients.erase(client);
+    }
+
+    // The router's own metrics, in the Prometheus text format
+    string formatMetrics() {
+        string text = "# TYPE bts_router_requests_total counter\n";
+        char line[128];
+        for (size_t i = 0; i < shards.size(); i++) {
+            snprintf(line, sizeof(line), "bts_router_requests_total{shard=\"%zu\"} %ld\n", i, shards[i].forwarded);
+            text += line;
         }
-        
-        // Get passenger details
-        Passenger passenger;
-        clearInputBuffer();
-        
-        cout << "\n----- Passenger Details -----\n";
-        cout << "Name: ";
-        cin.getline(passenger.name, 50);
-        
-        cout << "Contact Number: ";
-        cin.getline(passenger.contactNumber, 15);
-        
-        cout << "Age: ";
-        cin >> passenger.age;
-        
-        clearInputBuffer();
-        cout << "Gender (M/F): ";
-        cin.getline(passenger.gender, 2);
-        
-        // Create ticket
-        if (ticketCount >= MAX_TICKETS) {
-            cout << "Maximum ticket limit reached!\n";
-            cout << "Press Enter to return to main menu...";
-            cin.ignore();
-            cin.get();
-            return;
+        text += "# TYPE bts_router_pending_responses gauge\n";
+        for (size_t i = 0; i < shards.size(); i++) {
+            snprintf(line, sizeof(line), "bts_router_pending_responses{shard=\"%zu\"} %zu\n",
+                     i, shards[i].awaited.size());
+            text += line;
         }
-        
-        Ticket newTicket;
-        newTicket.ticketId = nextTicketId++;
-        newTicket.busId = busId;
-        newTicket.passenger = passenger;
-        newTicket.seatNumber = seatNumber;
-        getCurrentDateTime(newTicket.bookingDate);
-        newTicket.fare = selectedBus.ticketPrice;
-        newTicket.isBooked = true;
-        
-        // Store travel details in ticket
-        copyString(newTicket.travelDate, requestedDate);
-        copyString(newTicket.source, requestedSource);
-        copyString(newTicket.destination, requestedDestination);
-        
-        // Mark seat as booked
-        selectedBus.seatAvailability[seatNumber - 1] = false;
-        
-        // Add ticket to array
-        tickets[ticketCount++] = newTicket;
-        
-        // Print ticket in a nice format
-        clearScreen();
-        displayHeader("TICKET BOOKED SUCCESSFULLY");
-        
-        cout << "\n+------------------------------------------+\n";
-        cout << "|           TICKET DETAILS                 |\n";
-        cout << "+------------------------------------------+\n";
-        cout << "| Ticket ID      : " << setw(23) << left << newTicket.ticketId << "|\n";
-        cout << "| Bus Number     : " << setw(23) << left << selectedBus.busNumber << "|\n";
-        cout << "| Travel Date    : " << setw(23) << left << newTicket.travelDate << "|\n";
-        cout << "| From           : " << setw(23) << left << newTicket.source << "|\n";
-        cout << "| To             : " << setw(23) << left << newTicket.destination << "|\n";
-        cout << "| Departure Time : " << setw(23) << left << selectedBus.departureTime << "|\n";
-        cout << "+------------------------------------------+\n";
-        cout << "|           PASSENGER DETAILS              |\n";
-        cout << "+------------------------------------------+\n";
-        cout << "| Name           : " << setw(23) << left << passenger.name << "|\n";
-        cout << "| Seat Number    : " << setw(23) << left << seatNumber << "|\n";
-        cout << "| Fare           : Rs. " << setw(20) << left << newTicket.fare << "|\n";
-        cout << "| Booking Date   : " << setw(23) << left << newTicket.bookingDate << "|\n";
-        cout << "+------------------------------------------+\n";
-        
-        cout << "\nPlease note down your Ticket ID for future reference: " << newTicket.ticketId << "\n";
-        
-        // Check if bus is fully booked
-        if (isBusFullyBooked(busIndex)) {
-            generateBusBill(busIndex);
+        text += "# TYPE bts_router_shard_up gauge\n";
+        for (size_t i = 0; i < shards.size(); i++) {
+            snprintf(line, sizeof(line), "bts_router_shard_up{shard=\"%zu\"} %d\n", i,
+                     shards[i].state == SHARD_UP ? 1 : 0);
+            text += line;
         }
+        return text;
     }
+};
 
-    // View ticket function
-    void viewTicket() {
-        clearScreen();
-        displayHeader("VIEW TICKET DETAILS");
-        
-        int ticketId;
-        
-        cout << "\nEnter Ticket ID: ";
-        cin >> ticketId;
-        
-        int ticketIndex = findTicketById(ticketId);
-        
-        if (ticketIndex == -1) {
-            cout << "\nTicket with ID " << ticketId << " not found or has been cancelled.\n";
-            return;
+// Reservation server: serves the reservation service over a Unix or TCP
+// socket from a single non-blocking epoll loop.
+//
+// Protocol: one request per line, fields separated by tabs. Every request
+// gets exactly one response line, in request order, so clients may
+// pipeline any number of requests before reading the responses.
+//   PING                                              -> OK
+//   SHARD                                             -> OK index count
+//                          (the --shard=index/count the server started with)
+//   ADDBUS number source destination date departure arrival seats price
+//                                                     -> OK busId
+//   DELBUS busId                                      -> OK billId
+//   BOOK busId seat name contact age gender           -> OK ticketId seat fare billId
+//   GROUP adjacent|any {busId seat name contact age gender}...
+//                       -> OK count {ticketId busId seat fare billId}...
+//                          (all seats or none; adjacent puts a bus's seat-0
+//                          bookings in one block)
+//   CANCEL ticketId                                   -> OK busId seat refund promotedTicketId
+//   WAIT busId priority name contact age gender       -> OK waitId ahead
+//   UNWAIT waitId                                     -> OK busId
+//   WAITLIST busId                                    -> OK count {waitId priority name}...
+//                          (waiters on a full bus are booked into freed
+//                          seats, higher priority first)
+//   HOLD busId seat seconds                           -> OK holdId seat fare expiresIn
+//   CONFIRM holdId name contact age gender            -> OK ticketId busId seat fare billId
+//   RELEASE holdId                                    -> OK busId seat
+//                          (a held seat is freed when the hold expires
+//                          unconfirmed, up to HOLD_MAX_SECONDS)
+//   BUSES               -> OK count {busId number source destination date available price}...
+//   BUS busId           -> OK busId number source destination date departure arrival seats available price
+//   TICKET ticketId     -> OK ticketId busId seat name date source destination fare Active|Cancelled
+//   SEARCH source destination [fromDate toDate]       -> OK count {busId available price}...
+//   PLAN source destination date [passengers [transferMinutes]]
+//                       -> OK count {legCount fare {busId departAt arriveAt}...}...
+//                          (journeys with changes of bus; times are minutes
+//                          after midnight of the date)
+//   STATS [busId]       -> OK revenue passengers seats loadFactor bookings cancellations
+//                          (system totals without a bus ID)
+//   METRICS             -> OK lineCount, then that many lines of metrics text
+// A connection that starts with an HTTP "GET /metrics" request instead gets
+// the same metrics as an HTTP response, for Prometheus-style scrapers.
+// A server started with --follow is a read replica: it answers reads from
+// the owner's data and refuses every change with ERR READ_ONLY. A router
+// started with --shards speaks the same protocol in front of the shards;
+// see ShardRouter for which requests span shards.
+// Seat 0 books the first free seat. Dates are DD/MM/YYYY. Failures are
+// answered with ERR code message, where code is an OperationStatus.
+class ReservationServer {
+private:
+    // One client connection with its unparsed input and unsent output
+    struct Connection {
+        int fd;
+        string input;
+        string output;
+        size_t outputSent;
+        bool wantWrite;
+        bool httpHeaders; // Reading the headers of an HTTP request
+        bool closing;     // Close once the output is sent
+        bool readClosed;  // The client sent all it will; no longer watched for input
+        string httpPath;
+    };
+
+    ReservationService* service; // Null when routing for shards
+    ShardRouter* router;         // Null when serving a service
+    vector<int> routedClients;   // Clients the router has completed responses for
+    int listenFd;
+    int epollFd;
+    SocketAddress address;
+    unordered_map<int, unique_ptr<Connection>> connections;
+    Arena requestArena; // Scratch memory for the request being handled
+
+    // Whether a command changes the data, which only the owner may do
+    static bool isWriteCommand(const char* command) {
+        static const char* const writes[] = {
+            "BOOK", "GROUP", "CANCEL", "WAIT", "UNWAIT", "HOLD", "CONFIRM", "RELEASE", "ADDBUS", "DELBUS",
+        };
+        for (const char* write : writes) {
+            if (strcmp(command, write) == 0) {
+                return true;
+            }
         }
+        return false;
+    }
+
+    // Execute one request line and append its response
+    void handleRequest(char* line, string& out) {
+        char* fields[SERVER_MAX_FIELDS];
+        int count = splitFields(line, fields, SERVER_MAX_FIELDS);
+        requestArena.reset();
+        const char* command = fields[0];
+        char response[512];
         
-        const Ticket& ticket = tickets[ticketIndex];
-        
-        // Find the bus
-        int busIndex = findBusById(ticket.busId);
-        
-        if (busIndex == -1) {
-            cout << "\nBus information not found for this ticket.\n";
-            return;
+        if (service->isReadOnly() && isWriteCommand(command)) {
+            writeError(out, STATUS_READ_ONLY);
+        } else if (strcmp(command, "PING") == 0) {
+            out += "OK\n";
+        } else if (strcmp(command, "SHARD") == 0 && count == 1) {
+            ShardSpec shard = service->shardSpec();
+            snprintf(response, sizeof(response), "OK\t%d\t%d\n", shard.index, shard.count);
+            out += response;
+        } else if (strcmp(command, "BOOK") == 0 && count == 7) {
+            Passenger passenger;
+            memset(&passenger, 0, sizeof(passenger));
+            if (!copyField(passenger.name, sizeof(passenger.name), fields[3]) ||
+                !copyField(passenger.contactNumber, sizeof(passenger.contactNumber), fields[4]) ||
+                !copyField(passenger.gender, sizeof(passenger.gender), fields[6])) {
+                writeError(out, STATUS_BAD_REQUEST);
+                return;
+            }
+            passenger.age = atoi(fields[5]);
+            OperationResult result = service->reserveSeat(atoi(fields[1]), atoi(fields[2]), passenger);
+            if (result.status != STATUS_OK) {
+                writeError(out, result.status);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%d\t%d\t%.2f\t%d\n",
+                     result.ticketId, result.seatNumber, result.fare, result.billId);
+            out += response;
+        } else if (strcmp(command, "CANCEL") == 0 && count == 2) {
+            OperationResult result = service->cancelReservation(atoi(fields[1]));
+            if (result.status != STATUS_OK) {
+                writeError(out, result.status);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%d\t%d\t%.2f\t%d\n",
+                     result.busId, result.seatNumber, result.fare, result.promotedTicketId);
+            out += response;
+        } else if (strcmp(command, "WAIT") == 0 && count == 7) {
+            Passenger passenger;
+            memset(&passenger, 0, sizeof(passenger));
+            if (!copyField(passenger.name, sizeof(passenger.name), fields[3]) ||
+                !copyField(passenger.contactNumber, sizeof(passenger.contactNumber), fields[4]) ||
+                !copyField(passenger.gender, sizeof(passenger.gender), fields[6])) {
+                writeError(out, STATUS_BAD_REQUEST);
+                return;
+            }
+            passenger.age = atoi(fields[5]);
+            WaitlistResult result = service->joinWaitlist(atoi(fields[1]), passenger, atoi(fields[2]));
+            if (result.status != STATUS_OK) {
+                writeError(out, result.status);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%d\t%d\n", result.waitId, result.ahead);
+            out += response;
+        } else if (strcmp(command, "UNWAIT") == 0 && count == 2) {
+            OperationResult result = service->leaveWaitlist(atoi(fields[1]));
+            if (result.status != STATUS_OK) {
+                writeError(out, result.status);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%d\n", result.busId);
+            out += response;
+        } else if (strcmp(command, "WAITLIST") == 0 && count == 2) {
+            vector<WaitlistEntry> waiting = service->getWaitlist(atoi(fields[1]));
+            snprintf(response, sizeof(response), "OK\t%d", (int)waiting.size());
+            out += response;
+            for (const WaitlistEntry& entry : waiting) {
+                snprintf(response, sizeof(response), "\t%d\t%d\t%s",
+                         entry.waitId, entry.priority, entry.passenger.name);
+                out += response;
+            }
+            out += "\n";
+        } else if (strcmp(command, "HOLD") == 0 && count == 4) {
+            HoldResult result = service->holdSeat(atoi(fields[1]), atoi(fields[2]), atoi(fields[3]));
+            if (result.status != STATUS_OK) {
+                writeError(out, result.status);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%d\t%d\t%.2f\t%d\n",
+                     result.holdId, result.seatNumber, result.fare, result.expiresIn);
+            out += response;
+        } else if (strcmp(command, "CONFIRM") == 0 && count == 6) {
+            Passenger passenger;
+            memset(&passenger, 0, sizeof(passenger));
+            if (!copyField(passenger.name, sizeof(passenger.name), fields[2]) ||
+                !copyField(passenger.contactNumber, sizeof(passenger.contactNumber), fields[3]) ||
+                !copyField(passenger.gender, sizeof(passenger.gender), fields[5])) {
+                writeError(out, STATUS_BAD_REQUEST);
+                return;
+            }
+            passenger.age = atoi(fields[4]);
+            OperationResult result = service->confirmHold(atoi(fields[1]), passenger);
+            if (result.status != STATUS_OK) {
+                writeError(out, result.status);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%d\t%d\t%d\t%.2f\t%d\n",
+                     result.ticketId, result.busId, result.seatNumber, result.fare, result.billId);
+            out += response;
+        } else if (strcmp(command, "RELEASE") == 0 && count == 2) {
+            OperationResult result = service->releaseHold(atoi(fields[1]));
+            if (result.status != STATUS_OK) {
+                writeError(out, result.status);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%d\t%d\n", result.busId, result.seatNumber);
+            out += response;
+        } else if (strcmp(command, "BUSES") == 0 && count == 1) {
+            vector<Bus> buses = service->listBuses();
+            snprintf(response, sizeof(response), "OK\t%d", (int)buses.size());
+            out += response;
+            for (const Bus& bus : buses) {
+                snprintf(response, sizeof(response), "\t%d\t%s\t%s\t%s\t%s\t%d\t%.2f",
+                         bus.busId, bus.busNumber, bus.source, bus.destination, bus.travelDate,
+                         bus.seats.available(), bus.ticketPrice);
+                out += response;
+            }
+            out += "\n";
+        } else if (strcmp(command, "BUS") == 0 && count == 2) {
+            Bus bus;
+            if (!service->getBus(atoi(fields[1]), bus)) {
+                writeError(out, STATUS_BUS_NOT_FOUND);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%d\t%s\t%s\t%s\t%s\t%s\t%s\t%d\t%d\t%.2f\n",
+                     bus.busId, bus.busNumber, bus.source, bus.destination, bus.travelDate,
+                     bus.departureTime, bus.arrivalTime, bus.totalSeats,
+                     bus.seats.available(), bus.ticketPrice);
+            out += response;
+        } else if (strcmp(command, "TICKET") == 0 && count == 2) {
+            Ticket ticket;
+            if (!service->getTicket(atoi(fields[1]), ticket)) {
+                writeError(out, STATUS_TICKET_NOT_FOUND);
+                return;
+            }
+            char travelDate[11];
+            formatDate(ticket.travelDate, travelDate);
+            snprintf(response, sizeof(response), "OK\t%d\t%d\t%d\t%s\t%s\t%s\t%s\t%.2f\t%s\n",
+                     ticket.ticketId, ticket.busId, ticket.seatNumber, ticket.passenger.name,
+                     travelDate, service->stringText(ticket.sourceId),
+                     service->stringText(ticket.destinationId), ticket.fare,
+                     ticket.isBooked ? "Active" : "Cancelled");
+            out += response;
+        } else if (strcmp(command, "SEARCH") == 0 && (count == 3 || count == 5)) {
+            int fromDate = 0, toDate = INT_MAX;
+            if (count == 5) {
+                fromDate = packDate(fields[3]);
+                toDate = packDate(fields[4]);
+                if (fromDate == 0 || toDate == 0) {
+                    writeError(out, STATUS_INVALID_DATE);
+                    return;
+                }
+            }
+            ArenaVector<Bus> matches = service->searchRoute(requestArena, fields[1], fields[2], fromDate, toDate);
+            snprintf(response, sizeof(response), "OK\t%d", (int)matches.size());
+            out += response;
+            for (const Bus& bus : matches) {
+                snprintf(response, sizeof(response), "\t%d\t%d\t%.2f",
+                         bus.busId, bus.seats.available(), bus.ticketPrice);
+                out += response;
+            }
+            out += "\n";
+        } else if (strcmp(command, "PLAN") == 0 && count >= 4 && count <= 6) {
+            int date = packDate(fields[3]);
+            if (date == 0) {
+                writeError(out, STATUS_INVALID_DATE);
+                return;
+            }
+            int passengers = count >= 5 ? atoi(fields[4]) : 1;
+            int transferMinutes = count == 6 ? atoi(fields[5]) : JOURNEY_MIN_TRANSFER;
+            if (passengers < 1 || passengers > MAX_SEATS || transferMinutes < 0) {
+                writeError(out, STATUS_BAD_REQUEST);
+                return;
+            }
+            ArenaVector<Journey> journeys = service->planJourney(requestArena, fields[1], fields[2], date, 0,
+                                                               passengers, transferMinutes);
+            snprintf(response, sizeof(response), "OK\t%d", (int)journeys.size());
+            out += response;
+            for (const Journey& journey : journeys) {
+                snprintf(response, sizeof(response), "\t%d\t%.2f", journey.legCount, journey.fare);
+                out += response;
+                for (int l = 0; l < journey.legCount; l++) {
+                    const JourneyLeg& leg = journey.legs[l];
+                    snprintf(response, sizeof(response), "\t%d\t%d\t%d",
+                             leg.bus.busId, leg.departAt, leg.arriveAt);
+                    out += response;
+                }
+            }
+            out += "\n";
+        } else if (strcmp(command, "GROUP") == 0 && count >= 8 && (count - 2) % 6 == 0 &&
+                   (strcmp(fields[1], "adjacent") == 0 || strcmp(fields[1], "any") == 0)) {
+            vector<BookingRequest> requests((count - 2) / 6);
+            for (size_t i = 0; i < requests.size(); i++) {
+                char** seat = &fields[2 + i * 6];
+                BookingRequest& request = requests[i];
+                memset(&request, 0, sizeof(request));
+                request.busId = atoi(seat[0]);
+                request.seatNumber = atoi(seat[1]);
+                if (!copyField(request.passenger.name, sizeof(request.passenger.name), seat[2]) ||
+                    !copyField(request.passenger.contactNumber, sizeof(request.passenger.contactNumber), seat[3]) ||
+                    !copyField(request.passenger.gender, sizeof(request.passenger.gender), seat[5])) {
+                    writeError(out, STATUS_BAD_REQUEST);
+                    return;
+                }
+                request.passenger.age = atoi(seat[4]);
+            }
+            GroupBookingResult result = service->reserveGroup(requests, strcmp(fields[1], "adjacent") == 0);
+            if (result.status != STATUS_OK) {
+                writeError(out, result.status);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%zu", result.bookings.size());
+            out += response;
+            for (const OperationResult& booking : result.bookings) {
+                snprintf(response, sizeof(response), "\t%d\t%d\t%d\t%.2f\t%d", booking.ticketId,
+                         booking.busId, booking.seatNumber, booking.fare, booking.billId);
+                out += response;
+            }
+            out += "\n";
+        } else if (strcmp(command, "STATS") == 0 && count <= 2) {
+            RevenueRollup totals;
+            if (count == 2 && !service->getBusStats(atoi(fields[1]), totals)) {
+                writeError(out, STATUS_BUS_NOT_FOUND);
+                return;
+            } else if (count == 1) {
+                totals = service->getSystemTotals();
+            }
+            snprintf(response, sizeof(response), "OK\t%.2f\t%d\t%d\t%.4f\t%ld\t%ld\n",
+                     totals.revenue, totals.passengers, totals.seats, totals.loadFactor(),
+                     totals.bookings, totals.cancellations);
+            out += response;
+        } else if (strcmp(command, "METRICS") == 0 && count == 1) {
+            string text = formatMetrics(*service);
+            snprintf(response, sizeof(response), "OK\t%ld\n", (long)count_if(text.begin(), text.end(),
+                     [](char c) { return c == '\n'; }));
+            out += response;
+            out += text;
+        } else if (strcmp(command, "ADDBUS") == 0 && count == 9) {
+            Bus bus;
+            memset(&bus, 0, sizeof(bus));
+            if (!copyField(bus.busNumber, sizeof(bus.busNumber), fields[1]) ||
+                !copyField(bus.source, sizeof(bus.source), fields[2]) ||
+                !copyField(bus.destination, sizeof(bus.destination), fields[3]) ||
+                !copyField(bus.travelDate, sizeof(bus.travelDate), fields[4]) ||
+                !copyField(bus.departureTime, sizeof(bus.departureTime), fields[5]) ||
+                !copyField(bus.arrivalTime, sizeof(bus.arrivalTime), fields[6])) {
+                writeError(out, STATUS_BAD_REQUEST);
+                return;
+            }
+            bus.totalSeats = atoi(fields[7]);
+            bus.ticketPrice = atof(fields[8]);
+            OperationResult result = service->addBusRecord(bus);
+            if (result.status != STATUS_OK) {
+                writeError(out, result.status);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%d\n", result.busId);
+            out += response;
+        } else if (strcmp(command, "DELBUS") == 0 && count == 2) {
+            OperationResult result = service->deleteBusRecord(atoi(fields[1]));
+            if (result.status != STATUS_OK) {
+                writeError(out, result.status);
+                return;
+            }
+            snprintf(response, sizeof(response), "OK\t%d\n", result.billId);
+            out += response;
+        } else {
+            writeError(out, STATUS_BAD_REQUEST);
         }
-        
-        const Bus& bus = buses[busIndex];
-        
-        // Print ticket details
-        cout << "\n+------------------------------------------+\n";
-        cout << "|           TICKET DETAILS                 |\n";
-        cout << "+------------------------------------------+\n";
-        cout << "| Ticket ID      : " << setw(23) << left << ticket.ticketId << "|\n";
-        cout << "| Bus Number     : " << setw(23) << left << bus.busNumber << "|\n";
-        cout << "| Travel Date    : " << setw(23) << left << ticket.travelDate << "|\n";
-        cout << "| From           : " << setw(23) << left << ticket.source << "|\n";
-        cout << "| To             : " << setw(23) << left << ticket.destination << "|\n";
-        cout << "| Departure Time : " << setw(23) << left << bus.departureTime << "|\n";
-        cout << "+------------------------------------------+\n";
-        cout << "|           PASSENGER DETAILS              |\n";
-        cout << "+------------------------------------------+\n";
-        cout << "| Name           : " << setw(23) << left << ticket.passenger.name << "|\n";
-        cout << "| Contact        : " << setw(23) << left << ticket.passenger.contactNumber << "|\n";
-        cout << "| Age            : " << setw(23) << left << ticket.passenger.age << "|\n";
-        cout << "| Gender         : " << setw(23) << left << ticket.passenger.gender << "|\n";
-        cout << "+------------------------------------------+\n";
-        cout << "|           BOOKING DETAILS                |\n";
-        cout << "+------------------------------------------+\n";
-        cout << "| Seat Number    : " << setw(23) << left << ticket.seatNumber << "|\n";
-        cout << "| Fare           : Rs. " << setw(20) << left << ticket.fare << "|\n";
-        cout << "| Booking Date   : " << setw(23) << left << ticket.bookingDate << "|\n";
-        cout << "| Status         : " << setw(23) << left << (ticket.isBooked ? "Active" : "Cancelled") << "|\n";
-        cout << "+------------------------------------------+\n";
     }
 
-    // Cancel ticket function
-    void cancelTicket() {
-        int ticketId;
-        
-        cout << "\n========== CANCEL TICKET ==========\n";
-        cout << "Enter Ticket ID: ";
-        cin >> ticketId;
-        
-        int ticketIndex = findTicketById(ticketId);
-        
-        if (ticketIndex == -1) {
-            cout << "Ticket with ID " << ticketId << " not found or has already been cancelled.\n";
-            return;
+    // Accept every pending connection
+    void acceptConnections() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return; // EAGAIN, or a client that went away before we got to it
+            }
+            if (!address.isUnix) {
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+            epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                ::close(fd);
+                continue;
+            }
+            connections[fd].reset(new Connection{fd, string(), string(), 0, false, false, false, false, string()});
+        }
+    }
+
+    // Answer an HTTP request once its headers are read. Only GET /metrics
+    // is served; the connection closes after the response.
+    void handleHttpRequest(Connection& connection) {
+        string body;
+        const char* status = "200 OK";
+        if (connection.httpPath == "/metrics") {
+            body = router ? router->formatMetrics() : formatMetrics(*service);
+        } else {
+            status = "404 Not Found";
+            body = "Not found\n";
+        }
+        char header[256];
+        snprintf(header, sizeof(header),
+                 "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, body.size());
+        connection.output += header;
+        connection.output += body;
+        connection.closing = true;
+    }
+    
+    // Close a connection and forget it
+    void closeConnection(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        connections.erase(fd);
+        if (router) {
+            router->dropClient(fd);
+        }
+    }
+
+    // Whether a connection is done: closing, and nothing left to send
+    bool isFinished(const Connection& connection) {
+        return connection.closing && connection.output.empty() && !(router && router->hasPending(connection.fd));
+    }
+
+    // Watch a connection for input, unless its client has closed its end,
+    // and for writability while output is left over
+    void watchConnection(Connection& connection) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = (connection.readClosed ? 0u : (uint32_t)(EPOLLIN | EPOLLRDHUP)) |
+                       (connection.wantWrite ? (uint32_t)EPOLLOUT : 0u);
+        event.data.fd = connection.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+    }
+
+    // Pass the responses the shards have completed on to their clients
+    void deliverRouted() {
+        for (int fd : routedClients) {
+            auto it = connections.find(fd);
+            if (it == connections.end()) {
+                continue; // Gone, or already handled
+            }
+            Connection& connection = *it->second;
+            router->takeResponses(fd, connection.output);
+            if (!writeResponses(connection) || isFinished(connection)) {
+                closeConnection(fd);
+            }
+        }
+        routedClients.clear();
+    }
+
+    // Read what the client sent and answer every complete request.
+    // Returns false if the connection should be closed.
+    bool readRequests(Connection& connection) {
+        char buffer[65536];
+        while (true) {
+            ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                connection.input.append(buffer, received);
+                continue;
+            }
+            if (received == 0) {
+                return false; // Client closed its end
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
         }
         
-        Ticket& ticket = tickets[ticketIndex];
-        
-        // Find the bus
-        int busIndex = findBusById(ticket.busId);
-        
-        if (busIndex == -1) {
-            cout << "Bus information not found for this ticket.\n";
-            return;
+        size_t start = 0;
+        while (!connection.closing) {
+            size_t end = connection.input.find('\n', start);
+            if (end == string::npos) {
+                break;
+            }
+            connection.input[end] = '\0';
+            if (end > start && connection.input[end - 1] == '\r') {
+                connection.input[end - 1] = '\0';
+            }
+            char* line = &connection.input[start];
+            if (connection.httpHeaders) {
+                if (line[0] == '\0') {
+                    handleHttpRequest(connection); // Blank line ends the headers
+                }
+            } else if (strncmp(line, "GET ", 4) == 0) {
+                const char* path = line + 4;
+                connection.httpPath.assign(path, strcspn(path, " "));
+                connection.httpHeaders = true;
+            } else if (router) {
+                router->route(connection.fd, line);
+            } else {
+                handleRequest(line, connection.output);
+            }
+            start = end + 1;
         }
-        
-        Bus& bus = buses[busIndex];
-        
-        // Mark seat as available
-        bus.seatAvailability[ticket.seatNumber - 1] = true;
-        
-        // Mark ticket as cancelled
-        ticket.isBooked = false;
-        
-        cout << "\nTicket with ID " << ticketId << " has been cancelled successfully.\n";
-        cout << "Refund amount: " << ticket.fare << endl;
+        if (router) {
+            router->flush(routedClients);
+            router->takeResponses(connection.fd, connection.output); // Answered by the router itself
+        }
+        if (connection.closing) {
+            connection.input.clear(); // Nothing after an HTTP request is read
+            return true;
+        }
+        connection.input.erase(0, start);
+        if (connection.input.size() > (size_t)SERVER_MAX_REQUEST) {
+            writeError(connection.output, STATUS_BAD_REQUEST);
+            writeResponses(connection);
+            return false;
+        }
+        return true;
     }
 
-    // View all bookings function
-    void viewAllBookings() {
-        clearScreen();
-        displayHeader("ALL BOOKINGS");
-        
-        bool found = false;
-        for (int i = 0; i < ticketCount; i++) {
-            if (tickets[i].isBooked) {
-                found = true;
+    // Send as much pending output as the socket takes, and watch for
+    // writability only while output is left over.
+    // Returns false if the connection should be closed.
+    bool writeResponses(Connection& connection) {
+        while (connection.outputSent < connection.output.size()) {
+            ssize_t sent = send(connection.fd, connection.output.data() + connection.outputSent,
+                                connection.output.size() - connection.outputSent, MSG_NOSIGNAL);
+            if (sent > 0) {
+                connection.outputSent += sent;
+            } else if (sent < 0 && errno == EINTR) {
+                continue;
+            } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
                 break;
+            } else {
+                return false;
             }
         }
-        
-        if (!found) {
-            cout << "\nNo bookings found.\n";
-            return;
+        if (connection.outputSent == connection.output.size()) {
+            connection.output.clear();
+            connection.outputSent = 0;
         }
         
-        cout << "\n+----------+----------+--------------------+--------------+---------------+---------------+---------+----------+\n";
-        cout << "| Ticket ID|  Bus ID  |  Passenger Name    | Travel Date  |    Source     |  Destination  | Seat No.|  Status  |\n";
-        cout << "+----------+----------+--------------------+--------------+---------------+---------------+---------+----------+\n";
-        
-        for (int i = 0; i < ticketCount; i++) {
-            if (tickets[i].isBooked || !tickets[i].isBooked) { // Show both active and cancelled tickets
-                const Ticket& ticket = tickets[i];
-                const char* status = ticket.isBooked ? "Active" : "Cancelled";
-                
-                printf("| %-8d | %-8d | %-18s | %-12s | %-13s | %-13s | %-7d | %-8s |\n", 
-                       ticket.ticketId, ticket.busId, ticket.passenger.name, 
-                       ticket.travelDate, ticket.source, ticket.destination, 
-                       ticket.seatNumber, status);
-                
-                cout << "+----------+----------+--------------------+--------------+---------------+---------------+---------+----------+\n";
-            }
+        bool wantWrite = !connection.output.empty();
+        if (wantWrite != connection.wantWrite) {
+            connection.wantWrite = wantWrite;
+            watchConnection(connection);
         }
+        return true;
     }
 
-    // Delete bus function
-    void deleteBus() {
-        int busId;
-        
-        cout << "\n========== DELETE BUS RECORD ==========\n";
-        viewAllBuses();
-        
-        bool found = false;
-        for (int i = 0; i < busCount; i++) {
-            if (buses[i].isActive) {
-                found = true;
-                break;
+public:
+    ReservationServer(ReservationService& reservationService)
+        : service(&reservationService), router(nullptr), listenFd(-1), epollFd(-1) {
+        memset(&address, 0, sizeof(address));
+    }
+
+    // Serve the protocol by forwarding each request to the shards
+    ReservationServer(ShardRouter& shardRouter)
+        : service(nullptr), router(&shardRouter), listenFd(-1), epollFd(-1) {
+        memset(&address, 0, sizeof(address));
+    }
+
+    ~ReservationServer() {
+        for (auto& entry : connections) {
+            ::close(entry.first);
+        }
+        if (epollFd != -1) {
+            ::close(epollFd);
+        }
+        if (listenFd != -1) {
+            ::close(listenFd);
+            if (address.isUnix) {
+                unlink(address.path);
             }
         }
-        
-        if (!found) {
-            return;
+    }
+
+    // Bind and listen on an address. Returns an error message, or null.
+    const char* listenOn(const SocketAddress& listenAddress) {
+        address = listenAddress;
+        int family = address.isUnix ? AF_UNIX : AF_INET;
+        listenFd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) {
+            return "cannot create socket";
         }
-        
-        cout << "\nEnter Bus ID to delete: ";
-        cin >> busId;
-        
-        // Find the bus
-        int busIndex = findBusById(busId);
-        
-        if (busIndex == -1) {
-            cout << "Bus with ID " << busId << " not found.\n";
-            return;
+        if (address.isUnix) {
+            unlink(address.path); // Stale socket from an earlier run
+        } else {
+            int on = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
         }
-        
-        // Check if there are active bookings for this bus
-        bool hasBookings = hasActiveBookings(busId);
-        bool isFullyBooked = isBusFullyBooked(busIndex);
-        
-        if (hasBookings && !isFullyBooked) {
-            cout << "Cannot delete bus with active bookings that is not fully booked. Please cancel all tickets first.\n";
-            return;
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&address.storage), address.length) != 0) {
+            return "cannot bind address";
+        }
+        if (listen(listenFd, SOMAXCONN) != 0) {
+            return "cannot listen on address";
         }
         
-        // Confirm deletion
-        char confirm;
-        cout << "Are you sure you want to delete Bus " << buses[busIndex].busNumber 
-             << " (" << buses[busIndex].source << " to " << buses[busIndex].destination << ")? (y/n): ";
-        cin >> confirm;
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            return "cannot create epoll instance";
+        }
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = listenFd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event) != 0) {
+            return "cannot watch listening socket";
+        }
+        if (router) {
+            router->attach(epollFd);
+        }
+        return nullptr;
+    }
+
+    // Serve requests until SIGINT or SIGTERM
+    void run() {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = requestServerStop; // No SA_RESTART, so epoll_wait wakes up
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
         
-        if (tolower(confirm) == 'y') {
-            // If bus is fully booked and not already in bill history, generate a bill
-            if (isFullyBooked) {
-                bool billExists = false;
-                for (int i = 0; i < billCount; i++) {
-                    if (busBills[i].isActive && busBills[i].busId == busId) {
-                        billExists = true;
-                        break;
-                    }
+        epoll_event events[SERVER_MAX_EVENTS];
+        while (!serverStopRequested) {
+            int ready = epoll_wait(epollFd, events, SERVER_MAX_EVENTS, router ? SHARD_TICK_MS : -1);
+            if (ready < 0) {
+                if (errno == EINTR) {
+                    continue;
                 }
-                
-                if (!billExists) {
-                    generateBusBill(busIndex);
+                break;
+            }
+            for (int i = 0; i < ready; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptConnections();
+                    continue;
+                }
+                if (router && router->isShard(fd)) {
+                    router->handleShardEvent(fd, events[i].events, routedClients);
+                    continue;
+                }
+                auto it = connections.find(fd);
+                if (it == connections.end()) {
+                    continue;
+                }
+                Connection& connection = *it->second;
+                bool keep = true;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    keep = readRequests(connection);
+                }
+                if (!keep && router && router->hasPending(fd) && !connection.readClosed) {
+                    // The client closed its end; finish answering what it sent
+                    connection.closing = true;
+                    connection.readClosed = true;
+                    watchConnection(connection);
+                    keep = true;
+                }
+                if (keep) {
+                    keep = writeResponses(connection) && !isFinished(connection);
+                } else {
+                    writeResponses(connection); // Best effort for a half-closed client
+                }
+                if (!keep) {
+                    closeConnection(fd);
                 }
             }
-            
-            // Mark bus as inactive
-            buses[busIndex].isActive = false;
-            cout << "Bus record deleted successfully.\n";
-        } else {
-            cout << "Deletion cancelled.\n";
+            if (router) {
+                router->tick(routedClients);
+                deliverRouted();
+            }
         }
     }
+};
 
-    // View bus bill history function
-    void viewBusBillHistory() {
-        clearScreen();
-        displayHeader("BUS BILL HISTORY");
-        
-        bool found = false;
-        for (int i = 0; i < billCount; i++) {
-            if (busBills[i].isActive) {
-                found = true;
-                break;
+// Fetch the server's metrics with the METRICS command and print them.
+// Returns the process exit code.
+int printServerMetrics(const SocketAddress& address) {
+    int fd = connectToServer(address);
+    if (fd < 0) {
+        cout << "Cannot connect to server.\n";
+        return 1;
+    }
+    string buffer, line;
+    size_t start = 0;
+    if (!sendAll(fd, "METRICS\n") || !readResponseLine(fd, buffer, start, line) ||
+        line.compare(0, 3, "OK\t") != 0) {
+        cout << "Cannot read metrics: " << line << "\n";
+        ::close(fd);
+        return 1;
+    }
+    int lines = atoi(line.c_str() + 3);
+    for (int i = 0; i < lines; i++) {
+        if (!readResponseLine(fd, buffer, start, line)) {
+            cout << "Connection closed after " << i << " of " << lines << " lines.\n";
+            ::close(fd);
+            return 1;
+        }
+        cout << line << "\n";
+    }
+    ::close(fd);
+    return 0;
+}
+
+// Route requests from clients on an address to the shards listed, comma
+// separated, in shardList until SIGINT or SIGTERM. Returns the process exit
+// code.
+int runShardRouter(const SocketAddress& address, const char* shardList, ShardKey shardBy) {
+    vector<SocketAddress> shardAddresses;
+    string list = shardList;
+    for (size_t start = 0; start <= list.size();) {
+        size_t end = min(list.find(',', start), list.size());
+        string entry = list.substr(start, end - start);
+        SocketAddress shardAddress;
+        if (!parseSocketAddress(entry.c_str(), shardAddress)) {
+            cout << "Invalid shard address " << entry << ". Use unix:PATH, tcp:PORT or tcp:HOST:PORT.\n";
+            return 1;
+        }
+        shardAddresses.push_back(shardAddress);
+        start = end + 1;
+    }
+    if (shardAddresses.size() > (size_t)SHARD_MAX) {
+        cout << "At most " << SHARD_MAX << " shards are supported.\n";
+        return 1;
+    }
+    
+    ShardRouter router(shardAddresses, shardBy);
+    string error = router.connectAll();
+    if (!error.empty()) {
+        cout << "Cannot use " << error << "\n";
+        return 1;
+    }
+    ReservationServer server(router);
+    const char* listenError = server.listenOn(address);
+    if (listenError) {
+        cout << "Cannot start router: " << listenError << "\n";
+        return 1;
+    }
+    cout << "Routing to " << shardAddresses.size() << " shards by "
+         << (shardBy == SHARD_BY_ROUTE ? "route" : "date") << " (Ctrl+C to stop)\n" << flush;
+    server.run();
+    return 0;
+}
+
+// Load generator settings
+struct LoadOptions {
+    int connections;
+    long requests;   // Total requests across all connections
+    int pipeline;    // Requests in flight per connection
+    int buses;       // Buses created for the run
+};
+
+// Latencies and outcome of one load generator connection
+struct LoadResult {
+    vector<uint32_t> latencies; // Microseconds per request
+    long errors;
+    bool failed;
+};
+
+// Drive one connection: a read-mostly mix of BUS and SEARCH lookups with
+// one booking in eight. Tickets booked are cancelled again later in the
+// run, so the buses never fill up.
+void runLoadConnection(const SocketAddress& address, const vector<int>& busIds,
+                       long requests, int pipeline, int seed, LoadResult& result) {
+    result.errors = 0;
+    result.failed = false;
+    int fd = connectToServer(address);
+    if (fd < 0) {
+        result.failed = true;
+        return;
+    }
+    result.latencies.reserve(requests);
+    
+    vector<int> bookedTickets;
+    string batch, buffer, line;
+    size_t start = 0;
+    long issued = 0;
+    unsigned int state = (unsigned int)seed * 2654435761u + 1;
+    char request[256];
+    
+    while (issued < requests) {
+        int depth = (int)min<long>(pipeline, requests - issued);
+        vector<bool> isBooking(depth, false);
+        batch.clear();
+        for (int i = 0; i < depth; i++) {
+            state = state * 1103515245u + 12345u;
+            int busId = busIds[(state >> 8) % busIds.size()];
+            long n = issued + i;
+            if (n % 8 == 0) {
+                snprintf(request, sizeof(request), "BOOK\t%d\t0\tLoad Test\t9800000000\t30\tM\n", busId);
+                isBooking[i] = true;
+            } else if (n % 8 == 4 && !bookedTickets.empty()) {
+                snprintf(request, sizeof(request), "CANCEL\t%d\n", bookedTickets.back());
+                bookedTickets.pop_back();
+            } else if (n % 2 == 0) {
+                snprintf(request, sizeof(request), "SEARCH\tLoadgen City A\tLoadgen City B\n");
+            } else {
+                snprintf(request, sizeof(request), "BUS\t%d\n", busId);
             }
+            batch += request;
         }
         
-        if (!found) {
-            cout << "\nNo bus bills found.\n";
-            return;
+        auto sentAt = chrono::steady_clock::now();
+        if (!sendAll(fd, batch)) {
+            result.failed = true;
+            break;
         }
-        
-        for (int i = 0; i < billCount; i++) {
-            if (busBills[i].isActive) {
-                cout << "\n+---------------------------------------------------------------+\n";
-                cout << "|                              BUS BILL " << setw(4) << left << busBills[i].billId << "                       |\n";
-                cout << "+-------------------------------------------------------------------------+\n";
-                cout << "| Bus ID         : " << setw(42) << left << busBills[i].busId << "        |\n";
-                cout << "| Bus Number     : " << setw(42) << left << busBills[i].busNumber << "    |\n";
-                cout << "| Route          : " << setw(20) << left << busBills[i].source << " to " << setw(19) << left << busBills[i].destination << "|\n";
-                cout << "| Travel Date    : " << setw(42) << left << busBills[i].travelDate << "   |\n";
-                cout << "| Departure Time : " << setw(42) << left << busBills[i].departureTime << "|\n";
-                cout << "| Arrival Time   : " << setw(42) << left << busBills[i].arrivalTime << "  |\n";
-                cout << "| Total Seats    : " << setw(42) << left << busBills[i].totalSeats << "   |\n";
-                cout << "| Total Revenue  : Rs. " << setw(39) << left << fixed << setprecision(2) << busBills[i].totalRevenue << "|\n";
-                cout << "| Generated On   : " << setw(42) << left << busBills[i].generatedDate << "|\n";
-                cout << "+-------------------------------------------------------------------------+\n";
-                cout << "|                     PASSENGER DETAILS                         |\n";
-                cout << "+-------------------------------------------------------------------------+\n";
-                cout << "| " << setw(25) << left << "Name" << setw(20) << left << "Contact" << setw(10) << left << "Seat No." << "|\n";
-                cout << "+-------------------------------------------------------------------------+\n";
-                
-                for (int j = 0; j < busBills[i].passengerCount; j++) {
-                    int ticketId = busBills[i].passengerIds[j];
-                    
-                    // Find the ticket
-                    for (int k = 0; k < ticketCount; k++) {
-                        if (tickets[k].ticketId == ticketId) {
-                            cout << "| " << setw(25) << left << tickets[k].passenger.name 
-                                 << setw(20) << left << tickets[k].passenger.contactNumber 
-                                 << setw(10) << left << tickets[k].seatNumber << "|\n";
-                            break;
-                        }
-                    }
-                }
-                
-                cout << "+------------------------------------------------------------------------+\n";
-                cout << "| Total Passengers: " << setw(5) << left << busBills[i].passengerCount 
-                     << "            Total Revenue: Rs. " << setw(10) << left << fixed << setprecision(2) << busBills[i].totalRevenue << "|\n";
-                cout << "+------------------------------------------------------------------------+\n\n";
+        for (int i = 0; i < depth; i++) {
+            if (!readResponseLine(fd, buffer, start, line)) {
+                result.failed = true;
+                break;
             }
+            auto elapsed = chrono::steady_clock::now() - sentAt;
+            result.latencies.push_back((uint32_t)chrono::duration_cast<chrono::microseconds>(elapsed).count());
+            if (line.compare(0, 2, "OK") != 0) {
+                result.errors++;
+            } else if (isBooking[i]) {
+                bookedTickets.push_back(atoi(line.c_str() + 3));
+            }
+        }
+        if (result.failed) {
+            break;
         }
+        issued += depth;
     }
+    
+    // Give back the seats still held
+    for (int ticketId : bookedTickets) {
+        snprintf(request, sizeof(request), "CANCEL\t%d\n", ticketId);
+        if (!sendAll(fd, request) || !readResponseLine(fd, buffer, start, line)) {
+            break;
+        }
+    }
+    ::close(fd);
+}
 
-    // Save data to file function
-    void saveData() {
-        // Save buses
-        ofstream busFile("buses.dat", ios::binary);
-        if (busFile.is_open()) {
-            busFile.write(reinterpret_cast<char*>(&busCount), sizeof(busCount));
-            busFile.write(reinterpret_cast<char*>(&nextBusId), sizeof(nextBusId));
-            
-            for (int i = 0; i < busCount; i++) {
-                busFile.write(reinterpret_cast<char*>(&buses[i]), sizeof(Bus));
-            }
-            busFile.close();
+// Read --connections, --requests, --pipeline and --buses
+LoadOptions parseLoadOptions(int argc, char* argv[]) {
+    LoadOptions options = {4, 100000, 16, 8};
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--connections=", 14) == 0) {
+            options.connections = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--requests=", 11) == 0) {
+            options.requests = atol(argv[i] + 11);
+        } else if (strncmp(argv[i], "--pipeline=", 11) == 0) {
+            options.pipeline = atoi(argv[i] + 11);
+        } else if (strncmp(argv[i], "--buses=", 8) == 0) {
+            options.buses = atoi(argv[i] + 8);
         }
-        
-        // Save tickets
-        ofstream ticketFile("tickets.dat", ios::binary);
-        if (ticketFile.is_open()) {
-            ticketFile.write(reinterpret_cast<char*>(&ticketCount), sizeof(ticketCount));
-            ticketFile.write(reinterpret_cast<char*>(&nextTicketId), sizeof(nextTicketId));
-            
-            for (int i = 0; i < ticketCount; i++) {
-                ticketFile.write(reinterpret_cast<char*>(&tickets[i]), sizeof(Ticket));
-            }
-            ticketFile.close();
+    }
+    options.connections = max(1, options.connections);
+    options.requests = max(1L, options.requests);
+    options.pipeline = max(1, options.pipeline);
+    options.buses = max(1, options.buses);
+    return options;
+}
+
+// Run the load generator against a server and print requests per second
+// and latency percentiles. Returns the process exit code.
+int runLoadGenerator(const SocketAddress& address, const LoadOptions& options) {
+    // Create the buses the run books on, under numbers unique to this run
+    int fd = connectToServer(address);
+    if (fd < 0) {
+        cout << "Cannot connect to server.\n";
+        return 1;
+    }
+    time_t now = time(nullptr);
+    struct tm today;
+    localtime_r(&now, &today);
+    char travelDate[16];
+    snprintf(travelDate, sizeof(travelDate), "01/01/%04d", (today.tm_year + 1900 + 1) % 10000);
+    
+    vector<int> busIds;
+    string buffer, line;
+    size_t start = 0;
+    char request[256];
+    for (int i = 0; i < options.buses; i++) {
+        snprintf(request, sizeof(request),
+                 "ADDBUS\tLG%d-%d\tLoadgen City A\tLoadgen City B\t%s\t08:00 AM\t02:00 PM\t%d\t500\n",
+                 (int)getpid() % 100000, i, travelDate, MAX_SEATS);
+        if (!sendAll(fd, request) || !readResponseLine(fd, buffer, start, line) ||
+            line.compare(0, 3, "OK\t") != 0) {
+            cout << "Cannot create load test buses: " << line << "\n";
+            ::close(fd);
+            return 1;
         }
-        
-        // Save bus bills
-        ofstream billFile("busbills.dat", ios::binary);
-        if (billFile.is_open()) {
-            billFile.write(reinterpret_cast<char*>(&billCount), sizeof(billCount));
-            billFile.write(reinterpret_cast<char*>(&nextBillId), sizeof(nextBillId));
-            
-            for (int i = 0; i < billCount; i++) {
-                billFile.write(reinterpret_cast<char*>(&busBills[i]), sizeof(BusBill));
-            }
-            billFile.close();
+        busIds.push_back(atoi(line.c_str() + 3));
+    }
+    
+    vector<LoadResult> results(options.connections);
+    vector<thread> workers;
+    long perConnection = options.requests / options.connections;
+    auto startedAt = chrono::steady_clock::now();
+    for (int i = 0; i < options.connections; i++) {
+        long requests = perConnection + (i < options.requests % options.connections ? 1 : 0);
+        workers.emplace_back(runLoadConnection, cref(address), cref(busIds), requests,
+                             options.pipeline, i, ref(results[i]));
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startedAt).count();
+    
+    // Remove the load test buses again
+    for (int busId : busIds) {
+        snprintf(request, sizeof(request), "DELBUS\t%d\n", busId);
+        if (!sendAll(fd, request) || !readResponseLine(fd, buffer, start, line)) {
+            break;
         }
     }
+    ::close(fd);
+    
+    vector<uint32_t> latencies;
+    long errors = 0;
+    int failedConnections = 0;
+    for (const LoadResult& result : results) {
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        errors += result.errors;
+        failedConnections += result.failed ? 1 : 0;
+    }
+    if (latencies.empty()) {
+        cout << "No requests completed.\n";
+        return 1;
+    }
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies[min(latencies.size() - 1, (size_t)(p * latencies.size()))];
+    };
+    
+    printf("Connections: %d  Pipeline depth: %d  Buses: %d\n",
+           options.connections, options.pipeline, options.buses);
+    printf("Requests:    %zu in %.3f s (%ld errors, %d failed connections)\n",
+           latencies.size(), seconds, errors, failedConnections);
+    printf("Throughput:  %.0f requests/s\n", latencies.size() / seconds);
+    printf("Latency:     p50 %u us  p99 %u us  p99.9 %u us  max %u us\n",
+           percentile(0.50), percentile(0.99), percentile(0.999), latencies.back());
+    return failedConnections == 0 ? 0 : 1;
+}
+#endif
 
-    // Load data from file function
-    void loadData() {
-        // Load buses
-        ifstream busFile("buses.dat", ios::binary);
-        if (busFile.is_open()) {
-            busFile.read(reinterpret_cast<char*>(&busCount), sizeof(busCount));
-            busFile.read(reinterpret_cast<char*>(&nextBusId), sizeof(nextBusId));
-            
-            for (int i = 0; i < busCount; i++) {
-                busFile.read(reinterpret_cast<char*>(&buses[i]), sizeof(Bus));
+int main(int argc, char* argv[]) {
+    // Journal fsync policy: --fsync=always (default), --fsync=group or --fsync=never
+    // Server: --serve=ADDRESS. Load generator: --loadgen=ADDRESS [--connections=N]
+    // [--requests=N] [--pipeline=N] [--buses=N]. Server metrics dump:
+    // --metrics=ADDRESS (also served as GET /metrics). --follow with --serve
+    // starts a read replica that follows the journal of the server owning
+    // the data in the current directory, so several can run on one box.
+    // Sharding: --shard=K/N makes this process shard K of N (run each shard
+    // in its own directory); --serve=ADDRESS --shards=ADDRESS,... starts a
+    // router in front of the shards, listed in shard order, with
+    // --shard-by=route (default) or --shard-by=date.
+    // ADDRESS is unix:PATH,
+    // tcp:PORT or tcp:HOST:PORT. Bulk import: --import-buses=FILE and/or
+    // --import-tickets=FILE (CSV or TSV). Export: --export=tickets|buses|bills
+    // [--format=csv|columnar] [--output=FILE] [--from=DATE] [--to=DATE]
+    // [--source=CITY] [--destination=CITY] [--bus=ID]. Revenue reports:
+    // --report=dashboard|routes|days [--from=DATE] [--to=DATE]. Ad-hoc
+    // queries: --query=tickets|buses with the export filters and
+    // [--status=booked|cancelled] [--min-fare=N] [--max-fare=N]
+    // [--min-free=N]; --simd=scalar|sse2 caps the filter instruction set.
+    // Ticket layout benchmark: --bench-tickets[=COUNT]. Core benchmark:
+    // --bench[=RESULTS.csv] [--buses=N] [--routes=N] [--operations=N]
+    // [--threads=N] [--zipf=S] [--seed=N] [--rounds=N] [--bench-dir=DIR].
+    FsyncPolicy fsyncPolicy = FSYNC_EVERY_COMMIT;
+    const char* serveAddress = nullptr;
+    bool follow = false;
+    ShardSpec shard = {0, 1};
+    bool validShard = true;
+    const char* shardList = nullptr;
+    ShardKey shardBy = SHARD_BY_ROUTE;
+    const char* loadAddress = nullptr;
+    const char* metricsAddress = nullptr;
+    const char* busImport = nullptr;
+    const char* ticketImport = nullptr;
+    const char* exportKind = nullptr;
+    const char* reportKind = nullptr;
+    const char* queryKind = nullptr;
+    const char* exportPath = nullptr;
+    bool exportColumnar = false;
+    ExportFilter exportFilter = {0, INT_MAX, nullptr, nullptr, 0, -1, -1};
+    bool validDates = true;
+    int benchTickets = 0;
+    const char* benchResults = nullptr;
+    ScanQuery scanQuery = {0, nullptr, nullptr, 0, INT_MAX, 0, DBL_MAX, -1, 0};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fsync=group") == 0) {
+            fsyncPolicy = FSYNC_GROUP_COMMIT;
+        } else if (strcmp(argv[i], "--fsync=never") == 0) {
+            fsyncPolicy = FSYNC_NEVER;
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            serveAddress = argv[i] + 8;
+        } else if (strcmp(argv[i], "--follow") == 0) {
+            follow = true;
+        } else if (strncmp(argv[i], "--shard=", 8) == 0) {
+            validShard = sscanf(argv[i] + 8, "%d/%d", &shard.index, &shard.count) == 2 &&
+                         shard.count >= 1 && shard.count <= SHARD_MAX &&
+                         shard.index >= 0 && shard.index < shard.count;
+        } else if (strncmp(argv[i], "--shards=", 9) == 0) {
+            shardList = argv[i] + 9;
+        } else if (strcmp(argv[i], "--shard-by=route") == 0) {
+            shardBy = SHARD_BY_ROUTE;
+        } else if (strcmp(argv[i], "--shard-by=date") == 0) {
+            shardBy = SHARD_BY_DATE;
+        } else if (strncmp(argv[i], "--loadgen=", 10) == 0) {
+            loadAddress = argv[i] + 10;
+        } else if (strncmp(argv[i], "--metrics=", 10) == 0) {
+            metricsAddress = argv[i] + 10;
+        } else if (strncmp(argv[i], "--import-buses=", 15) == 0) {
+            busImport = argv[i] + 15;
+        } else if (strncmp(argv[i], "--import-tickets=", 17) == 0) {
+            ticketImport = argv[i] + 17;
+        } else if (strncmp(argv[i], "--report=", 9) == 0) {
+            reportKind = argv[i] + 9;
+        } else if (strncmp(argv[i], "--export=", 9) == 0) {
+            exportKind = argv[i] + 9;
+        } else if (strcmp(argv[i], "--format=columnar") == 0) {
+            exportColumnar = true;
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            exportPath = argv[i] + 9;
+        } else if (strncmp(argv[i], "--from=", 7) == 0) {
+            exportFilter.fromDate = packDate(argv[i] + 7);
+            validDates = validDates && exportFilter.fromDate != 0;
+        } else if (strncmp(argv[i], "--to=", 5) == 0) {
+            exportFilter.toDate = packDate(argv[i] + 5);
+            validDates = validDates && exportFilter.toDate != 0;
+        } else if (strncmp(argv[i], "--source=", 9) == 0) {
+            exportFilter.source = argv[i] + 9;
+        } else if (strncmp(argv[i], "--destination=", 14) == 0) {
+            exportFilter.destination = argv[i] + 14;
+        } else if (strncmp(argv[i], "--bus=", 6) == 0) {
+            exportFilter.busId = atoi(argv[i] + 6);
+        } else if (strncmp(argv[i], "--query=", 8) == 0) {
+            queryKind = argv[i] + 8;
+        } else if (strcmp(argv[i], "--status=booked") == 0) {
+            scanQuery.bookedState = 1;
+        } else if (strcmp(argv[i], "--status=cancelled") == 0) {
+            scanQuery.bookedState = 0;
+        } else if (strncmp(argv[i], "--min-fare=", 11) == 0) {
+            scanQuery.minFare = atof(argv[i] + 11);
+        } else if (strncmp(argv[i], "--max-fare=", 11) == 0) {
+            scanQuery.maxFare = atof(argv[i] + 11);
+        } else if (strncmp(argv[i], "--min-free=", 11) == 0) {
+            scanQuery.minFreeSeats = atoi(argv[i] + 11);
+        } else if (strcmp(argv[i], "--simd=scalar") == 0) {
+            simdLevel = SIMD_SCALAR;
+        } else if (strcmp(argv[i], "--simd=sse2") == 0) {
+            simdLevel = min(simdLevel, SIMD_SSE2);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            benchResults = "bench-results.csv";
+        } else if (strncmp(argv[i], "--bench=", 8) == 0) {
+            benchResults = argv[i] + 8;
+        } else if (strcmp(argv[i], "--bench-tickets") == 0) {
+            benchTickets = 4000000;
+        } else if (strncmp(argv[i], "--bench-tickets=", 16) == 0) {
+            benchTickets = atoi(argv[i] + 16);
+            if (benchTickets == 0) {
+                benchTickets = -1; // Rejected by the benchmark
             }
-            busFile.close();
         }
-        
-        // Load tickets
-        ifstream ticketFile("tickets.dat", ios::binary);
-        if (ticketFile.is_open()) {
-            ticketFile.read(reinterpret_cast<char*>(&ticketCount), sizeof(ticketCount));
-            ticketFile.read(reinterpret_cast<char*>(&nextTicketId), sizeof(nextTicketId));
-            
-            for (int i = 0; i < ticketCount; i++) {
-                ticketFile.read(reinterpret_cast<char*>(&tickets[i]), sizeof(Ticket));
-            }
-            ticketFile.close();
+    }
+    
+    if (!validShard) {
+        cout << "Use --shard=K/N with 0 <= K < N <= " << SHARD_MAX << ".\n";
+        return 1;
+    }
+    if (shardList && !serveAddress) {
+        cout << "A router needs an address: --serve=ADDRESS --shards=ADDRESS,...\n";
+        return 1;
+    }
+    
+    // Benchmarks never touch the data files in the current directory
+    if (benchTickets != 0) {
+        return runTicketBenchmark(benchTickets);
+    }
+    if (benchResults) {
+        return runBenchmark(benchResults, parseBenchOptions(argc, argv), fsyncPolicy);
+    }
+    
+    // Revenue report from a read-only snapshot
+    if (reportKind) {
+        if (!validDates) {
+            cout << "Dates must be DD/MM/YYYY.\n";
+            return 1;
+        }
+        ReservationService service(fsyncPolicy, OPEN_READ_ONLY);
+        return runReport(service, reportKind, exportFilter.fromDate, exportFilter.toDate);
+    }
+    
+    // Ad-hoc query over a read-only snapshot
+    if (queryKind) {
+        if (!validDates) {
+            cout << "Dates must be DD/MM/YYYY.\n";
+            return 1;
+        }
+        scanQuery.busId = exportFilter.busId;
+        scanQuery.source = exportFilter.source;
+        scanQuery.destination = exportFilter.destination;
+        scanQuery.fromDate = exportFilter.fromDate;
+        scanQuery.toDate = exportFilter.toDate;
+        ReservationService service(fsyncPolicy, OPEN_READ_ONLY);
+        return runQuery(service, queryKind, scanQuery);
+    }
+    
+    // Export: to <kind>.csv or <kind>.col unless --output is given. The data
+    // is opened read-only, so exports can run while a server owns it.
+    if (exportKind) {
+        if (!validDates) {
+            cout << "Dates must be DD/MM/YYYY.\n";
+            return 1;
+        }
+        string defaultPath = string(exportKind) + (exportColumnar ? ".col" : ".csv");
+        ReservationService service(fsyncPolicy, OPEN_READ_ONLY);
+        return runExport(service, exportKind, exportColumnar,
+                         exportPath ? exportPath : defaultPath.c_str(), exportFilter);
+    }
+    
+    // Bulk import: buses first, so tickets can refer to them
+    if (busImport || ticketImport) {
+        ReservationService service(fsyncPolicy, OPEN_READ_WRITE, shard);
+        long errors = 0;
+        if (busImport) {
+            errors += runImport(service, busImport, false);
+        }
+        if (ticketImport) {
+            errors += runImport(service, ticketImport, true);
+        }
+        service.checkpoint();
+        return errors == 0 ? 0 : 1;
+    }
+    
+    if (serveAddress || loadAddress || metricsAddress) {
+#ifdef __linux__
+        SocketAddress address;
+        const char* clientAddress = loadAddress ? loadAddress : metricsAddress;
+        if (!parseSocketAddress(clientAddress ? clientAddress : serveAddress, address)) {
+            cout << "Invalid address. Use unix:PATH, tcp:PORT or tcp:HOST:PORT.\n";
+            return 1;
+        }
+        if (loadAddress) {
+            return runLoadGenerator(address, parseLoadOptions(argc, argv));
+        }
+        if (metricsAddress) {
+            return printServerMetrics(address);
+        }
+        if (shardList) {
+            return runShardRouter(address, shardList, shardBy);
         }
         
-        // Load bus bills
-        ifstream billFile("busbills.dat", ios::binary);
-        if (billFile.is_open()) {
-            billFile.read(reinterpret_cast<char*>(&billCount), sizeof(billCount));
-            billFile.read(reinterpret_cast<char*>(&nextBillId), sizeof(nextBillId));
-            
-            for (int i = 0; i < billCount; i++) {
-                billFile.read(reinterpret_cast<char*>(&busBills[i]), sizeof(BusBill));
-            }
-            billFile.close();
+        ReservationService service(fsyncPolicy, follow ? OPEN_FOLLOWER : OPEN_READ_WRITE, shard);
+        for (const string& warning : service.startupWarnings()) {
+            cout << "Warning: " << warning << "\n";
+        }
+        ReservationServer server(service);
+        const char* error = server.listenOn(address);
+        if (error) {
+            cout << "Cannot start server: " << error << "\n";
+            return 1;
         }
+        cout << (follow ? "Following on " : "Serving on ") << serveAddress << " (Ctrl+C to stop)\n" << flush;
+        server.run();
+        return 0; // The service checkpoints as it goes out of scope
+#else
+        cout << "Server, load generator and metrics modes are only available on Linux.\n";
+        return 1;
+#endif
     }
-};
-
-int main() {
-    BusReservationSystem busSystem;
+    
+    ReservationService service(fsyncPolicy, OPEN_READ_WRITE, shard);
+    BusReservationSystem busSystem(service);
     
     busSystem.clearScreen();
     busSystem.displayHeader("BUS TICKET RESERVATION SYSTEM");
+    for (const string& warning : service.startupWarnings()) {
+        cout << "\nWarning: " << warning;
+    }
     cout << "\nPress Enter to continue...";
     cin.get();
     